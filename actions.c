@@ -8,14 +8,16 @@
 static bool daklakwl_seat_handle_enable(struct daklakwl_seat *seat)
 {
 	seat->is_composing = true;
+	daklakwl_seat_grab_update(seat);
 	return true;
 }
 
 static bool daklakwl_seat_handle_disable(struct daklakwl_seat *seat)
 {
 	seat->is_composing = false;
-	daklakwl_buffer_clear(&seat->buffer);
+	seat->engine->reset(&seat->buffer);
 	daklakwl_seat_composing_update(seat);
+	daklakwl_seat_grab_update(seat);
 	return true;
 }
 
@@ -33,7 +35,7 @@ static bool daklakwl_seat_handle_delete_left(struct daklakwl_seat *seat)
 		return true;
 	if (seat->buffer.len == 0)
 		return true;
-	daklakwl_buffer_delete_backwards_all(&seat->buffer, 1);
+	seat->engine->delete_left(&seat->buffer);
 	daklakwl_seat_composing_update(seat);
 	if (seat->buffer.len == 0)
 		daklakwl_seat_composing_commit(seat);
@@ -46,7 +48,7 @@ static bool daklakwl_seat_handle_delete_right(struct daklakwl_seat *seat)
 		return true;
 	if (seat->buffer.len == 0)
 		return true;
-	daklakwl_buffer_delete_forwards_all(&seat->buffer, 1);
+	seat->engine->delete_right(&seat->buffer);
 	daklakwl_seat_composing_update(seat);
 	if (seat->buffer.len == 0)
 		daklakwl_seat_composing_commit(seat);
@@ -59,7 +61,7 @@ static bool daklakwl_seat_handle_move_left(struct daklakwl_seat *seat)
 		return true;
 	if (seat->buffer.len == 0)
 		return true;
-	daklakwl_buffer_move_left(&seat->buffer);
+	seat->engine->move_left(&seat->buffer);
 	daklakwl_seat_composing_update(seat);
 	return true;
 }
@@ -74,7 +76,7 @@ static bool daklakwl_seat_handle_move_right(struct daklakwl_seat *seat)
 		daklakwl_seat_composing_commit(seat);
 		return false;
 	}
-	daklakwl_buffer_move_right(&seat->buffer);
+	seat->engine->move_right(&seat->buffer);
 	daklakwl_seat_composing_update(seat);
 	return true;
 }
@@ -101,11 +103,18 @@ static bool daklakwl_seat_handle_discard(struct daklakwl_seat *seat)
 {
 	if (!seat->is_composing)
 		return true;
-	daklakwl_buffer_clear(&seat->buffer);
+	seat->engine->reset(&seat->buffer);
 	daklakwl_seat_composing_commit(seat);
 	return true;
 }
 
+static bool daklakwl_seat_handle_next_method(struct daklakwl_seat *seat)
+{
+	daklakwl_state_set_engine(seat->state,
+				  daklakwl_engine_next(seat->engine));
+	return true;
+}
+
 enum daklakwl_action daklakwl_action_from_string(const char *name)
 {
 	if (strcmp(name, "enable") == 0)
@@ -128,6 +137,8 @@ enum daklakwl_action daklakwl_action_from_string(const char *name)
 		return DAKLAKWL_ACTION_ACCEPT;
 	if (strcmp(name, "discard") == 0)
 		return DAKLAKWL_ACTION_DISCARD;
+	if (strcmp(name, "next-method") == 0)
+		return DAKLAKWL_ACTION_NEXT_METHOD;
 	return DAKLAKWL_ACTION_INVALID;
 }
 
@@ -144,6 +155,7 @@ static bool (*daklakwl_seat_action_handlers[_DAKLAKWL_ACTION_LAST])(
 	[DAKLAKWL_ACTION_COMPOSE] = daklakwl_seat_handle_compose,
 	[DAKLAKWL_ACTION_ACCEPT] = daklakwl_seat_handle_accept,
 	[DAKLAKWL_ACTION_DISCARD] = daklakwl_seat_handle_discard,
+	[DAKLAKWL_ACTION_NEXT_METHOD] = daklakwl_seat_handle_next_method,
 };
 
 bool daklakwl_seat_handle_action(struct daklakwl_seat *seat,
@@ -16,6 +16,7 @@ enum daklakwl_action {
 	DAKLAKWL_ACTION_COMPOSE,
 	DAKLAKWL_ACTION_ACCEPT,
 	DAKLAKWL_ACTION_DISCARD,
+	DAKLAKWL_ACTION_NEXT_METHOD,
 	_DAKLAKWL_ACTION_LAST,
 };
 
@@ -0,0 +1,279 @@
+#include "atlas.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "buffer.h"
+#include "metrics.h"
+
+#define DAKLAKWL_ATLAS_CHUNK_SIZE (64 * 1024)
+
+static size_t daklakwl_atlas_hash(uint32_t codepoint, uint16_t size,
+				  uint8_t scale)
+{
+	uint64_t key = (uint64_t)codepoint << 24 | (uint64_t)size << 8 | scale;
+	key *= 0x9e3779b97f4a7c15ULL;
+	return key >> 32;
+}
+
+static struct daklakwl_glyph *
+daklakwl_atlas_find(struct daklakwl_glyph *glyphs, size_t cap,
+		    uint32_t codepoint, uint16_t size, uint8_t scale)
+{
+	size_t mask = cap - 1;
+	for (size_t i = daklakwl_atlas_hash(codepoint, size, scale) & mask;;
+	     i = (i + 1) & mask) {
+		struct daklakwl_glyph *glyph = &glyphs[i];
+		if (!glyph->used
+		    || (glyph->codepoint == codepoint && glyph->size == size
+			&& glyph->scale == scale))
+			return glyph;
+	}
+}
+
+static uint8_t *daklakwl_atlas_alloc(struct daklakwl_atlas *atlas,
+				     size_t size)
+{
+	if (atlas->chunks_len == 0
+	    || atlas->chunk_used + size > DAKLAKWL_ATLAS_CHUNK_SIZE) {
+		size_t chunk_size = size > DAKLAKWL_ATLAS_CHUNK_SIZE
+					? size
+					: DAKLAKWL_ATLAS_CHUNK_SIZE;
+		atlas->chunks
+		    = realloc(atlas->chunks,
+			      (atlas->chunks_len + 1) * sizeof *atlas->chunks);
+		atlas->chunks[atlas->chunks_len++] = malloc(chunk_size);
+		atlas->chunk_used = 0;
+	}
+	uint8_t *p = atlas->chunks[atlas->chunks_len - 1] + atlas->chunk_used;
+	atlas->chunk_used += size;
+	return p;
+}
+
+// Must be called with the lock held.
+static struct daklakwl_glyph
+daklakwl_atlas_insert(struct daklakwl_atlas *atlas, uint32_t codepoint,
+		      uint16_t size, uint8_t scale, FT_GlyphSlot slot)
+{
+	if ((atlas->glyphs_len + 1) * 2 > atlas->glyphs_cap) {
+		size_t cap = atlas->glyphs_cap ? atlas->glyphs_cap * 2 : 512;
+		struct daklakwl_glyph *glyphs = calloc(cap, sizeof *glyphs);
+		for (size_t i = 0; i < atlas->glyphs_cap; i++) {
+			struct daklakwl_glyph *old = &atlas->glyphs[i];
+			if (old->used)
+				*daklakwl_atlas_find(glyphs, cap,
+						     old->codepoint, old->size,
+						     old->scale)
+				    = *old;
+		}
+		free(atlas->glyphs);
+		atlas->glyphs = glyphs;
+		atlas->glyphs_cap = cap;
+	}
+	struct daklakwl_glyph *glyph = daklakwl_atlas_find(
+	    atlas->glyphs, atlas->glyphs_cap, codepoint, size, scale);
+	if (glyph->used)
+		return *glyph;
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_GLYPHS, 1);
+
+	FT_Bitmap const *bitmap = &slot->bitmap;
+	uint8_t *mask = daklakwl_atlas_alloc(atlas, (size_t)bitmap->width
+							* bitmap->rows);
+	for (unsigned int row = 0; row < bitmap->rows; row++)
+		memcpy(mask + row * bitmap->width,
+		       bitmap->buffer + row * bitmap->pitch, bitmap->width);
+	*glyph = (struct daklakwl_glyph){
+	    .codepoint = codepoint,
+	    .size = size,
+	    .scale = scale,
+	    .used = true,
+	    .left = slot->bitmap_left,
+	    .top = slot->bitmap_top,
+	    .advance = slot->advance.x >> 6,
+	    .width = bitmap->width,
+	    .height = bitmap->rows,
+	    .mask = mask,
+	};
+	atlas->glyphs_len++;
+	return *glyph;
+}
+
+static struct daklakwl_glyph daklakwl_atlas_get(struct daklakwl_atlas *atlas,
+						struct daklakwl_font *font,
+						uint32_t codepoint)
+{
+	struct daklakwl_glyph glyph = {0};
+	pthread_mutex_lock(&atlas->lock);
+	if (atlas->glyphs_cap)
+		glyph = *daklakwl_atlas_find(atlas->glyphs, atlas->glyphs_cap,
+					     codepoint, font->pixel_size,
+					     font->scale);
+	pthread_mutex_unlock(&atlas->lock);
+	if (glyph.used)
+		return glyph;
+
+	FT_UInt index = FT_Get_Char_Index(font->ft_face, codepoint);
+	if (FT_Load_Glyph(font->ft_face, index, FT_LOAD_RENDER) != 0)
+		return glyph;
+	pthread_mutex_lock(&atlas->lock);
+	glyph = daklakwl_atlas_insert(atlas, codepoint, font->pixel_size,
+				      font->scale, font->ft_face->glyph);
+	pthread_mutex_unlock(&atlas->lock);
+	return glyph;
+}
+
+static void *daklakwl_atlas_warm_thread(void *data)
+{
+	struct daklakwl_atlas *atlas = data;
+	wchar_t repertoire[512];
+	size_t len = daklakwl_buffer_repertoire(repertoire, 512);
+	for (uint32_t c = 0x20; c < 0x7f && len < 512; c++)
+		repertoire[len++] = c;
+
+	// FreeType faces are not thread-safe, so warm up with a face of
+	// our own.
+	FT_Library library;
+	FT_Face face;
+	if (FT_Init_FreeType(&library) != 0)
+		return NULL;
+	if (FT_New_Face(library, atlas->font_file, atlas->font_index, &face)
+	    != 0) {
+		FT_Done_FreeType(library);
+		return NULL;
+	}
+	for (size_t s = 0; s < atlas->warm_scales_len; s++) {
+		int scale = atlas->warm_scales[s];
+		FT_Set_Pixel_Sizes(face, 0, atlas->font_size * scale);
+		for (size_t i = 0; i < len; i++) {
+			pthread_mutex_lock(&atlas->lock);
+			bool cached
+			    = atlas->cancel
+			      || (atlas->glyphs_cap
+				  && daklakwl_atlas_find(
+					 atlas->glyphs, atlas->glyphs_cap,
+					 repertoire[i], atlas->font_size,
+					 scale)
+					 ->used);
+			bool cancel = atlas->cancel;
+			pthread_mutex_unlock(&atlas->lock);
+			if (cancel)
+				goto done;
+			if (cached)
+				continue;
+			FT_UInt index = FT_Get_Char_Index(face, repertoire[i]);
+			if (FT_Load_Glyph(face, index, FT_LOAD_RENDER) != 0)
+				continue;
+			pthread_mutex_lock(&atlas->lock);
+			daklakwl_atlas_insert(atlas, repertoire[i],
+					      atlas->font_size, scale,
+					      face->glyph);
+			pthread_mutex_unlock(&atlas->lock);
+		}
+	}
+done:
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+	return NULL;
+}
+
+void daklakwl_atlas_init(struct daklakwl_atlas *atlas)
+{
+	memset(atlas, 0, sizeof *atlas);
+	pthread_mutex_init(&atlas->lock, NULL);
+}
+
+void daklakwl_atlas_warm(struct daklakwl_atlas *atlas,
+			 struct daklakwl_font *font, int const *scales,
+			 size_t scales_len)
+{
+	if (atlas->has_thread || font->ft_face == NULL)
+		return;
+	free(atlas->font_file);
+	atlas->font_file = strdup(font->file);
+	atlas->font_index = font->index;
+	atlas->font_size = font->pixel_size;
+	atlas->warm_scales_len = 0;
+	for (size_t i = 0; i < scales_len && i < 4; i++)
+		atlas->warm_scales[atlas->warm_scales_len++] = scales[i];
+	if (pthread_create(&atlas->thread, NULL, daklakwl_atlas_warm_thread,
+			   atlas)
+	    == 0)
+		atlas->has_thread = true;
+}
+
+void daklakwl_atlas_finish(struct daklakwl_atlas *atlas)
+{
+	if (atlas->has_thread) {
+		pthread_mutex_lock(&atlas->lock);
+		atlas->cancel = true;
+		pthread_mutex_unlock(&atlas->lock);
+		pthread_join(atlas->thread, NULL);
+	}
+	pthread_mutex_destroy(&atlas->lock);
+	for (size_t i = 0; i < atlas->chunks_len; i++)
+		free(atlas->chunks[i]);
+	free(atlas->chunks);
+	free(atlas->glyphs);
+	free(atlas->font_file);
+	memset(atlas, 0, sizeof *atlas);
+}
+
+int daklakwl_atlas_measure(struct daklakwl_atlas *atlas,
+			   struct daklakwl_font *font, char const *text)
+{
+	int width = 0;
+	while (*text)
+		width += daklakwl_atlas_get(atlas, font,
+					    daklakwl_utf8_next(&text))
+			     .advance;
+	return width;
+}
+
+static void daklakwl_atlas_blend(uint32_t *pixel, uint8_t coverage,
+				 uint32_t color)
+{
+	if (coverage == 0)
+		return;
+	if (coverage == 0xff) {
+		*pixel = color;
+		return;
+	}
+	uint32_t dst = *pixel, out = 0xff000000;
+	for (int shift = 0; shift < 24; shift += 8) {
+		uint32_t s = (color >> shift) & 0xff;
+		uint32_t d = (dst >> shift) & 0xff;
+		out |= ((s * coverage + d * (255 - coverage)) / 255) << shift;
+	}
+	*pixel = out;
+}
+
+int daklakwl_atlas_draw(struct daklakwl_atlas *atlas,
+			struct daklakwl_font *font, uint32_t *data,
+			int stride, int width, int height, int x, int y,
+			char const *text, uint32_t color)
+{
+	int baseline = y + font->ascent;
+	while (*text) {
+		struct daklakwl_glyph glyph = daklakwl_atlas_get(
+		    atlas, font, daklakwl_utf8_next(&text));
+		int left = x + glyph.left;
+		int top = baseline - glyph.top;
+		for (int row = 0; row < glyph.height; row++) {
+			int py = top + row;
+			if (py < 0 || py >= height)
+				continue;
+			uint32_t *line = data + py * (stride / 4);
+			uint8_t const *src = glyph.mask + row * glyph.width;
+			for (int col = 0; col < glyph.width; col++) {
+				int px = left + col;
+				if (px >= 0 && px < width)
+					daklakwl_atlas_blend(&line[px], src[col],
+							     color);
+			}
+		}
+		x += glyph.advance;
+	}
+	return x;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "font.h"
+
+struct daklakwl_glyph {
+	uint32_t codepoint;
+	uint16_t size;
+	uint8_t scale;
+	bool used;
+	int16_t left, top, advance;
+	uint16_t width, height;
+	uint8_t const *mask;
+};
+
+// Coverage masks rasterized once per (glyph, size, scale). Masks live in
+// fixed chunks that are never moved, so a looked-up glyph stays valid
+// while it is blitted without holding the lock.
+struct daklakwl_atlas {
+	pthread_mutex_t lock;
+	struct daklakwl_glyph *glyphs;
+	size_t glyphs_cap;
+	size_t glyphs_len;
+	uint8_t **chunks;
+	size_t chunks_len;
+	size_t chunk_used;
+
+	pthread_t thread;
+	bool has_thread;
+	bool cancel;
+	int warm_scales[4];
+	size_t warm_scales_len;
+	char *font_file;
+	int font_index;
+	int font_size;
+};
+
+void daklakwl_atlas_init(struct daklakwl_atlas *);
+void daklakwl_atlas_finish(struct daklakwl_atlas *);
+void daklakwl_atlas_warm(struct daklakwl_atlas *, struct daklakwl_font *,
+			 int const *scales, size_t scales_len);
+int daklakwl_atlas_measure(struct daklakwl_atlas *, struct daklakwl_font *,
+			   char const *text);
+int daklakwl_atlas_draw(struct daklakwl_atlas *, struct daklakwl_font *,
+			uint32_t *data, int stride, int width, int height,
+			int x, int y, char const *text, uint32_t color);
@@ -0,0 +1,976 @@
+// Stand-in compositor for measuring daklak. It offers a number of seats,
+// types the same text on all of them at once and reports, per seat, how
+// long daklak takes to answer each key press: an input method commit or a
+// key sent back through the virtual keyboard. Each seat has a text field
+// that takes those answers the way a text-input client would and reports
+// its text back as surrounding text.
+//
+//	daklak-bench [-v] [-s seats] [-n keys] [-i interval-ms]
+//		     [-r log [-f]] [command...]
+//
+// The command, typically build/daklak, is started with WAYLAND_DISPLAY
+// pointing at the bench; without one the bench waits for an input method
+// started by hand. -v prints what ended up in each text field. The exit
+// status is nonzero when daklak died or answered no key at all, so the
+// bench can run unattended.
+//
+// -r replays a session daklak recorded (see record.h) instead of typing,
+// at its original pace or, with -f, each key as soon as the one before
+// was answered. Recorded seats are spread over the bench's seats.
+
+#include <getopt.h>
+#include <linux/input-event-codes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "input-method-unstable-v2-server-protocol.h"
+#include "record.h"
+#include "text-input-unstable-v3-server-protocol.h"
+#include "virtual-keyboard-unstable-v1-server-protocol.h"
+
+struct bench;
+
+// What answered a key: text committed, the preedit changed, or the key
+// went back through the virtual keyboard.
+enum bench_answer {
+	BENCH_ANSWER_COMMIT,
+	BENCH_ANSWER_PREEDIT,
+	BENCH_ANSWER_FORWARD,
+	_BENCH_ANSWER_LAST,
+};
+
+static char const *const bench_answer_names[_BENCH_ANSWER_LAST] = {
+    [BENCH_ANSWER_COMMIT] = "commit",
+    [BENCH_ANSWER_PREEDIT] = "preedit",
+    [BENCH_ANSWER_FORWARD] = "fwd",
+};
+
+// The focused text field, cursor always at the end.
+struct bench_field {
+	struct wl_array text;
+	// input method requests waiting for its commit
+	char *pending_commit;
+	uint32_t pending_delete;
+};
+
+struct bench_seat {
+	struct bench *bench;
+	int index;
+	struct wl_global *global;
+	struct wl_resource *input_method;
+	struct wl_resource *grab;
+	// keys typed so far, and when the one still unanswered went out
+	size_t typed;
+	bool waiting;
+	struct timespec sent;
+	size_t missed;
+	// nanoseconds per answered key
+	struct wl_array latencies;
+	struct wl_array answers[_BENCH_ANSWER_LAST];
+	struct bench_field field;
+};
+
+struct bench {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_event_source *tick;
+	struct wl_event_source *child_exit;
+	struct bench_seat *seats;
+	int seats_len;
+	int grabs;
+	size_t keys;
+	int interval_ms;
+	bool verbose;
+	char *keymap;
+	size_t keymap_size;
+	pid_t child;
+	size_t answered;
+	struct bench_replay *replay;
+};
+
+// Replay of a recorded session, see bench_replay_step.
+struct bench_replay {
+	FILE *file;
+	bool fast;
+	struct daklakwl_record_event next;
+	bool has_next, ended;
+	struct timespec start;
+	// recorded time of next, in microseconds since the start
+	uint64_t next_us;
+	// recorded seat ids in order of appearance
+	uint32_t seats[64];
+	int seats_len;
+	// waiting on this seat's answer before going on
+	struct bench_seat *blocked;
+	uint32_t serial;
+	bool reported;
+};
+
+static char const bench_text[] = "vieejt nam xin chaof cacs banj ";
+
+static uint64_t bench_ns_since(struct timespec const *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec
+	       - start->tv_nsec;
+}
+
+static uint32_t bench_keycode(char c)
+{
+	static uint8_t const letters[26] = {
+	    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I,
+	    KEY_J, KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R,
+	    KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+	};
+	if (c >= 'a' && c <= 'z')
+		return letters[c - 'a'];
+	return KEY_SPACE;
+}
+
+static char bench_char(uint32_t key)
+{
+	for (char c = 'a'; c <= 'z'; c++) {
+		if (bench_keycode(c) == key)
+			return c;
+	}
+	return key == KEY_SPACE ? ' ' : '\0';
+}
+
+static void bench_replay_resume(void *data);
+
+static void bench_seat_answered(struct bench_seat *seat,
+				enum bench_answer answer)
+{
+	if (!seat->waiting)
+		return;
+	seat->waiting = false;
+	uint64_t ns = bench_ns_since(&seat->sent);
+	*(uint64_t *)wl_array_add(&seat->latencies, sizeof ns) = ns;
+	*(uint64_t *)wl_array_add(&seat->answers[answer], sizeof ns) = ns;
+	struct bench *bench = seat->bench;
+	if (bench->replay != NULL && bench->replay->blocked == seat) {
+		bench->replay->blocked = NULL;
+		wl_event_loop_add_idle(bench->loop, bench_replay_resume, bench);
+	}
+}
+
+// Tells the input method what the field now holds, as the compositor
+// does once the text-input client commits.
+static void bench_field_send(struct bench_seat *seat, uint32_t cause)
+{
+	struct bench_field *field = &seat->field;
+	if (seat->input_method == NULL)
+		return;
+	// surrounding text is limited to 4000 bytes, keep whole characters
+	size_t start = field->text.size > 4000 ? field->text.size - 4000 : 0;
+	char *text = field->text.data;
+	while (start < field->text.size && (text[start] & 0xc0) == 0x80)
+		start++;
+	char *surrounding = strndup(text + start, field->text.size - start);
+	uint32_t cursor = field->text.size - start;
+	zwp_input_method_v2_send_surrounding_text(seat->input_method,
+						  surrounding, cursor, cursor);
+	zwp_input_method_v2_send_text_change_cause(seat->input_method, cause);
+	zwp_input_method_v2_send_done(seat->input_method);
+	free(surrounding);
+}
+
+static void bench_resource_destroy(struct wl_client *client,
+				   struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+// wl_surface and wl_region, only as much as the candidate popup needs
+
+static void surface_attach(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *buffer, int32_t x, int32_t y)
+{
+	wl_resource_set_user_data(resource, buffer);
+}
+
+static void surface_damage(struct wl_client *client,
+			   struct wl_resource *resource, int32_t x, int32_t y,
+			   int32_t width, int32_t height)
+{
+}
+
+static void surface_frame(struct wl_client *client,
+			  struct wl_resource *resource, uint32_t callback)
+{
+	struct wl_resource *wl_callback
+	    = wl_resource_create(client, &wl_callback_interface, 1, callback);
+	wl_callback_send_done(wl_callback, 0);
+	wl_resource_destroy(wl_callback);
+}
+
+static void surface_set_region(struct wl_client *client,
+			       struct wl_resource *resource,
+			       struct wl_resource *region)
+{
+}
+
+static void surface_commit(struct wl_client *client,
+			   struct wl_resource *resource)
+{
+	// pretend the contents were copied right away
+	struct wl_resource *buffer = wl_resource_get_user_data(resource);
+	if (buffer != NULL)
+		wl_buffer_send_release(buffer);
+	wl_resource_set_user_data(resource, NULL);
+}
+
+static void surface_set_int(struct wl_client *client,
+			    struct wl_resource *resource, int32_t value)
+{
+}
+
+static struct wl_surface_interface const surface_impl = {
+    .destroy = bench_resource_destroy,
+    .attach = surface_attach,
+    .damage = surface_damage,
+    .frame = surface_frame,
+    .set_opaque_region = surface_set_region,
+    .set_input_region = surface_set_region,
+    .commit = surface_commit,
+    .set_buffer_transform = surface_set_int,
+    .set_buffer_scale = surface_set_int,
+    .damage_buffer = surface_damage,
+};
+
+static void region_rect(struct wl_client *client,
+			struct wl_resource *resource, int32_t x, int32_t y,
+			int32_t width, int32_t height)
+{
+}
+
+static struct wl_region_interface const region_impl = {
+    .destroy = bench_resource_destroy,
+    .add = region_rect,
+    .subtract = region_rect,
+};
+
+static void compositor_create_surface(struct wl_client *client,
+				      struct wl_resource *resource,
+				      uint32_t id)
+{
+	struct wl_resource *surface
+	    = wl_resource_create(client, &wl_surface_interface,
+				 wl_resource_get_version(resource), id);
+	wl_resource_set_implementation(surface, &surface_impl, NULL, NULL);
+}
+
+static void compositor_create_region(struct wl_client *client,
+				     struct wl_resource *resource, uint32_t id)
+{
+	struct wl_resource *region = wl_resource_create(
+	    client, &wl_region_interface, 1, id);
+	wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static struct wl_compositor_interface const compositor_impl = {
+    .create_surface = compositor_create_surface,
+    .create_region = compositor_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data,
+			    uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource
+	    = wl_resource_create(client, &wl_compositor_interface, version, id);
+	wl_resource_set_implementation(resource, &compositor_impl, data, NULL);
+}
+
+// wl_seat; daklak never asks for its devices
+
+static void seat_get_device(struct wl_client *client,
+			    struct wl_resource *resource, uint32_t id)
+{
+}
+
+static void seat_release(struct wl_client *client,
+			 struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static struct wl_seat_interface const seat_impl = {
+    .get_pointer = seat_get_device,
+    .get_keyboard = seat_get_device,
+    .get_touch = seat_get_device,
+    .release = seat_release,
+};
+
+static void seat_bind(struct wl_client *client, void *data, uint32_t version,
+		      uint32_t id)
+{
+	struct bench_seat *seat = data;
+	struct wl_resource *resource
+	    = wl_resource_create(client, &wl_seat_interface, version, id);
+	wl_resource_set_implementation(resource, &seat_impl, seat, NULL);
+	wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_KEYBOARD);
+	if (version >= WL_SEAT_NAME_SINCE_VERSION) {
+		char name[32];
+		snprintf(name, sizeof name, "bench%d", seat->index);
+		wl_seat_send_name(resource, name);
+	}
+}
+
+// zwp_input_method_v2 and its keyboard grab
+
+static void input_method_commit_string(struct wl_client *client,
+				       struct wl_resource *resource,
+				       char const *text)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	free(seat->field.pending_commit);
+	seat->field.pending_commit = strdup(text);
+}
+
+static void input_method_set_preedit_string(struct wl_client *client,
+					    struct wl_resource *resource,
+					    char const *text,
+					    int32_t cursor_begin,
+					    int32_t cursor_end)
+{
+	// shown over the field, not part of its text
+}
+
+static void input_method_delete_surrounding_text(
+    struct wl_client *client, struct wl_resource *resource,
+    uint32_t before_length, uint32_t after_length)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	seat->field.pending_delete = before_length;
+}
+
+static void input_method_commit(struct wl_client *client,
+				struct wl_resource *resource, uint32_t serial)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	struct bench_field *field = &seat->field;
+	// an empty commit still clears the preedit
+	bench_seat_answered(seat, field->pending_commit != NULL
+				      ? BENCH_ANSWER_COMMIT
+				      : BENCH_ANSWER_PREEDIT);
+	if (field->pending_commit == NULL && field->pending_delete == 0)
+		return;
+	field->text.size -= field->pending_delete < field->text.size
+				? field->pending_delete
+				: field->text.size;
+	if (field->pending_commit != NULL) {
+		size_t len = strlen(field->pending_commit);
+		memcpy(wl_array_add(&field->text, len), field->pending_commit,
+		       len);
+	}
+	free(field->pending_commit);
+	field->pending_commit = NULL;
+	field->pending_delete = 0;
+	bench_field_send(seat, ZWP_TEXT_INPUT_V3_CHANGE_CAUSE_INPUT_METHOD);
+}
+
+static struct zwp_input_popup_surface_v2_interface const popup_surface_impl
+    = {
+	.destroy = bench_resource_destroy,
+};
+
+static void input_method_get_input_popup_surface(
+    struct wl_client *client, struct wl_resource *resource, uint32_t id,
+    struct wl_resource *surface)
+{
+	struct wl_resource *popup_surface = wl_resource_create(
+	    client, &zwp_input_popup_surface_v2_interface, 1, id);
+	wl_resource_set_implementation(popup_surface, &popup_surface_impl,
+				       NULL, NULL);
+}
+
+static void grab_destroy(struct wl_resource *resource)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	if (seat->grab == resource)
+		seat->grab = NULL;
+}
+
+static struct zwp_input_method_keyboard_grab_v2_interface const grab_impl = {
+    .release = bench_resource_destroy,
+};
+
+static void bench_seat_send_keymap(struct bench_seat *seat, char const *data,
+				   size_t size)
+{
+	int fd = memfd_create("daklak-bench-keymap", MFD_CLOEXEC);
+	if (fd == -1 || write(fd, data, size) != (ssize_t)size) {
+		perror("keymap");
+		exit(1);
+	}
+	zwp_input_method_keyboard_grab_v2_send_keymap(
+	    seat->grab, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size);
+	close(fd);
+}
+
+static void input_method_grab_keyboard(struct wl_client *client,
+				       struct wl_resource *resource,
+				       uint32_t id)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	struct bench *bench = seat->bench;
+	seat->grab = wl_resource_create(
+	    client, &zwp_input_method_keyboard_grab_v2_interface, 1, id);
+	wl_resource_set_implementation(seat->grab, &grab_impl, seat,
+				       grab_destroy);
+	bench_seat_send_keymap(seat, bench->keymap, bench->keymap_size);
+	// no repeat, every key is typed by the bench itself
+	zwp_input_method_keyboard_grab_v2_send_repeat_info(seat->grab, 0,
+							    600);
+	zwp_input_method_keyboard_grab_v2_send_modifiers(seat->grab, 0, 0, 0,
+							 0, 0);
+	if (++bench->grabs == bench->seats_len)
+		wl_event_source_timer_update(bench->tick, bench->interval_ms);
+}
+
+static struct zwp_input_method_v2_interface const input_method_impl = {
+    .commit_string = input_method_commit_string,
+    .set_preedit_string = input_method_set_preedit_string,
+    .delete_surrounding_text = input_method_delete_surrounding_text,
+    .commit = input_method_commit,
+    .get_input_popup_surface = input_method_get_input_popup_surface,
+    .grab_keyboard = input_method_grab_keyboard,
+    .destroy = bench_resource_destroy,
+};
+
+static void input_method_destroy(struct wl_resource *resource)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	if (seat->input_method == resource)
+		seat->input_method = NULL;
+}
+
+static void input_method_manager_get_input_method(
+    struct wl_client *client, struct wl_resource *resource,
+    struct wl_resource *seat_resource, uint32_t id)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(seat_resource);
+	seat->input_method = wl_resource_create(
+	    client, &zwp_input_method_v2_interface, 1, id);
+	wl_resource_set_implementation(seat->input_method, &input_method_impl,
+				       seat, input_method_destroy);
+	// a text field has focus from the start
+	zwp_input_method_v2_send_activate(seat->input_method);
+	zwp_input_method_v2_send_content_type(
+	    seat->input_method, 0, 0);
+	zwp_input_method_v2_send_done(seat->input_method);
+}
+
+static struct zwp_input_method_manager_v2_interface const
+    input_method_manager_impl = {
+	.get_input_method = input_method_manager_get_input_method,
+	.destroy = bench_resource_destroy,
+};
+
+static void input_method_manager_bind(struct wl_client *client, void *data,
+				      uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource = wl_resource_create(
+	    client, &zwp_input_method_manager_v2_interface, version, id);
+	wl_resource_set_implementation(resource, &input_method_manager_impl,
+				       data, NULL);
+}
+
+// zwp_virtual_keyboard_v1, where daklak sends keys it does not take
+
+static void virtual_keyboard_keymap(struct wl_client *client,
+				    struct wl_resource *resource,
+				    uint32_t format, int32_t fd, uint32_t size)
+{
+	close(fd);
+}
+
+static void virtual_keyboard_key(struct wl_client *client,
+				 struct wl_resource *resource, uint32_t time,
+				 uint32_t key, uint32_t state)
+{
+	struct bench_seat *seat = wl_resource_get_user_data(resource);
+	if (state != WL_KEYBOARD_KEY_STATE_PRESSED)
+		return;
+	bench_seat_answered(seat, BENCH_ANSWER_FORWARD);
+	// the field types it like any other key
+	char c = bench_char(key);
+	if (c != '\0') {
+		*(char *)wl_array_add(&seat->field.text, 1) = c;
+		bench_field_send(seat, ZWP_TEXT_INPUT_V3_CHANGE_CAUSE_OTHER);
+	}
+}
+
+static void virtual_keyboard_modifiers(struct wl_client *client,
+				       struct wl_resource *resource,
+				       uint32_t mods_depressed,
+				       uint32_t mods_latched,
+				       uint32_t mods_locked, uint32_t group)
+{
+}
+
+static struct zwp_virtual_keyboard_v1_interface const virtual_keyboard_impl
+    = {
+	.keymap = virtual_keyboard_keymap,
+	.key = virtual_keyboard_key,
+	.modifiers = virtual_keyboard_modifiers,
+	.destroy = bench_resource_destroy,
+};
+
+static void virtual_keyboard_manager_create_virtual_keyboard(
+    struct wl_client *client, struct wl_resource *resource,
+    struct wl_resource *seat_resource, uint32_t id)
+{
+	struct wl_resource *virtual_keyboard = wl_resource_create(
+	    client, &zwp_virtual_keyboard_v1_interface, 1, id);
+	wl_resource_set_implementation(
+	    virtual_keyboard, &virtual_keyboard_impl,
+	    wl_resource_get_user_data(seat_resource), NULL);
+}
+
+static struct zwp_virtual_keyboard_manager_v1_interface const
+    virtual_keyboard_manager_impl = {
+	.create_virtual_keyboard
+	= virtual_keyboard_manager_create_virtual_keyboard,
+};
+
+static void virtual_keyboard_manager_bind(struct wl_client *client,
+					  void *data, uint32_t version,
+					  uint32_t id)
+{
+	struct wl_resource *resource = wl_resource_create(
+	    client, &zwp_virtual_keyboard_manager_v1_interface, version, id);
+	wl_resource_set_implementation(
+	    resource, &virtual_keyboard_manager_impl, data, NULL);
+}
+
+// typing and reporting
+
+static int bench_compare_u64(void const *_a, void const *_b)
+{
+	uint64_t a = *(uint64_t const *)_a, b = *(uint64_t const *)_b;
+	return a < b ? -1 : a > b;
+}
+
+static void bench_report_row(char const *name, struct wl_array *latencies,
+			     size_t missed, int seats)
+{
+	size_t len = latencies->size / sizeof(uint64_t);
+	uint64_t *ns = latencies->data;
+	if (len == 0) {
+		printf("%5d %6s %6zu %6zu %9s %9s %9s\n", seats, name, len,
+		       missed, "-", "-", "-");
+		return;
+	}
+	qsort(ns, len, sizeof *ns, bench_compare_u64);
+	printf("%5d %6s %6zu %6zu %9.1f %9.1f %9.1f\n", seats, name, len,
+	       missed, ns[len / 2] / 1e3, ns[len * 99 / 100] / 1e3,
+	       ns[len - 1] / 1e3);
+}
+
+// Returns the number of keys answered.
+static size_t bench_report(struct bench *bench)
+{
+	struct wl_array all, answers[_BENCH_ANSWER_LAST];
+	wl_array_init(&all);
+	for (int i = 0; i < _BENCH_ANSWER_LAST; i++)
+		wl_array_init(&answers[i]);
+	size_t missed = 0;
+	printf("seats   seat   keys missed   p50 us    p99 us    max us\n");
+	for (int i = 0; i < bench->seats_len; i++) {
+		struct bench_seat *seat = &bench->seats[i];
+		char name[16];
+		snprintf(name, sizeof name, "%d", i);
+		memcpy(wl_array_add(&all, seat->latencies.size),
+		       seat->latencies.data, seat->latencies.size);
+		for (int j = 0; j < _BENCH_ANSWER_LAST; j++)
+			memcpy(wl_array_add(&answers[j],
+					    seat->answers[j].size),
+			       seat->answers[j].data, seat->answers[j].size);
+		missed += seat->missed;
+		bench_report_row(name, &seat->latencies, seat->missed,
+				 bench->seats_len);
+	}
+	// every seat together, then by what answered the key
+	bench_report_row("all", &all, missed, bench->seats_len);
+	for (int i = 0; i < _BENCH_ANSWER_LAST; i++) {
+		bench_report_row(bench_answer_names[i], &answers[i], 0,
+				 bench->seats_len);
+		wl_array_release(&answers[i]);
+	}
+	size_t answered = all.size / sizeof(uint64_t);
+	wl_array_release(&all);
+	if (bench->verbose) {
+		for (int i = 0; i < bench->seats_len; i++) {
+			struct bench_field *field = &bench->seats[i].field;
+			printf("seat %d: %.*s\n", i, (int)field->text.size,
+			       (char *)field->text.data);
+		}
+	}
+	return answered;
+}
+
+static int bench_tick(void *data)
+{
+	struct bench *bench = data;
+	bool finished = true;
+	uint32_t time = bench_ns_since(&(struct timespec){0}) / 1000000;
+	for (int i = 0; i < bench->seats_len; i++) {
+		struct bench_seat *seat = &bench->seats[i];
+		// give a slow answer one more tick, then count it as missed
+		if (seat->waiting
+		    && bench_ns_since(&seat->sent)
+			   < 2000000ULL * bench->interval_ms) {
+			finished = false;
+			continue;
+		}
+		if (seat->waiting) {
+			seat->waiting = false;
+			seat->missed++;
+		}
+		if (seat->typed == bench->keys)
+			continue;
+		finished = false;
+		if (seat->grab == NULL)
+			continue;
+		size_t text_len = sizeof bench_text - 1;
+		uint32_t key = bench_keycode(bench_text[seat->typed % text_len]);
+		clock_gettime(CLOCK_MONOTONIC, &seat->sent);
+		seat->waiting = true;
+		seat->typed++;
+		zwp_input_method_keyboard_grab_v2_send_key(
+		    seat->grab, seat->typed * 2, time, key,
+		    WL_KEYBOARD_KEY_STATE_PRESSED);
+		zwp_input_method_keyboard_grab_v2_send_key(
+		    seat->grab, seat->typed * 2 + 1, time, key,
+		    WL_KEYBOARD_KEY_STATE_RELEASED);
+	}
+	wl_display_flush_clients(bench->display);
+	if (finished) {
+		bench->answered = bench_report(bench);
+		wl_display_terminate(bench->display);
+		return 0;
+	}
+	wl_event_source_timer_update(bench->tick, bench->interval_ms);
+	return 0;
+}
+
+static struct bench_seat *bench_replay_seat(struct bench *bench, uint32_t id)
+{
+	struct bench_replay *replay = bench->replay;
+	int i = 0;
+	while (i < replay->seats_len && replay->seats[i] != id)
+		i++;
+	if (i == replay->seats_len
+	    && i < (int)(sizeof replay->seats / sizeof replay->seats[0]))
+		replay->seats[replay->seats_len++] = id;
+	return &bench->seats[i % bench->seats_len];
+}
+
+static void bench_replay_send(struct bench *bench, struct bench_seat *seat,
+			      struct daklakwl_record_event *event)
+{
+	struct bench_replay *replay = bench->replay;
+	uint32_t time = bench_ns_since(&(struct timespec){0}) / 1000000;
+	switch (event->type) {
+	case DAKLAKWL_RECORD_KEYMAP:
+		if (seat->grab != NULL)
+			bench_seat_send_keymap(seat, event->keymap.data,
+					       event->keymap.size);
+		free(event->keymap.data);
+		break;
+	case DAKLAKWL_RECORD_KEY:
+		if (seat->grab == NULL)
+			break;
+		if (event->key.state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+			clock_gettime(CLOCK_MONOTONIC, &seat->sent);
+			seat->waiting = true;
+			seat->typed++;
+		}
+		zwp_input_method_keyboard_grab_v2_send_key(
+		    seat->grab, ++replay->serial, time, event->key.key,
+		    event->key.state);
+		break;
+	case DAKLAKWL_RECORD_MODIFIERS:
+		if (seat->grab == NULL)
+			break;
+		zwp_input_method_keyboard_grab_v2_send_modifiers(
+		    seat->grab, ++replay->serial, event->modifiers.depressed,
+		    event->modifiers.latched, event->modifiers.locked,
+		    event->modifiers.group);
+		break;
+	}
+}
+
+// Gives a seat's unanswered key two intervals before counting it as
+// missed; returns whether the seat is still waiting.
+static bool bench_seat_still_waiting(struct bench *bench,
+				     struct bench_seat *seat)
+{
+	if (!seat->waiting)
+		return false;
+	if (bench_ns_since(&seat->sent) < 2000000ULL * bench->interval_ms)
+		return true;
+	seat->waiting = false;
+	seat->missed++;
+	return false;
+}
+
+// Sends every recorded event that is due. A seat never gets an event
+// while its last key is unanswered, so at the original pace a slow
+// daklak delays the rest of the session instead of piling keys up.
+static void bench_replay_step(struct bench *bench)
+{
+	struct bench_replay *replay = bench->replay;
+	if (replay->reported)
+		return;
+	if (replay->start.tv_sec == 0 && replay->start.tv_nsec == 0)
+		clock_gettime(CLOCK_MONOTONIC, &replay->start);
+	for (;;) {
+		if (!replay->has_next && !replay->ended) {
+			replay->has_next
+			    = daklakwl_record_read(replay->file, &replay->next);
+			replay->ended = !replay->has_next;
+			if (replay->has_next)
+				replay->next_us += replay->next.delta_us;
+		}
+		if (replay->ended)
+			break;
+		struct bench_seat *seat
+		    = bench_replay_seat(bench, replay->next.seat);
+		if (bench_seat_still_waiting(bench, seat)) {
+			replay->blocked = seat;
+			wl_event_source_timer_update(bench->tick,
+						     bench->interval_ms);
+			return;
+		}
+		uint64_t now_us = bench_ns_since(&replay->start) / 1000;
+		if (!replay->fast && now_us < replay->next_us) {
+			wl_event_source_timer_update(
+			    bench->tick, (replay->next_us - now_us + 999) / 1000);
+			return;
+		}
+		bench_replay_send(bench, seat, &replay->next);
+		replay->has_next = false;
+	}
+
+	for (int i = 0; i < bench->seats_len; i++) {
+		if (bench_seat_still_waiting(bench, &bench->seats[i])) {
+			wl_event_source_timer_update(bench->tick,
+						     bench->interval_ms);
+			return;
+		}
+	}
+	replay->reported = true;
+	bench->answered = bench_report(bench);
+	wl_display_terminate(bench->display);
+}
+
+static int bench_replay_tick(void *data)
+{
+	struct bench *bench = data;
+	bench_replay_step(bench);
+	wl_display_flush_clients(bench->display);
+	return 0;
+}
+
+static void bench_replay_resume(void *data)
+{
+	bench_replay_tick(data);
+}
+
+static int bench_child_exit(int signal_number, void *data)
+{
+	struct bench *bench = data;
+	if (waitpid(bench->child, NULL, WNOHANG) == bench->child) {
+		fprintf(stderr, "daklak exited before the bench finished\n");
+		bench->child = 0;
+		wl_display_terminate(bench->display);
+	}
+	return 0;
+}
+
+static bool bench_keymap_init(struct bench *bench)
+{
+	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (context == NULL)
+		return false;
+	struct xkb_rule_names names = {0};
+	struct xkb_keymap *keymap = xkb_keymap_new_from_names(
+	    context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (keymap != NULL) {
+		bench->keymap = xkb_keymap_get_as_string(
+		    keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+		bench->keymap_size = strlen(bench->keymap) + 1;
+		xkb_keymap_unref(keymap);
+	}
+	xkb_context_unref(context);
+	return bench->keymap != NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench bench = {
+	    .seats_len = 1,
+	    .keys = 1000,
+	    .interval_ms = 10,
+	};
+	struct bench_replay replay = {0};
+	char const *replay_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "+s:n:i:r:fvh")) != -1) {
+		switch (opt) {
+		case 'v':
+			bench.verbose = true;
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'f':
+			replay.fast = true;
+			break;
+		case 's':
+			bench.seats_len = atoi(optarg);
+			break;
+		case 'n':
+			bench.keys = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			bench.interval_ms = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-v] [-s seats] [-n keys] "
+				"[-i interval-ms] [-r log [-f]] "
+				"[command...]\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (bench.seats_len < 1 || bench.interval_ms < 1) {
+		fprintf(stderr, "need at least one seat and 1 ms between "
+				"keys\n");
+		return 1;
+	}
+	if (replay_path != NULL) {
+		replay.file = fopen(replay_path, "re");
+		if (replay.file == NULL) {
+			perror(replay_path);
+			return 1;
+		}
+		if (!daklakwl_record_read_header(replay.file)) {
+			fprintf(stderr, "%s: not a daklak recording\n",
+				replay_path);
+			return 1;
+		}
+		bench.replay = &replay;
+	}
+	if (!bench_keymap_init(&bench)) {
+		fprintf(stderr, "failed to compile keymap\n");
+		return 1;
+	}
+
+	// CI machines often run without a session
+	char runtime_dir[] = "/tmp/daklak-bench-XXXXXX";
+	bool own_runtime_dir = getenv("XDG_RUNTIME_DIR") == NULL;
+	if (own_runtime_dir) {
+		if (mkdtemp(runtime_dir) == NULL) {
+			perror("mkdtemp");
+			return 1;
+		}
+		setenv("XDG_RUNTIME_DIR", runtime_dir, true);
+	}
+
+	bench.display = wl_display_create();
+	bench.loop = wl_display_get_event_loop(bench.display);
+	char const *socket = wl_display_add_socket_auto(bench.display);
+	if (socket == NULL) {
+		perror("wl_display_add_socket_auto");
+		return 1;
+	}
+	wl_display_init_shm(bench.display);
+	wl_global_create(bench.display, &wl_compositor_interface, 4, &bench,
+			 compositor_bind);
+	wl_global_create(bench.display, &zwp_input_method_manager_v2_interface,
+			 1, &bench, input_method_manager_bind);
+	wl_global_create(bench.display,
+			 &zwp_virtual_keyboard_manager_v1_interface, 1, &bench,
+			 virtual_keyboard_manager_bind);
+	bench.seats = calloc(bench.seats_len, sizeof *bench.seats);
+	for (int i = 0; i < bench.seats_len; i++) {
+		struct bench_seat *seat = &bench.seats[i];
+		seat->bench = &bench;
+		seat->index = i;
+		wl_array_init(&seat->latencies);
+		for (int j = 0; j < _BENCH_ANSWER_LAST; j++)
+			wl_array_init(&seat->answers[j]);
+		wl_array_init(&seat->field.text);
+		seat->global = wl_global_create(
+		    bench.display, &wl_seat_interface, 7, seat, seat_bind);
+	}
+	bench.tick = wl_event_loop_add_timer(
+	    bench.loop, bench.replay ? bench_replay_tick : bench_tick, &bench);
+
+	// the input method sees all seats before the first key
+	setenv("WAYLAND_DISPLAY", socket, true);
+	if (optind < argc) {
+		bench.child_exit = wl_event_loop_add_signal(
+		    bench.loop, SIGCHLD, bench_child_exit, &bench);
+		bench.child = fork();
+		if (bench.child == -1) {
+			perror("fork");
+			return 1;
+		}
+		if (bench.child == 0) {
+			sigset_t mask;
+			sigemptyset(&mask);
+			sigaddset(&mask, SIGCHLD);
+			sigprocmask(SIG_UNBLOCK, &mask, NULL);
+			execvp(argv[optind], argv + optind);
+			perror("execvp");
+			_exit(127);
+		}
+	}
+	else {
+		fprintf(stderr, "waiting for an input method on %s\n", socket);
+	}
+
+	wl_display_run(bench.display);
+
+	if (bench.child > 0) {
+		kill(bench.child, SIGTERM);
+		waitpid(bench.child, NULL, 0);
+	}
+	for (int i = 0; i < bench.seats_len; i++) {
+		struct bench_seat *seat = &bench.seats[i];
+		wl_array_release(&seat->latencies);
+		for (int j = 0; j < _BENCH_ANSWER_LAST; j++)
+			wl_array_release(&seat->answers[j]);
+		wl_array_release(&seat->field.text);
+		free(seat->field.pending_commit);
+	}
+	wl_display_destroy_clients(bench.display);
+	wl_display_destroy(bench.display);
+	if (own_runtime_dir)
+		rmdir(runtime_dir);
+	if (replay.file != NULL)
+		fclose(replay.file);
+	if (replay.has_next && replay.next.type == DAKLAKWL_RECORD_KEYMAP)
+		free(replay.next.keymap.data);
+	free(bench.seats);
+	free(bench.keymap);
+	return bench.answered != 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include "bloom.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DAKLAKWL_BLOOM_MAGIC "DKBF"
+#define DAKLAKWL_BLOOM_VERSION 1
+#define DAKLAKWL_BLOOM_BLOCK_BITS 512
+
+struct daklakwl_bloom_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t blocks_len;
+	uint32_t hashes;
+	uint32_t words_len;
+	uint32_t reserved[3];
+};
+
+bool daklakwl_bloom_open(struct daklakwl_bloom *bloom, char const *path)
+{
+	memset(bloom, 0, sizeof *bloom);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+	if ((size_t)st.st_size < sizeof(struct daklakwl_bloom_header)) {
+		fprintf(stderr, "%s: word filter too short\n", path);
+		close(fd);
+		return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap word filter");
+		return false;
+	}
+
+	struct daklakwl_bloom_header const *header = map;
+	uint32_t blocks_len = header->blocks_len;
+	if (memcmp(header->magic, DAKLAKWL_BLOOM_MAGIC, 4) != 0
+	    || header->version != DAKLAKWL_BLOOM_VERSION || blocks_len == 0
+	    || (blocks_len & (blocks_len - 1)) != 0 || header->hashes == 0
+	    || header->hashes > 7
+	    || sizeof *header + (size_t)blocks_len * 64
+		   != (size_t)st.st_size) {
+		fprintf(stderr, "%s: invalid word filter\n", path);
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	bloom->map = map;
+	bloom->size = st.st_size;
+	bloom->blocks = (uint64_t const *)(header + 1);
+	bloom->blocks_len = blocks_len;
+	bloom->hashes = header->hashes;
+	return true;
+}
+
+void daklakwl_bloom_close(struct daklakwl_bloom *bloom)
+{
+	if (bloom->map)
+		munmap(bloom->map, bloom->size);
+	memset(bloom, 0, sizeof *bloom);
+}
+
+// Keep in sync with buildtools/bloomcompile.py.
+static uint64_t daklakwl_bloom_hash(char const *word)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (char const *c = word; *c; c++) {
+		char lower = *c >= 'A' && *c <= 'Z' ? *c - 'A' + 'a' : *c;
+		h ^= (unsigned char)lower;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+bool daklakwl_bloom_contains(struct daklakwl_bloom const *bloom,
+			     char const *word)
+{
+	if (bloom->map == NULL || word[0] == '\0')
+		return false;
+	uint64_t h = daklakwl_bloom_hash(word);
+	uint64_t const *block
+	    = bloom->blocks + (h & (bloom->blocks_len - 1)) * 8;
+	uint64_t g = h ^ (h >> 29);
+	g *= 0xbf58476d1ce4e5b9ULL;
+	g ^= g >> 32;
+	for (uint32_t i = 0; i < bloom->hashes; i++) {
+		uint32_t bit = (g >> (9 * i)) & (DAKLAKWL_BLOOM_BLOCK_BITS - 1);
+		if (!(block[bit / 64] & (1ULL << (bit % 64))))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Blocked Bloom filter compiled by buildtools/bloomcompile.py and mapped
+// read-only. Each word lives in one 64-byte block, so a lookup is one
+// hash and one cache line.
+struct daklakwl_bloom {
+	void *map;
+	size_t size;
+	uint64_t const *blocks;
+	uint32_t blocks_len;
+	uint32_t hashes;
+};
+
+bool daklakwl_bloom_open(struct daklakwl_bloom *, char const *path);
+void daklakwl_bloom_close(struct daklakwl_bloom *);
+bool daklakwl_bloom_contains(struct daklakwl_bloom const *, char const *word);
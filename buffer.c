@@ -482,6 +482,7 @@ void daklakwl_buffer_init(struct daklakwl_buffer *buffer)
 	buffer->pos = 0;
 	buffer->gi = calloc(1, 1);
 	buffer->raw = calloc(1, 1);
+	buffer->prefix = calloc(1, 1);
 }
 
 void daklakwl_buffer_steps_destroy(struct daklakwl_buffer *buffer)
@@ -499,6 +500,7 @@ void daklakwl_buffer_destroy(struct daklakwl_buffer *buffer)
 	free(buffer->text);
 	free(buffer->gi);
 	free(buffer->raw);
+	free(buffer->prefix);
 	daklakwl_buffer_steps_destroy(buffer);
 }
 
@@ -507,6 +509,7 @@ void daklakwl_buffer_clear(struct daklakwl_buffer *buffer)
 	buffer->text[0] = '\0';
 	buffer->gi[0] = '\0';
 	buffer->raw[0] = '\0';
+	buffer->prefix[0] = '\0';
 	buffer->catalyst = '\0';
 	buffer->len = 0;
 	buffer->pos = 0;
@@ -1258,10 +1261,19 @@ void daklakwl_buffer_gi_append(struct daklakwl_buffer *buffer, const char *utf8)
 	}
 }
 
-void daklakwl_buffer_compose(struct daklakwl_buffer *buffer)
+void daklakwl_buffer_prefix_append(struct daklakwl_buffer *buffer,
+				   char const *utf8)
+{
+	size_t len = strlen(buffer->prefix);
+	buffer->prefix = realloc(buffer->prefix, len + strlen(utf8) + 1);
+	strcpy(buffer->prefix + len, utf8);
+}
+
+// Returns whether a rule fired, or undid the one before.
+bool daklakwl_buffer_compose(struct daklakwl_buffer *buffer)
 {
 	if (buffer->len == 0)
-		return;
+		return false;
 	daklakwl_buffer_set_wc_text(buffer);
 
 	char cN = buffer->text[buffer->pos - 1];
@@ -1270,11 +1282,13 @@ void daklakwl_buffer_compose(struct daklakwl_buffer *buffer)
 		buffer->steps[0][0] = buffer->gi[0];
 	}
 	int composed = daklakwl_buffer_compose_full(buffer);
-	if (composed)
+	if (composed) {
 		buffer->catalyst = cN;
-	else if (!composed && buffer->catalyst && buffer->catalyst == cN
-		 && (is_mark(cN) || is_accent(cN) || cN == 'd' || cN == 'D')
-		 && buffer->len == buffer->pos) {
+		return true;
+	}
+	if (buffer->catalyst && buffer->catalyst == cN
+	    && (is_mark(cN) || is_accent(cN) || cN == 'd' || cN == 'D')
+	    && buffer->len == buffer->pos) {
 		buffer->len = 0;
 		buffer->pos = 0;
 		buffer->text[0] = '\0';
@@ -1284,7 +1298,9 @@ void daklakwl_buffer_compose(struct daklakwl_buffer *buffer)
 			buffer->raw + buffer->len + 1, 1);
 		buffer->catalyst = '\0';
 		daklakwl_buffer_steps_destroy(buffer);
+		return true;
 	}
+	return false;
 }
 
 bool daklakwl_buffer_should_not_append(struct daklakwl_buffer *buf,
@@ -1292,3 +1308,46 @@ bool daklakwl_buffer_should_not_append(struct daklakwl_buffer *buf,
 {
 	return !is_vowel(utf8[0]) && buf->len == 0 && towlower(utf8[0]) != 'd';
 }
+
+static size_t daklakwl_buffer_repertoire_add(wchar_t *out, size_t len,
+					     size_t max, char const *utf8)
+{
+	mbstate_t state;
+	memset(&state, 0, sizeof state);
+	wchar_t wc;
+	if (utf8 == NULL || mbrtowc(&wc, utf8, MB_LEN_MAX, &state) >= (size_t)-2)
+		return len;
+	for (size_t i = 0; i < len; i++) {
+		if (out[i] == wc)
+			return len;
+	}
+	if (len < max)
+		out[len++] = wc;
+	return len;
+}
+
+// Every character the Telex rules can produce: the base vowels, their
+// marked forms and đ. Accent tables only yield characters already listed
+// as a base vowel or a marked form.
+size_t daklakwl_buffer_repertoire(wchar_t *out, size_t max)
+{
+	static char const marks[] = {'s', 'f', 'x', 'r', 'j'};
+	size_t len = 0;
+	char utf8[MB_LEN_MAX + 1];
+	for (size_t c = 0; c < sizeof vowels_marks / sizeof vowels_marks[0];
+	     c++) {
+		if (vowels_marks[c] == NULL)
+			continue;
+		int n = wctomb(utf8, c);
+		if (n > 0) {
+			utf8[n] = '\0';
+			len = daklakwl_buffer_repertoire_add(out, len, max, utf8);
+		}
+		for (size_t i = 0; i < sizeof marks; i++)
+			len = daklakwl_buffer_repertoire_add(
+			    out, len, max, vowels_marks[c][(int)marks[i]]);
+	}
+	len = daklakwl_buffer_repertoire_add(out, len, max, d_accents['d']);
+	len = daklakwl_buffer_repertoire_add(out, len, max, d_accents['D']);
+	return len;
+}
@@ -14,6 +14,9 @@ struct daklakwl_buffer {
 	size_t wc_len;
 	size_t wc_pos;
 	char *gi;
+	// consonants typed before the first vowel, which went on to the
+	// client as they were typed and are in neither text nor raw
+	char *prefix;
 	char catalyst;
 	char *steps[4];
 	char *mark;
@@ -27,10 +30,12 @@ void daklakwl_buffer_clear(struct daklakwl_buffer *);
 void daklakwl_buffer_append(struct daklakwl_buffer *, char const *);
 void daklakwl_buffer_raw_append(struct daklakwl_buffer *, char const *);
 void daklakwl_buffer_gi_append(struct daklakwl_buffer *, const char *);
+void daklakwl_buffer_prefix_append(struct daklakwl_buffer *, char const *);
 void daklakwl_buffer_delete_backwards(struct daklakwl_buffer *, size_t);
 void daklakwl_buffer_delete_backwards_all(struct daklakwl_buffer *, size_t);
 void daklakwl_buffer_delete_forwards(struct daklakwl_buffer *, size_t);
 void daklakwl_buffer_delete_forwards_all(struct daklakwl_buffer *, size_t);
 void daklakwl_buffer_move_left(struct daklakwl_buffer *);
 void daklakwl_buffer_move_right(struct daklakwl_buffer *);
-void daklakwl_buffer_compose(struct daklakwl_buffer *);
+bool daklakwl_buffer_compose(struct daklakwl_buffer *);
+size_t daklakwl_buffer_repertoire(wchar_t *, size_t);
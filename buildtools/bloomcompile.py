@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Compile a word list into the blocked Bloom filter loaded by bloom.c.
+#
+# The input has one word per line; empty lines and lines starting with
+# '#' are ignored. Words are folded to lowercase ASCII, and words shorter
+# than MIN_LENGTH are left out: nearly every two-letter English word (as,
+# if, is, of, or) is also how Telex spells a Vietnamese syllable.
+#
+# The output layout (all integers little-endian) is:
+#
+#   header   magic "DKBF", version, blocks, hashes, words, 3 x reserved
+#   blocks   64-byte blocks of 512 bits, a power of two of them
+#
+# A word sets `hashes` bits inside a single block, so a lookup touches one
+# cache line. Keep the hash in sync with daklakwl_bloom_hash().
+
+import struct
+import sys
+
+MAGIC = b"DKBF"
+VERSION = 1
+HASHES = 7
+BITS_PER_WORD = 12
+BLOCK_BITS = 512
+MIN_LENGTH = 3
+MASK64 = (1 << 64) - 1
+
+
+def word_hash(word):
+    h = 0xCBF29CE484222325
+    for c in word.encode():
+        h ^= c
+        h = (h * 0x100000001B3) & MASK64
+    return h
+
+
+def mix(h):
+    h ^= h >> 29
+    h = (h * 0xBF58476D1CE4E5B9) & MASK64
+    h ^= h >> 32
+    return h
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: bloomcompile.py INPUT OUTPUT")
+
+    words = set()
+    with open(sys.argv[1], encoding="ascii") as f:
+        for line in f:
+            word = line.strip().lower()
+            if not word or word.startswith("#"):
+                continue
+            if not word.isalpha():
+                sys.exit("%s: not a plain word: %r" % (sys.argv[1], word))
+            if len(word) >= MIN_LENGTH:
+                words.add(word)
+
+    blocks = 1
+    while blocks * BLOCK_BITS < len(words) * BITS_PER_WORD:
+        blocks *= 2
+    bits = bytearray(blocks * BLOCK_BITS // 8)
+    for word in words:
+        h = word_hash(word)
+        block = h & (blocks - 1)
+        g = mix(h)
+        for i in range(HASHES):
+            bit = block * BLOCK_BITS + ((g >> (9 * i)) & (BLOCK_BITS - 1))
+            bits[bit // 8] |= 1 << (bit % 8)
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(struct.pack("<4s7I", MAGIC, VERSION, blocks, HASHES,
+                            len(words), 0, 0, 0))
+        f.write(bits)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+
+# Compile a word list into the double-array trie dictionary loaded by
+# dict.c.
+#
+# The input has one word or phrase per line, most frequent first. An
+# optional tab-separated count after the word overrides the rank-based
+# frequency. Empty lines and lines starting with '#' are ignored.
+#
+# The output layout (all integers little-endian) is:
+#
+#   header   magic "DKDA", version, units, entries, top, strings, topk
+#   units    { int32 base; uint32 check; uint32 lo; uint32 count;
+#              uint32 top; }
+#   entries  { uint32 text; uint32 frequency; }  sorted by UTF-8 bytes
+#   top      uint32 entry indices, topk per unit with count > topk
+#   strings  NUL-terminated UTF-8
+#
+# A unit's children are at base + byte + 1, valid when their check is the
+# parent's index. Every unit covers the contiguous range [lo, lo + count)
+# of entries starting with its prefix, so short ranges are ranked on the
+# fly and long ones use the precomputed top list.
+
+import struct
+import sys
+
+MAGIC = b"DKDA"
+VERSION = 1
+TOPK = 8
+NONE = 0xFFFFFFFF
+
+
+def read_words(infile):
+    lines = []
+    for line in infile:
+        line = line.rstrip("\n")
+        if not line or line.startswith("#"):
+            continue
+        word, _, count = line.partition("\t")
+        word = word.strip()
+        if word:
+            lines.append((word, count.strip()))
+
+    words = {}
+    for rank, (word, count) in enumerate(lines):
+        frequency = int(count) if count else len(lines) - rank
+        key = word.encode("utf-8")
+        words[key] = max(words.get(key, 0), frequency)
+    return words
+
+
+class DoubleArray:
+    def __init__(self):
+        self.base = [0]
+        self.check = [NONE]
+        self.lo = [0]
+        self.count = [0]
+        self.top = [NONE]
+        self.used = bytearray(1)
+        self.used[0] = 1
+        self.next_free = 1
+
+    def grow(self, size):
+        while len(self.base) < size:
+            self.base.append(0)
+            self.check.append(NONE)
+            self.lo.append(0)
+            self.count.append(0)
+            self.top.append(NONE)
+            self.used.append(0)
+
+    def find_base(self, codes):
+        first = codes[0]
+        pos = max(self.next_free, first + 1)
+        while True:
+            base = pos - first
+            self.grow(base + codes[-1] + 1)
+            if all(not self.used[base + c] for c in codes):
+                return base
+            pos += 1
+            while pos < len(self.used) and self.used[pos]:
+                pos += 1
+
+    def place(self, parent, codes):
+        base = self.find_base(codes)
+        self.base[parent] = base
+        for c in codes:
+            self.used[base + c] = 1
+            self.check[base + c] = parent
+        while self.next_free < len(self.used) and self.used[self.next_free]:
+            self.next_free += 1
+        return [base + c for c in codes]
+
+
+def build(words):
+    keys = sorted(words)
+    freqs = [words[k] for k in keys]
+    da = DoubleArray()
+    top = []
+
+    # (unit, depth, lo, hi)
+    pending = [(0, 0, 0, len(keys))]
+    while pending:
+        unit, depth, lo, hi = pending.pop()
+        da.lo[unit] = lo
+        da.count[unit] = hi - lo
+        if hi - lo > TOPK:
+            ranked = sorted(range(lo, hi), key=lambda i: (-freqs[i], i))
+            da.top[unit] = len(top)
+            top.extend(ranked[:TOPK])
+
+        children = []
+        i = lo
+        while i < hi and len(keys[i]) == depth:
+            i += 1
+        while i < hi:
+            byte = keys[i][depth]
+            j = i
+            while j < hi and keys[j][depth] == byte:
+                j += 1
+            children.append((byte + 1, i, j))
+            i = j
+        if not children:
+            continue
+        units = da.place(unit, [c for c, _, _ in children])
+        for child, (_, clo, chi) in zip(units, children):
+            pending.append((child, depth + 1, clo, chi))
+
+    return keys, freqs, da, top
+
+
+def write(outfile, keys, freqs, da, top):
+    strings = bytearray()
+    entries = bytearray()
+    for key, freq in zip(keys, freqs):
+        entries += struct.pack("<II", len(strings), freq)
+        strings += key + b"\0"
+
+    header = MAGIC + struct.pack(
+        "<IIIIII", VERSION, len(da.base), len(keys), len(top), len(strings),
+        TOPK)
+    header += b"\0" * (32 - len(header))
+    outfile.write(header)
+    for i in range(len(da.base)):
+        outfile.write(struct.pack("<iIIII", da.base[i], da.check[i], da.lo[i],
+                                  da.count[i], da.top[i]))
+    outfile.write(entries)
+    outfile.write(struct.pack("<%dI" % len(top), *top))
+    outfile.write(strings)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: %s WORDLIST OUTPUT" % sys.argv[0])
+    with open(sys.argv[1], encoding="utf-8") as infile:
+        words = read_words(infile)
+    with open(sys.argv[2], "wb") as outfile:
+        write(outfile, *build(words))
@@ -0,0 +1,65 @@
+#include "channel.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+bool daklakwl_channel_init(struct daklakwl_channel *channel)
+{
+	atomic_init(&channel->head, 0);
+	atomic_init(&channel->tail, 0);
+	channel->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (channel->fd == -1) {
+		perror("eventfd");
+		return false;
+	}
+	return true;
+}
+
+void daklakwl_channel_finish(struct daklakwl_channel *channel)
+{
+	if (channel->fd != -1)
+		close(channel->fd);
+	channel->fd = -1;
+}
+
+// Producer side. Fails when the consumer has fallen a whole ring behind.
+bool daklakwl_channel_send(struct daklakwl_channel *channel, uint64_t message)
+{
+	uint32_t tail
+	    = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+	uint32_t head
+	    = atomic_load_explicit(&channel->head, memory_order_acquire);
+	if (tail - head == DAKLAKWL_CHANNEL_SIZE)
+		return false;
+	channel->messages[tail % DAKLAKWL_CHANNEL_SIZE] = message;
+	atomic_store_explicit(&channel->tail, tail + 1, memory_order_release);
+	uint64_t one = 1;
+	if (write(channel->fd, &one, sizeof one) != sizeof one)
+		perror("eventfd write");
+	return true;
+}
+
+// Consumer side, before draining: a send that lands after this wakes the
+// consumer again, so nothing is left behind.
+void daklakwl_channel_ack(struct daklakwl_channel *channel)
+{
+	uint64_t count;
+	if (read(channel->fd, &count, sizeof count) == -1 && errno != EAGAIN)
+		perror("eventfd read");
+}
+
+bool daklakwl_channel_receive(struct daklakwl_channel *channel,
+			      uint64_t *message)
+{
+	uint32_t head
+	    = atomic_load_explicit(&channel->head, memory_order_relaxed);
+	uint32_t tail
+	    = atomic_load_explicit(&channel->tail, memory_order_acquire);
+	if (head == tail)
+		return false;
+	*message = channel->messages[head % DAKLAKWL_CHANNEL_SIZE];
+	atomic_store_explicit(&channel->head, head + 1, memory_order_release);
+	return true;
+}
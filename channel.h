@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DAKLAKWL_CHANNEL_SIZE 64
+
+// Ring of messages from exactly one producer thread to exactly one
+// consumer thread. The consumer polls fd, an eventfd bumped on every
+// send, and then drains the ring with daklakwl_channel_receive.
+struct daklakwl_channel {
+	int fd;
+	// next slot to read, moved by the consumer only
+	alignas(64) _Atomic uint32_t head;
+	// next slot to write, moved by the producer only
+	alignas(64) _Atomic uint32_t tail;
+	uint64_t messages[DAKLAKWL_CHANNEL_SIZE];
+};
+
+bool daklakwl_channel_init(struct daklakwl_channel *);
+void daklakwl_channel_finish(struct daklakwl_channel *);
+bool daklakwl_channel_send(struct daklakwl_channel *, uint64_t message);
+void daklakwl_channel_ack(struct daklakwl_channel *);
+bool daklakwl_channel_receive(struct daklakwl_channel *, uint64_t *message);
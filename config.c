@@ -69,8 +69,93 @@ static void daklakwl_config_load_bindings(struct daklakwl_config *config,
 							 sizeof binding)
 		    = binding;
 	}
-	qsort(bindings->data, bindings->size / sizeof(struct daklakwl_binding),
-	      sizeof(struct daklakwl_binding), daklakwl_binding_compare);
+}
+
+static void daklakwl_config_load_shortcuts(struct daklakwl_config *config,
+					   struct scfg_block *block)
+{
+	for (size_t i = 0; i < block->directives_len; i++) {
+		struct scfg_directive *directive = &block->directives[i];
+		if (directive->params_len != 1) {
+			fprintf(stderr,
+				"line %d: shortcut %s takes exactly one "
+				"expansion, ignoring\n",
+				directive->lineno, directive->name);
+			continue;
+		}
+		struct daklakwl_shortcut shortcut = {
+		    .abbreviation = strdup(directive->name),
+		    .expansion = strdup(directive->params[0]),
+		};
+		*(struct daklakwl_shortcut *)wl_array_add(&config->shortcuts,
+							  sizeof shortcut)
+		    = shortcut;
+	}
+}
+
+static char const *const daklakwl_content_purpose_names[] = {
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_NORMAL] = "normal",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_ALPHA] = "alpha",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_DIGITS] = "digits",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_NUMBER] = "number",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PHONE] = "phone",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_URL] = "url",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_EMAIL] = "email",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_NAME] = "name",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PASSWORD] = "password",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PIN] = "pin",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_DATE] = "date",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_TIME] = "time",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_DATETIME] = "datetime",
+    [ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_TERMINAL] = "terminal",
+};
+
+static void daklakwl_config_load_content_types(struct daklakwl_config *config,
+					       struct scfg_block *block)
+{
+	for (size_t i = 0; i < block->directives_len; i++) {
+		struct scfg_directive *directive = &block->directives[i];
+		if (directive->params_len != 1) {
+			fprintf(stderr,
+				"line %d: content type %s takes exactly one "
+				"policy, ignoring\n",
+				directive->lineno, directive->name);
+			continue;
+		}
+		enum daklakwl_input_policy policy;
+		char const *name = directive->params[0];
+		if (strcmp(name, "compose") == 0)
+			policy = DAKLAKWL_INPUT_COMPOSE;
+		else if (strcmp(name, "raw") == 0)
+			policy = DAKLAKWL_INPUT_RAW;
+		else if (strcmp(name, "bypass") == 0)
+			policy = DAKLAKWL_INPUT_BYPASS;
+		else {
+			fprintf(stderr,
+				"line %d: invalid policy %s, expected compose, "
+				"raw or bypass\n",
+				directive->lineno, name);
+			continue;
+		}
+
+		if (strcmp(directive->name, "sensitive") == 0) {
+			config->sensitive_policy = policy;
+			continue;
+		}
+		size_t purpose = 0;
+		for (; purpose < DAKLAKWL_CONTENT_PURPOSES; purpose++) {
+			if (strcmp(directive->name,
+				   daklakwl_content_purpose_names[purpose])
+			    == 0)
+				break;
+		}
+		if (purpose == DAKLAKWL_CONTENT_PURPOSES) {
+			fprintf(stderr, "line %d: unknown content type %s\n",
+				directive->lineno, directive->name);
+			continue;
+		}
+		config->purpose_policies[purpose] = policy;
+	}
 }
 
 static void daklakwl_config_load_root(struct daklakwl_config *config,
@@ -87,11 +172,69 @@ static void daklakwl_config_load_root(struct daklakwl_config *config,
 			else
 				config->active_at_startup = true;
 		}
+		else if (strcmp(directive->name, "dictionary") == 0) {
+			if (directive->params_len != 1) {
+				fprintf(stderr,
+					"line %d: dictionary takes exactly one "
+					"path\n",
+					directive->lineno);
+				continue;
+			}
+			free(config->dictionary_path);
+			config->dictionary_path = strdup(directive->params[0]);
+		}
+		else if (strcmp(directive->name, "english-words") == 0) {
+			if (directive->params_len != 1) {
+				fprintf(stderr,
+					"line %d: english-words takes exactly "
+					"one path\n",
+					directive->lineno);
+				continue;
+			}
+			free(config->english_words_path);
+			config->english_words_path
+			    = strdup(directive->params[0]);
+		}
+		else if (strcmp(directive->name, "record") == 0) {
+			if (directive->params_len != 1) {
+				fprintf(stderr,
+					"line %d: record takes exactly one "
+					"path\n",
+					directive->lineno);
+				continue;
+			}
+			free(config->record_path);
+			config->record_path = strdup(directive->params[0]);
+		}
+		else if (strcmp(directive->name, "popup-font") == 0) {
+			if (directive->params_len != 1) {
+				fprintf(stderr,
+					"line %d: popup-font takes exactly one "
+					"fontconfig pattern\n",
+					directive->lineno);
+				continue;
+			}
+			free(config->popup_font);
+			config->popup_font = strdup(directive->params[0]);
+		}
 		else if (strcmp(directive->name, "composing-bindings") == 0) {
 			daklakwl_config_load_bindings(
 			    config, &directive->children,
 			    &config->composing_bindings);
 		}
+		else if (strcmp(directive->name, "global-bindings") == 0) {
+			daklakwl_config_load_bindings(
+			    config, &directive->children,
+			    &config->global_bindings);
+		}
+		else if (strcmp(directive->name, "content-types") == 0) {
+			daklakwl_config_load_content_types(
+			    config, &directive->children);
+		}
+		else if (strcmp(directive->name, "shortcuts") == 0) {
+			daklakwl_config_load_shortcuts(config,
+						       &directive->children);
+		}
 		else {
 			fprintf(stderr, "line %d: unknown section '%s'\n",
 				directive->lineno, directive->name);
@@ -102,29 +245,61 @@ static void daklakwl_config_load_root(struct daklakwl_config *config,
 void daklakwl_config_init(struct daklakwl_config *config)
 {
 	wl_array_init(&config->composing_bindings);
+	wl_array_init(&config->global_bindings);
+	wl_array_init(&config->shortcuts);
+	// Telex gets in the way where text is not prose.
+	enum daklakwl_input_policy *policies = config->purpose_policies;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_DIGITS]
+	    = DAKLAKWL_INPUT_BYPASS;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_NUMBER]
+	    = DAKLAKWL_INPUT_BYPASS;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PHONE]
+	    = DAKLAKWL_INPUT_BYPASS;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_URL] = DAKLAKWL_INPUT_RAW;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_EMAIL] = DAKLAKWL_INPUT_RAW;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PASSWORD]
+	    = DAKLAKWL_INPUT_BYPASS;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PIN] = DAKLAKWL_INPUT_BYPASS;
+	policies[ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_TERMINAL]
+	    = DAKLAKWL_INPUT_RAW;
+	config->sensitive_policy = DAKLAKWL_INPUT_BYPASS;
 }
 
 void daklakwl_config_finish(struct daklakwl_config *config)
 {
 	wl_array_release(&config->composing_bindings);
+	wl_array_release(&config->global_bindings);
+	struct daklakwl_shortcut *shortcut;
+	wl_array_for_each(shortcut, &config->shortcuts)
+	{
+		free(shortcut->abbreviation);
+		free(shortcut->expansion);
+	}
+	wl_array_release(&config->shortcuts);
+	free(config->dictionary_path);
+	free(config->english_words_path);
+	free(config->popup_font);
+	free(config->record_path);
 }
 
-bool daklakwl_config_load(struct daklakwl_config *config)
+bool daklakwl_config_path(char *path, size_t size)
 {
-	char path[PATH_MAX];
 	char const *prefix;
 	if ((prefix = getenv("XDG_CONFIG_HOME"))) {
-		snprintf(path, sizeof path, "%s/daklakwl/config", prefix);
+		snprintf(path, size, "%s/daklakwl/config", prefix);
 	}
 	else if ((prefix = getenv("HOME"))) {
-		snprintf(path, sizeof path, "%s/.config/daklakwl/config",
-			 prefix);
+		snprintf(path, size, "%s/.config/daklakwl/config", prefix);
 	}
 	else {
 		fprintf(stderr, "cannot find config file\n");
 		return false;
 	}
+	return true;
+}
 
+bool daklakwl_config_read(struct daklakwl_config *config, char const *path)
+{
 	FILE *f = fopen(path, "r");
 	if (f == NULL)
 		f = fmemopen((char *)daklakwl_default_config,
@@ -136,11 +311,13 @@ bool daklakwl_config_load(struct daklakwl_config *config)
 	}
 
 	struct scfg_block root;
-	if (scfg_parse_file(&root, f))
-		goto close;
-	daklakwl_config_load_root(config, &root);
-	scfg_block_finish(&root);
-close:
+	bool ok = scfg_parse_file(&root, f) == 0;
+	if (ok) {
+		daklakwl_config_load_root(config, &root);
+		scfg_block_finish(&root);
+	}
+	else
+		fprintf(stderr, "%s: failed to parse config\n", path);
 	fclose(f);
-	return true;
+	return ok;
 }
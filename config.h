@@ -1,13 +1,44 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <wayland-client-core.h>
 
+#include "shortcut.h"
+
+// How keys are handled in a text field, from most to least work.
+enum daklakwl_input_policy {
+	// Telex composition with preedit
+	DAKLAKWL_INPUT_COMPOSE,
+	// bindings still apply, letters are passed through as typed
+	DAKLAKWL_INPUT_RAW,
+	// every key goes straight to the virtual keyboard
+	DAKLAKWL_INPUT_BYPASS,
+};
+
+// zwp_text_input_v3 content purposes, normal through terminal
+#define DAKLAKWL_CONTENT_PURPOSES 14
+
 struct daklakwl_config {
 	bool active_at_startup;
 	struct wl_array composing_bindings;
+	// handled in every state, before the content type policy
+	struct wl_array global_bindings;
+	char *dictionary_path;
+	char *english_words_path;
+	char *popup_font;
+	// where to log the keyboard for daklak-bench -r, off when NULL
+	char *record_path;
+	struct wl_array shortcuts;
+	enum daklakwl_input_policy purpose_policies[DAKLAKWL_CONTENT_PURPOSES];
+	// for fields hinted as hidden text or sensitive data
+	enum daklakwl_input_policy sensitive_policy;
 };
 
 void daklakwl_config_init(struct daklakwl_config *config);
-bool daklakwl_config_load(struct daklakwl_config *config);
+// Where the config lives, whether or not it exists.
+bool daklakwl_config_path(char *path, size_t size);
+// Reads path, or the default config when there is none. False when it
+// cannot be parsed.
+bool daklakwl_config_read(struct daklakwl_config *config, char const *path);
 void daklakwl_config_finish(struct daklakwl_config *config);
@@ -0,0 +1,403 @@
+#include "control.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "daklakwl.h"
+#include "metrics.h"
+#include "trace.h"
+
+// Requests are answered into the client's output buffer and everything
+// buffered goes out in one send from daklakwl_control_flush, after the
+// loop has dispatched, so pipelined requests cost one syscall each way.
+// Nothing here ever blocks: what the socket does not take waits for
+// EPOLLOUT. A client whose replies pile up is not read from until they
+// have gone out, so a large batch of requests waits in the kernel rather
+// than being answered into memory.
+
+// replies a client may leave unread before it counts as stuck
+#define DAKLAKWL_CONTROL_MAX_QUEUED (64 * 1024)
+
+// Whether another request could overflow the output buffer; the rest of
+// the input waits until the replies have been sent.
+static bool daklakwl_client_full(struct daklakwl_client const *client)
+{
+	return client->out.size + sizeof(struct daklakwl_control_header)
+		   + DAKLAKWL_CONTROL_MAX_PAYLOAD
+	       > DAKLAKWL_CONTROL_MAX_QUEUED;
+}
+
+static void daklakwl_client_write(struct daklakwl_client *client,
+				  uint16_t type, uint32_t id,
+				  void const *payload, uint32_t size)
+{
+	struct daklakwl_control_header header = {
+	    .size = size,
+	    .type = type,
+	    .id = id,
+	};
+	if (client->overflowed
+	    || client->out.size + sizeof header + size
+		   > DAKLAKWL_CONTROL_MAX_QUEUED) {
+		// dropped at the next flush, not here in the middle of a read
+		client->overflowed = true;
+		return;
+	}
+	char *out = wl_array_add(&client->out, sizeof header + size);
+	if (out == NULL) {
+		perror("control reply");
+		client->overflowed = true;
+		return;
+	}
+	memcpy(out, &header, sizeof header);
+	if (size)
+		memcpy(out + sizeof header, payload, size);
+}
+
+static void daklakwl_client_write_error(struct daklakwl_client *client,
+					uint32_t id, char const *reason)
+{
+	daklakwl_client_write(client, DAKLAKWL_CONTROL_ERROR, id, reason,
+			      strlen(reason));
+}
+
+static struct daklakwl_control_state
+daklakwl_control_state(struct daklakwl_state *state)
+{
+	struct daklakwl_control_state control_state = {
+	    .method = state->engine->method,
+	};
+	struct daklakwl_seat *seat;
+	wl_list_for_each(seat, &state->seats, link)
+	{
+		control_state.composing |= seat->is_composing;
+		control_state.seats++;
+	}
+	return control_state;
+}
+
+static void daklakwl_client_write_state(struct daklakwl_client *client,
+					uint16_t type, uint32_t id)
+{
+	struct daklakwl_control_state control_state
+	    = daklakwl_control_state(client->state);
+	daklakwl_client_write(client, type, id, &control_state,
+			      sizeof control_state);
+}
+
+static void daklakwl_client_write_stats(struct daklakwl_client *client,
+					uint32_t id)
+{
+	struct daklakwl_state *state = client->state;
+	char stats[DAKLAKWL_CONTROL_MAX_PAYLOAD];
+	int len = snprintf(
+	    stats, sizeof stats,
+	    "seats %d\n"
+	    "clients %d\n"
+	    "wakeups %llu\n"
+	    "timer_wakeups %llu\n"
+	    "keymap_hits %llu\n"
+	    "keymap_misses %llu\n",
+	    wl_list_length(&state->seats), wl_list_length(&state->clients),
+	    (unsigned long long)state->loop.wakeups,
+	    (unsigned long long)state->timers.wakeups,
+	    (unsigned long long)state->keymaps.hits,
+	    (unsigned long long)state->keymaps.misses);
+	for (int i = 0; i < _DAKLAKWL_STARTUP_LAST; i++) {
+		if (len < (int)sizeof stats)
+			len += snprintf(stats + len, sizeof stats - len,
+					"startup_%s_ns %llu\n",
+					daklakwl_startup_phase_names[i],
+					(unsigned long long)state->startup[i]);
+	}
+	if (len >= (int)sizeof stats)
+		len = sizeof stats - 1;
+	len += daklakwl_metrics_format(stats + len, sizeof stats - len);
+	daklakwl_client_write(client, DAKLAKWL_CONTROL_STATS, id, stats, len);
+}
+
+static void
+daklakwl_client_trace_dump(struct daklakwl_client *client,
+			   struct daklakwl_control_header const *header,
+			   char const *payload)
+{
+	char path[PATH_MAX];
+	if (header->size == 0 || header->size >= sizeof path
+	    || payload[0] != '/') {
+		daklakwl_client_write_error(client, header->id, "bad path");
+		return;
+	}
+	memcpy(path, payload, header->size);
+	path[header->size] = '\0';
+	if (!daklakwl_trace_dump(path)) {
+		daklakwl_client_write_error(client, header->id,
+					    "failed to write trace");
+		return;
+	}
+	daklakwl_client_write(client, header->type, header->id, NULL, 0);
+}
+
+static void
+daklakwl_client_handle_request(struct daklakwl_client *client,
+			       struct daklakwl_control_header const *header,
+			       char const *payload)
+{
+	struct daklakwl_state *state = client->state;
+	switch (header->type) {
+	case DAKLAKWL_CONTROL_GET_STATE:
+		break;
+	case DAKLAKWL_CONTROL_SET_METHOD: {
+		struct daklakwl_engine const *engine
+		    = daklakwl_engine_from_name(payload, header->size);
+		if (engine == NULL) {
+			daklakwl_client_write_error(client, header->id,
+						    "unknown method");
+			return;
+		}
+		daklakwl_state_set_engine(state, engine);
+		break;
+	}
+	case DAKLAKWL_CONTROL_TOGGLE:
+		daklakwl_state_handle_action(state, NULL,
+					     DAKLAKWL_ACTION_TOGGLE);
+		break;
+	case DAKLAKWL_CONTROL_ENABLE:
+		daklakwl_state_handle_action(state, NULL,
+					     DAKLAKWL_ACTION_ENABLE);
+		break;
+	case DAKLAKWL_CONTROL_DISABLE:
+		daklakwl_state_handle_action(state, NULL,
+					     DAKLAKWL_ACTION_DISABLE);
+		break;
+	case DAKLAKWL_CONTROL_STATS:
+		daklakwl_client_write_stats(client, header->id);
+		return;
+	case DAKLAKWL_CONTROL_SUBSCRIBE:
+		client->subscribed = true;
+		break;
+	case DAKLAKWL_CONTROL_UNSUBSCRIBE:
+		client->subscribed = false;
+		daklakwl_client_write(client, header->type, header->id, NULL,
+				      0);
+		return;
+	case DAKLAKWL_CONTROL_TRACE_START:
+		if (!daklakwl_trace_start()) {
+			daklakwl_client_write_error(client, header->id,
+						    "out of memory");
+			return;
+		}
+		daklakwl_client_write(client, header->type, header->id, NULL,
+				      0);
+		return;
+	case DAKLAKWL_CONTROL_TRACE_STOP:
+		daklakwl_trace_stop();
+		daklakwl_client_write(client, header->type, header->id, NULL,
+				      0);
+		return;
+	case DAKLAKWL_CONTROL_TRACE_DUMP:
+		daklakwl_client_trace_dump(client, header, payload);
+		return;
+	default:
+		daklakwl_client_write_error(client, header->id,
+					    "unknown request");
+		return;
+	}
+	daklakwl_client_write_state(client, header->type, header->id);
+}
+
+// Handles the complete messages in the input buffer until the output
+// buffer is full, and keeps the rest for later.
+static bool daklakwl_client_parse(struct daklakwl_client *client)
+{
+	char *data = client->in.data;
+	size_t offset = 0;
+	struct daklakwl_control_header header;
+	while (client->in.size - offset >= sizeof header
+	       && !daklakwl_client_full(client)) {
+		memcpy(&header, data + offset, sizeof header);
+		if (header.size > DAKLAKWL_CONTROL_MAX_PAYLOAD) {
+			fprintf(stderr, "control: %u byte message, closing\n",
+				header.size);
+			return false;
+		}
+		if (client->in.size - offset < sizeof header + header.size)
+			break;
+		daklakwl_client_handle_request(
+		    client, &header, data + offset + sizeof header);
+		offset += sizeof header + header.size;
+	}
+	memmove(data, data + offset, client->in.size - offset);
+	client->in.size -= offset;
+	return true;
+}
+
+// Reads only while there is room for the replies and waits for EPOLLOUT
+// while some are unsent.
+static void daklakwl_client_update(struct daklakwl_client *client)
+{
+	uint32_t events = client->blocked ? EPOLLOUT : 0;
+	if (!daklakwl_client_full(client))
+		events |= EPOLLIN;
+	daklakwl_loop_modify(&client->state->loop, &client->source, events);
+}
+
+void daklakwl_client_destroy(struct daklakwl_client *client)
+{
+	daklakwl_loop_remove(&client->state->loop, &client->source);
+	close(client->source.fd);
+	wl_list_remove(&client->link);
+	wl_array_release(&client->in);
+	wl_array_release(&client->out);
+	free(client);
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_CLIENTS_CLOSED, 1);
+}
+
+// Sends what the socket takes. Only the latest state is worth sending,
+// so a pending state event is added once earlier output has gone out.
+// Requests left unparsed because the output was full are handled as
+// soon as it has all been sent.
+static bool daklakwl_client_flush(struct daklakwl_client *client)
+{
+	if (client->state_pending && !client->blocked) {
+		client->state_pending = false;
+		daklakwl_client_write_state(client,
+					    DAKLAKWL_CONTROL_STATE_EVENT, 0);
+	}
+	for (;;) {
+		if (client->overflowed) {
+			fprintf(stderr,
+				"control: client stopped reading, closing\n");
+			return false;
+		}
+		if (client->out.size == 0)
+			break;
+		ssize_t rc
+		    = send(client->source.fd, client->out.data,
+			   client->out.size, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rc == -1 && errno != EAGAIN && errno != EINTR) {
+			perror("control send");
+			return false;
+		}
+		size_t sent = rc > 0 ? rc : 0;
+		memmove(client->out.data, (char *)client->out.data + sent,
+			client->out.size - sent);
+		client->out.size -= sent;
+		if (client->out.size != 0)
+			break;
+		// everything went out, answer what was held back
+		if (!daklakwl_client_parse(client))
+			return false;
+	}
+	client->blocked = client->out.size != 0;
+	daklakwl_client_update(client);
+	return true;
+}
+
+static void daklakwl_client_callback(struct daklakwl_event_source *source,
+				     uint32_t events)
+{
+	struct daklakwl_client *client
+	    = wl_container_of(source, client, source);
+	if (events & EPOLLOUT) {
+		// a pending state event follows at the next flush, once
+		// this has drained
+		if (!daklakwl_client_flush(client)) {
+			daklakwl_client_destroy(client);
+			return;
+		}
+	}
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		return;
+	for (;;) {
+		if (daklakwl_client_full(client)) {
+			// the rest waits in the socket until the client reads
+			// its replies, unless nobody is left to read them
+			if (events & (EPOLLHUP | EPOLLERR)) {
+				daklakwl_client_destroy(client);
+				return;
+			}
+			daklakwl_client_update(client);
+			return;
+		}
+		// parsing after every read keeps the buffer at most one
+		// message and one read long
+		size_t size = client->in.size;
+		if (wl_array_add(&client->in, 4096) == NULL) {
+			daklakwl_client_destroy(client);
+			return;
+		}
+		ssize_t rc = recv(source->fd, (char *)client->in.data + size,
+				  4096, 0);
+		client->in.size = size + (rc > 0 ? rc : 0);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == -1 && errno == EAGAIN)
+			return;
+		if (rc <= 0) {
+			if (rc == -1)
+				perror("recv");
+			daklakwl_client_destroy(client);
+			return;
+		}
+		if (!daklakwl_client_parse(client)) {
+			daklakwl_client_destroy(client);
+			return;
+		}
+	}
+}
+
+void daklakwl_state_listen_callback(struct daklakwl_event_source *source,
+				    uint32_t events)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(source, state, listen_source);
+	int fd = accept4(source->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1) {
+		perror("accept");
+		return;
+	}
+	struct daklakwl_client *client = calloc(1, sizeof *client);
+	if (client == NULL) {
+		perror("calloc");
+		close(fd);
+		return;
+	}
+	client->state = state;
+	wl_array_init(&client->in);
+	wl_array_init(&client->out);
+	if (!daklakwl_loop_add(&state->loop, &client->source, fd, EPOLLIN,
+			       daklakwl_client_callback)) {
+		close(fd);
+		free(client);
+		return;
+	}
+	wl_list_insert(&state->clients, &client->link);
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_CLIENTS_ACCEPTED, 1);
+}
+
+void daklakwl_control_broadcast_state(struct daklakwl_state *state)
+{
+	struct daklakwl_client *client;
+	wl_list_for_each(client, &state->clients, link)
+	{
+		client->state_pending |= client->subscribed;
+	}
+}
+
+void daklakwl_control_flush(struct daklakwl_state *state)
+{
+	struct daklakwl_client *client, *tmp_client;
+	wl_list_for_each_safe(client, tmp_client, &state->clients, link)
+	{
+		// a blocked client is flushed again on EPOLLOUT
+		if (client->blocked && !client->overflowed)
+			continue;
+		if (!daklakwl_client_flush(client))
+			daklakwl_client_destroy(client);
+	}
+}
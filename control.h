@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// Wire format of the control socket, shared by daklak and daklakctl.
+// Every message is a header followed by size bytes of payload, all in
+// host byte order since both ends are on the same machine. Clients may
+// send any number of requests without waiting; each one gets exactly one
+// reply carrying its id, in order.
+
+#define DAKLAKWL_CONTROL_SOCKET "/tmp/daklak.sock"
+// larger payloads are a protocol error and close the connection
+#define DAKLAKWL_CONTROL_MAX_PAYLOAD 4096
+
+struct daklakwl_control_header {
+	uint32_t size;
+	uint16_t type;
+	// reserved, 0
+	uint16_t flags;
+	uint32_t id;
+};
+
+enum daklakwl_control_type {
+	// Requests. Unless noted the reply has the same type and a
+	// struct daklakwl_control_state payload.
+	DAKLAKWL_CONTROL_GET_STATE = 1,
+	// payload: method name, not NUL-terminated
+	DAKLAKWL_CONTROL_SET_METHOD,
+	DAKLAKWL_CONTROL_TOGGLE,
+	DAKLAKWL_CONTROL_ENABLE,
+	DAKLAKWL_CONTROL_DISABLE,
+	// reply payload: "name value\n" lines
+	DAKLAKWL_CONTROL_STATS,
+	// state events follow until unsubscribed; the reply carries the
+	// current state so nothing is missed in between
+	DAKLAKWL_CONTROL_SUBSCRIBE,
+	// empty reply
+	DAKLAKWL_CONTROL_UNSUBSCRIBE,
+	// start or stop recording the key path trace, empty reply
+	DAKLAKWL_CONTROL_TRACE_START,
+	DAKLAKWL_CONTROL_TRACE_STOP,
+	// payload: absolute path to write the trace to, not NUL-terminated;
+	// empty reply
+	DAKLAKWL_CONTROL_TRACE_DUMP,
+
+	// reply to a request that failed, payload: reason
+	DAKLAKWL_CONTROL_ERROR = 0x100,
+	// sent to subscribers with id 0 whenever the state changes
+	DAKLAKWL_CONTROL_STATE_EVENT = 0x200,
+};
+
+enum daklakwl_control_method {
+	DAKLAKWL_CONTROL_METHOD_TELEX,
+	DAKLAKWL_CONTROL_METHOD_VNI,
+};
+
+struct daklakwl_control_state {
+	uint8_t composing;
+	uint8_t method;
+	uint16_t seats;
+};
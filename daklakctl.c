@@ -0,0 +1,276 @@
+// Command line client for the daklak control socket.
+//
+//	daklakctl command...
+//
+// Commands are sent together and their replies printed in order:
+//	state		print "on" or "off" and the typing method
+//	toggle, on, off	change the state and print it
+//	method NAME	switch the typing method
+//	stats		print daklak's counters
+//	watch		print the state now and whenever it changes
+//	trace on, trace off	start or stop recording the key path
+//	trace dump FILE	write the recorded trace to FILE
+//
+// and, without talking to daklak,
+//	daklakctl trace2json FILE
+// prints a dumped trace as Chrome trace JSON, for Perfetto or
+// chrome://tracing.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "trace.h"
+
+static char const *const methods[] = {
+    [DAKLAKWL_CONTROL_METHOD_TELEX] = "telex",
+    [DAKLAKWL_CONTROL_METHOD_VNI] = "vni",
+};
+
+struct request {
+	uint16_t type;
+	char const *payload;
+};
+
+// daklak does not share our working directory
+static char const *absolute_path(char const *path)
+{
+	static char absolute[PATH_MAX];
+	if (path[0] == '/')
+		return path;
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof cwd) == NULL) {
+		perror("getcwd");
+		return NULL;
+	}
+	if (snprintf(absolute, sizeof absolute, "%s/%s", cwd, path)
+	    >= (int)sizeof absolute) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return NULL;
+	}
+	return absolute;
+}
+
+static bool parse_command(int *i, int argc, char *argv[],
+			  struct request *request)
+{
+	char const *command = argv[*i];
+	request->payload = NULL;
+	if (strcmp(command, "state") == 0)
+		request->type = DAKLAKWL_CONTROL_GET_STATE;
+	else if (strcmp(command, "toggle") == 0)
+		request->type = DAKLAKWL_CONTROL_TOGGLE;
+	else if (strcmp(command, "on") == 0)
+		request->type = DAKLAKWL_CONTROL_ENABLE;
+	else if (strcmp(command, "off") == 0)
+		request->type = DAKLAKWL_CONTROL_DISABLE;
+	else if (strcmp(command, "stats") == 0)
+		request->type = DAKLAKWL_CONTROL_STATS;
+	else if (strcmp(command, "watch") == 0)
+		request->type = DAKLAKWL_CONTROL_SUBSCRIBE;
+	else if (strcmp(command, "method") == 0 && *i + 1 < argc) {
+		request->type = DAKLAKWL_CONTROL_SET_METHOD;
+		request->payload = argv[++*i];
+	}
+	else if (strcmp(command, "trace") == 0 && *i + 1 < argc
+		 && strcmp(argv[*i + 1], "on") == 0) {
+		request->type = DAKLAKWL_CONTROL_TRACE_START;
+		++*i;
+	}
+	else if (strcmp(command, "trace") == 0 && *i + 1 < argc
+		 && strcmp(argv[*i + 1], "off") == 0) {
+		request->type = DAKLAKWL_CONTROL_TRACE_STOP;
+		++*i;
+	}
+	else if (strcmp(command, "trace") == 0 && *i + 2 < argc
+		 && strcmp(argv[*i + 1], "dump") == 0) {
+		request->type = DAKLAKWL_CONTROL_TRACE_DUMP;
+		*i += 2;
+		request->payload = absolute_path(argv[*i]);
+		if (request->payload == NULL)
+			return false;
+	}
+	else {
+		fprintf(stderr, "unknown command %s\n", command);
+		return false;
+	}
+	return true;
+}
+
+static void print_message(struct daklakwl_control_header const *header,
+			  char const *payload)
+{
+	if (header->type == DAKLAKWL_CONTROL_ERROR) {
+		fprintf(stderr, "error: %.*s\n", (int)header->size, payload);
+		return;
+	}
+	if (header->type == DAKLAKWL_CONTROL_STATS) {
+		fwrite(payload, 1, header->size, stdout);
+		return;
+	}
+	if (header->type == DAKLAKWL_CONTROL_TRACE_START
+	    || header->type == DAKLAKWL_CONTROL_TRACE_STOP
+	    || header->type == DAKLAKWL_CONTROL_TRACE_DUMP)
+		return;
+	struct daklakwl_control_state state;
+	if (header->size < sizeof state)
+		return;
+	memcpy(&state, payload, sizeof state);
+	char const *method = state.method < sizeof methods / sizeof methods[0]
+				 ? methods[state.method]
+				 : "unknown";
+	printf("%s %s\n", state.composing ? "on" : "off", method);
+	fflush(stdout);
+}
+
+static int trace2json(char const *path)
+{
+	FILE *file = fopen(path, "re");
+	if (file == NULL) {
+		perror(path);
+		return 1;
+	}
+	struct daklakwl_trace_header header;
+	if (fread(&header, sizeof header, 1, file) != 1
+	    || memcmp(header.magic, DAKLAKWL_TRACE_MAGIC, sizeof header.magic)
+		   != 0
+	    || header.version != DAKLAKWL_TRACE_VERSION) {
+		fprintf(stderr, "%s: not a daklak trace\n", path);
+		fclose(file);
+		return 1;
+	}
+	// instant events on one track per seat, microseconds from the first
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	struct daklakwl_trace_record record;
+	uint64_t start = 0;
+	for (uint32_t i = 0; i < header.count; i++) {
+		if (fread(&record, sizeof record, 1, file) != 1) {
+			fprintf(stderr, "%s: truncated\n", path);
+			break;
+		}
+		if (i == 0)
+			start = record.time;
+		char const *name = record.stage < _DAKLAKWL_TRACE_LAST
+				       ? daklakwl_trace_stage_names[record.stage]
+				       : "unknown";
+		uint64_t ns = record.time - start;
+		printf("%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+		       "\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%u,"
+		       "\"args\":{\"payload\":%llu}}",
+		       i == 0 ? "" : ",", name, (unsigned long long)(ns / 1000),
+		       (unsigned long long)(ns % 1000), record.seat,
+		       (unsigned long long)record.payload);
+	}
+	printf("\n]}\n");
+	fclose(file);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "trace2json") == 0)
+		return trace2json(argv[2]);
+	if (argc < 2) {
+		fprintf(stderr,
+			"usage: %s state|toggle|on|off|method NAME|stats|"
+			"watch|trace on|trace off|trace dump FILE...\n"
+			"       %s trace2json FILE\n",
+			argv[0], argv[0]);
+		return 1;
+	}
+
+	// every request goes out in one write
+	char out[64 * 1024];
+	size_t out_len = 0;
+	uint32_t requests = 0;
+	bool watch = false;
+	for (int i = 1; i < argc; i++) {
+		struct request request;
+		if (!parse_command(&i, argc, argv, &request))
+			return 1;
+		watch |= request.type == DAKLAKWL_CONTROL_SUBSCRIBE;
+		struct daklakwl_control_header header = {
+		    .size = request.payload ? strlen(request.payload) : 0,
+		    .type = request.type,
+		    .id = ++requests,
+		};
+		if (header.size > DAKLAKWL_CONTROL_MAX_PAYLOAD
+		    || out_len + sizeof header + header.size > sizeof out) {
+			fprintf(stderr, "too many commands\n");
+			return 1;
+		}
+		memcpy(out + out_len, &header, sizeof header);
+		if (header.size)
+			memcpy(out + out_len + sizeof header, request.payload,
+			       header.size);
+		out_len += sizeof header + header.size;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, DAKLAKWL_CONTROL_SOCKET,
+		sizeof address.sun_path - 1);
+	if (fd == -1
+	    || connect(fd, (struct sockaddr *)&address, sizeof address)
+		   == -1) {
+		perror("connect " DAKLAKWL_CONTROL_SOCKET);
+		return 1;
+	}
+	for (size_t sent = 0; sent < out_len;) {
+		ssize_t rc = send(fd, out + sent, out_len - sent, MSG_NOSIGNAL);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == -1) {
+			perror("send");
+			return 1;
+		}
+		sent += rc;
+	}
+
+	static char in[sizeof(struct daklakwl_control_header)
+		       + DAKLAKWL_CONTROL_MAX_PAYLOAD];
+	size_t in_len = 0;
+	uint32_t replies = 0;
+	int status = 0;
+	while (watch || replies < requests) {
+		ssize_t rc = recv(fd, in + in_len, sizeof in - in_len, 0);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			if (rc == -1)
+				perror("recv");
+			else
+				fprintf(stderr, "daklak closed the connection\n");
+			return 1;
+		}
+		in_len += rc;
+		struct daklakwl_control_header header;
+		size_t offset = 0;
+		while (in_len - offset >= sizeof header) {
+			memcpy(&header, in + offset, sizeof header);
+			if (header.size > DAKLAKWL_CONTROL_MAX_PAYLOAD) {
+				fprintf(stderr, "bad message from daklak\n");
+				return 1;
+			}
+			if (in_len - offset < sizeof header + header.size)
+				break;
+			print_message(&header, in + offset + sizeof header);
+			if (header.id != 0)
+				replies++;
+			if (header.type == DAKLAKWL_CONTROL_ERROR)
+				status = 1;
+			offset += sizeof header + header.size;
+		}
+		memmove(in, in + offset, in_len - offset);
+		in_len -= offset;
+	}
+	close(fd);
+	return status;
+}
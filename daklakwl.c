@@ -9,15 +9,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
-#include <sys/poll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <time.h>
 
-#include <poll.h>
 #include <pthread.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
 
 #include <scfg.h>
 #include <wayland-client.h>
@@ -29,22 +31,19 @@
 
 #include "buffer.h"
 #include "config.h"
+#include "control.h"
 #include "daklakwl.h"
+#include "dict.h"
+#include "learn.h"
+#include "metrics.h"
+#include "trace.h"
 #include "tray.h"
 
-#define min(a, b)                                                              \
-	({                                                                     \
-		__typeof__(a) _a = (a);                                        \
-		__typeof__(b) _b = (b);                                        \
-		_a < _b ? _a : _b;                                             \
-	})
-
-#define max(a, b)                                                              \
-	({                                                                     \
-		__typeof__(a) _a = (a);                                        \
-		__typeof__(b) _b = (b);                                        \
-		_a > _b ? _a : _b;                                             \
-	})
+// seats show up in traces and recordings by their wl_seat object id
+static uint32_t daklakwl_seat_id(struct daklakwl_seat *seat)
+{
+	return wl_proxy_get_id((struct wl_proxy *)seat->wl_seat);
+}
 
 void daklakwl_seat_init(struct daklakwl_seat *seat,
 			struct daklakwl_state *state, struct wl_seat *wl_seat)
@@ -52,308 +51,454 @@ void daklakwl_seat_init(struct daklakwl_seat *seat,
 	seat->state = state;
 	seat->wl_seat = wl_seat;
 	wl_seat_add_listener(wl_seat, &wl_seat_listener, seat);
-	seat->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	if (state->running)
 		daklakwl_seat_init_protocols(seat);
+	seat->engine = state->engine;
 	daklakwl_buffer_init(&seat->buffer);
+	wl_array_init(&seat->pending_commit);
+	wl_array_init(&seat->backlog);
+	seat->key_budget = DAKLAKWL_SEAT_KEY_BUDGET;
 	seat->repeat_timer.callback = daklakwl_seat_repeat_timer_callback;
-	seat->is_composing = true;
+	seat->is_composing = state->config.active_at_startup;
 }
 
 void daklakwl_seat_init_protocols(struct daklakwl_seat *seat)
 {
+	seat->queue = wl_display_create_queue(seat->state->wl_display);
 	seat->zwp_input_method_v2
 	    = zwp_input_method_manager_v2_get_input_method(
 		seat->state->zwp_input_method_manager_v2, seat->wl_seat);
+	// the grab and popup surface created from it inherit the queue
+	wl_proxy_set_queue((struct wl_proxy *)seat->zwp_input_method_v2,
+			   seat->queue);
 	zwp_input_method_v2_add_listener(seat->zwp_input_method_v2,
 					 &zwp_input_method_v2_listener, seat);
 	seat->zwp_virtual_keyboard_v1
 	    = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
 		seat->state->zwp_virtual_keyboard_manager_v1, seat->wl_seat);
-	seat->zwp_input_method_keyboard_grab_v2
-	    = zwp_input_method_v2_grab_keyboard(seat->zwp_input_method_v2);
-	zwp_input_method_keyboard_grab_v2_add_listener(
-	    seat->zwp_input_method_keyboard_grab_v2,
-	    &zwp_input_method_keyboard_grab_v2_listener, seat);
+	// the keyboard is grabbed once a text field activates
+	daklakwl_popup_init(&seat->popup, seat);
 	seat->are_protocols_initted = true;
 }
 
+// Whether a global binding can turn composition on, so its key has to
+// reach daklak even while composition is off.
+static bool daklakwl_state_key_enables(struct daklakwl_state *state)
+{
+	struct daklakwl_binding *binding;
+	wl_array_for_each(binding, &state->config.global_bindings)
+	{
+		if (binding->action == DAKLAKWL_ACTION_ENABLE
+		    || binding->action == DAKLAKWL_ACTION_TOGGLE)
+			return true;
+	}
+	return false;
+}
+
+// A grabbed key takes a detour through daklak and the virtual keyboard,
+// so the grab is only held while a text field daklak does not bypass is
+// active and composition is on or can be turned on from the keyboard. It
+// is let go once no key is held, so the client never gets a release
+// without its press.
+void daklakwl_seat_grab_update(struct daklakwl_seat *seat)
+{
+	if (!seat->are_protocols_initted || seat->unavailable)
+		return;
+	bool wanted = seat->active && seat->policy != DAKLAKWL_INPUT_BYPASS
+		      && (seat->is_composing
+			  || daklakwl_state_key_enables(seat->state));
+	seat->ungrab_pending = false;
+	if (wanted && seat->zwp_input_method_keyboard_grab_v2 == NULL) {
+		seat->grab_requested = daklakwl_metrics_now();
+		seat->keys_down = 0;
+		seat->zwp_input_method_keyboard_grab_v2
+		    = zwp_input_method_v2_grab_keyboard(
+			seat->zwp_input_method_v2);
+		zwp_input_method_keyboard_grab_v2_add_listener(
+		    seat->zwp_input_method_keyboard_grab_v2,
+		    &zwp_input_method_keyboard_grab_v2_listener, seat);
+	}
+	else if (!wanted && seat->zwp_input_method_keyboard_grab_v2 != NULL) {
+		if (seat->keys_down != 0) {
+			seat->ungrab_pending = true;
+			return;
+		}
+		zwp_input_method_keyboard_grab_v2_release(
+		    seat->zwp_input_method_keyboard_grab_v2);
+		seat->zwp_input_method_keyboard_grab_v2 = NULL;
+		seat->grab_requested = 0;
+		seat->repeating_keycode = 0;
+		daklakwl_timer_disarm(&seat->state->timers,
+				      &seat->repeat_timer);
+		memset(seat->pressed, 0, sizeof seat->pressed);
+	}
+}
+
 void daklakwl_seat_destroy(struct daklakwl_seat *seat)
 {
+	daklakwl_timer_disarm(&seat->state->timers, &seat->repeat_timer);
 	daklakwl_buffer_destroy(&seat->buffer);
+	wl_array_release(&seat->pending_commit);
+	wl_array_release(&seat->backlog);
 	free(seat->pending_surrounding_text);
 	free(seat->surrounding_text);
 	free(seat->name);
 	xkb_state_unref(seat->xkb_state);
-	xkb_keymap_unref(seat->xkb_keymap);
-	xkb_context_unref(seat->xkb_context);
-	free(seat->xkb_keymap_string);
+	free(seat->keys);
+	daklakwl_keymap_unref(&seat->state->keymaps, seat->keymap);
 	if (seat->are_protocols_initted) {
+		daklakwl_popup_finish(&seat->popup);
 		zwp_virtual_keyboard_v1_destroy(seat->zwp_virtual_keyboard_v1);
-		zwp_input_method_keyboard_grab_v2_destroy(
-		    seat->zwp_input_method_keyboard_grab_v2);
+		if (seat->zwp_input_method_keyboard_grab_v2 != NULL)
+			zwp_input_method_keyboard_grab_v2_destroy(
+			    seat->zwp_input_method_keyboard_grab_v2);
 		zwp_input_method_v2_destroy(seat->zwp_input_method_v2);
+		wl_event_queue_destroy(seat->queue);
 	}
 	wl_seat_destroy(seat->wl_seat);
 	wl_list_remove(&seat->link);
 	free(seat);
 }
 
-static void
-daklakwl_send_message_to_socket_clients(struct daklakwl_state *state, char *msg,
-					int sender)
+bool daklakwl_seat_should_restore(struct daklakwl_seat *seat)
 {
-	for (int i = 2; i < state->nfds; i++) {
-		if (state->fds[i].fd != sender) {
-			int byte_cnt
-			    = send(state->fds[i].fd, msg, strlen(msg), 0);
-			if (byte_cnt == -1) {
-				perror("send message");
-			}
-		}
-	}
+	return daklakwl_word_should_restore(
+	    &seat->buffer, &seat->state->english, &seat->state->dict);
 }
 
 void daklakwl_seat_composing_update(struct daklakwl_seat *seat)
 {
-	zwp_input_method_v2_set_preedit_string(
-	    seat->zwp_input_method_v2, seat->buffer.text, seat->buffer.pos,
-	    seat->buffer.pos);
-	zwp_input_method_v2_commit(seat->zwp_input_method_v2,
-				   seat->done_events_received);
+	seat->needs_flush = true;
 }
 
-void daklakwl_seat_composing_commit(struct daklakwl_seat *seat)
+void daklakwl_seat_flush(struct daklakwl_seat *seat)
 {
-	zwp_input_method_v2_commit_string(seat->zwp_input_method_v2,
-					  seat->buffer.text);
+	// Everything since the last flush goes out as one input method
+	// commit, so a burst of keys costs one preedit and one popup redraw.
+	if (!seat->needs_flush)
+		return;
+	seat->needs_flush = false;
+	DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_FLUSH,
+		       seat->pending_commit.size);
+	if (seat->pending_delete != 0) {
+		zwp_input_method_v2_delete_surrounding_text(
+		    seat->zwp_input_method_v2, seat->pending_delete, 0);
+		seat->pending_delete = 0;
+	}
+	if (seat->pending_commit.size != 0) {
+		*(char *)wl_array_add(&seat->pending_commit, 1) = '\0';
+		zwp_input_method_v2_commit_string(seat->zwp_input_method_v2,
+						  seat->pending_commit.data);
+		daklakwl_metrics_count(DAKLAKWL_COUNTER_COMMITS, 1);
+		daklakwl_metrics_count(DAKLAKWL_COUNTER_COMMIT_BYTES,
+				       seat->pending_commit.size - 1);
+		seat->pending_commit.size = 0;
+	}
+	if (seat->buffer.len != 0 && daklakwl_seat_should_restore(seat)) {
+		size_t len = strlen(seat->buffer.raw);
+		zwp_input_method_v2_set_preedit_string(
+		    seat->zwp_input_method_v2, seat->buffer.raw, len, len);
+		daklakwl_metrics_count(DAKLAKWL_COUNTER_PREEDITS, 1);
+		daklakwl_metrics_count(DAKLAKWL_COUNTER_PREEDIT_BYTES, len);
+		DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_PREEDIT,
+			       len);
+	}
+	else if (seat->buffer.len != 0) {
+		size_t cursor;
+		char const *text = seat->engine->preedit(&seat->buffer, &cursor);
+		size_t len = strlen(text);
+		zwp_input_method_v2_set_preedit_string(
+		    seat->zwp_input_method_v2, text, cursor, cursor);
+		daklakwl_metrics_count(DAKLAKWL_COUNTER_PREEDITS, 1);
+		daklakwl_metrics_count(DAKLAKWL_COUNTER_PREEDIT_BYTES, len);
+		DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_PREEDIT,
+			       len);
+	}
 	zwp_input_method_v2_commit(seat->zwp_input_method_v2,
 				   seat->done_events_received);
-	daklakwl_buffer_clear(&seat->buffer);
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_IM_COMMITS, 1);
+	daklakwl_seat_candidates_update(seat);
 }
 
-int daklakwl_binding_compare(void const *_a, void const *_b)
+void daklakwl_seat_forward_key(struct daklakwl_seat *seat, uint32_t time,
+			       uint32_t key, uint32_t state)
 {
-	const struct daklakwl_binding *a = _a;
-	const struct daklakwl_binding *b = _b;
-	int keysym = a->keysym - b->keysym;
-	if (keysym != 0)
-		return keysym;
-	int modifiers = a->modifiers - b->modifiers;
-	if (modifiers != 0)
-		return modifiers;
-	return a->action - b->action;
+	// queued text has to reach the client before the key does
+	daklakwl_seat_flush(seat);
+	zwp_virtual_keyboard_v1_key(seat->zwp_virtual_keyboard_v1, time, key,
+				    state);
 }
 
-int daklakwl_seat_binding_compare_without_action(void const *_a, void const *_b)
+void daklakwl_seat_composing_commit(struct daklakwl_seat *seat)
 {
-	const struct daklakwl_seat_binding *a = _a;
-	const struct daklakwl_seat_binding *b = _b;
-	int keycode = a->keycode - b->keycode;
-	if (keycode != 0)
-		return keycode;
-	return a->mod_mask - b->mod_mask;
+	char *expansion = daklakwl_word_shortcut_expand(
+	    &seat->state->shortcuts, seat->shortcut_state, &seat->buffer);
+	char const *text = seat->engine->commit(&seat->buffer);
+	char word[DAKLAKWL_WORD_MAX];
+	bool whole = false;
+	if (expansion) {
+		// the consonants the client already has go too, "ko" leaves
+		// no "k" in front of "không"
+		seat->pending_delete += strlen(seat->buffer.prefix);
+		text = expansion;
+		whole = strlen(text) < sizeof word;
+		if (whole)
+			strcpy(word, text);
+	}
+	else {
+		if (daklakwl_seat_should_restore(seat))
+			text = seat->buffer.raw;
+		whole = daklakwl_word_get(&seat->buffer, text, word);
+	}
+	size_t len = strlen(text);
+	memcpy(wl_array_add(&seat->pending_commit, len), text, len);
+	seat->needs_flush = true;
+	if (seat->buffer.len != 0 && whole && daklakwl_word_fold(word)) {
+		char prev[DAKLAKWL_WORD_MAX];
+		daklakwl_seat_previous_word(seat, prev);
+		daklakwl_learn_record(&seat->state->learn, prev, word);
+	}
+	free(expansion);
+	seat->engine->reset(&seat->buffer);
+	seat->shortcut_state = DAKLAKWL_SHORTCUT_ROOT;
 }
 
-bool daklakwl_seat_handle_key_bindings(struct daklakwl_seat *seat,
-				       struct wl_array *bindings,
-				       struct daklakwl_seat_binding *press)
+bool daklakwl_seat_previous_word(struct daklakwl_seat *seat,
+				 char word[DAKLAKWL_WORD_MAX])
 {
-	struct daklakwl_seat_binding *found
-	    = bsearch(press, bindings->data,
-		      bindings->size / sizeof(struct daklakwl_seat_binding),
-		      sizeof(struct daklakwl_seat_binding),
-		      daklakwl_seat_binding_compare_without_action);
-	if (found == NULL)
+	word[0] = '\0';
+	char const *text = seat->surrounding_text;
+	if (text == NULL)
 		return false;
-	return daklakwl_seat_handle_action(seat, found->action);
+	size_t end = min((size_t)seat->surrounding_text_cursor, strlen(text));
+	// the consonants of the word being typed are already in the text
+	size_t prefix = strlen(seat->buffer.prefix);
+	if (prefix != 0 && end >= prefix
+	    && memcmp(text + end - prefix, seat->buffer.prefix, prefix) == 0)
+		end -= prefix;
+	while (end > 0 && (text[end - 1] == ' ' || text[end - 1] == '\t'))
+		end--;
+	size_t start = end;
+	while (start > 0 && !strchr(" \t\n.,;:!?\"'()", text[start - 1]))
+		start--;
+	if (start == end || end - start >= DAKLAKWL_WORD_MAX)
+		return false;
+	memcpy(word, text + start, end - start);
+	word[end - start] = '\0';
+	if (daklakwl_word_fold(word))
+		return true;
+	word[0] = '\0';
+	return false;
 }
 
-bool daklakwl_seat_handle_key(struct daklakwl_seat *seat, xkb_keycode_t keycode)
+void daklakwl_seat_candidates_update(struct daklakwl_seat *seat)
 {
-	xkb_keysym_t keysym
-	    = xkb_state_key_get_one_sym(seat->xkb_state, keycode);
-	struct daklakwl_seat_binding press = {
-	    .keycode = keycode,
-	    .mod_mask = 0,
-	    .action = 0,
-	};
-	xkb_mod_mask_t mod_count = xkb_keymap_num_mods(seat->xkb_keymap);
-	for (xkb_mod_index_t i = 0; i < mod_count; i++) {
-		bool is_active = xkb_state_mod_index_is_active(
-		    seat->xkb_state, i, XKB_STATE_MODS_EFFECTIVE);
-		bool is_consumed = xkb_state_mod_index_is_consumed(
-		    seat->xkb_state, keycode, i);
-		bool is_relevant
-		    = (i != seat->mod_indices[DAKLAKWL_CAPS_INDEX])
-		      && (i != seat->mod_indices[DAKLAKWL_NUM_INDEX]);
-		(void)is_consumed;
-		if (is_active && is_relevant)
-			press.mod_mask |= 1 << i;
-	}
-
-	if (seat->is_composing && seat->buffer.len != 0
-	    && daklakwl_seat_handle_key_bindings(
-		seat, &seat->composing_bindings, &press)) {
-		return true;
+	seat->candidates_len = 0;
+	char word[DAKLAKWL_WORD_MAX];
+	if (seat->buffer.len != 0
+	    && daklakwl_word_get(&seat->buffer, seat->buffer.text, word))
+		seat->candidates_len = daklakwl_dict_lookup(
+		    &seat->state->dict, word, seat->candidates,
+		    DAKLAKWL_DICT_TOPK);
+	if (seat->candidates_len >= 2)
+		daklakwl_seat_candidates_rank(seat);
+	daklakwl_popup_update(&seat->popup);
+}
+
+void daklakwl_seat_candidates_rank(struct daklakwl_seat *seat)
+{
+	// Words this user typed after the previous word come first, then
+	// words they type often, then the dictionary's own order.
+	char prev[DAKLAKWL_WORD_MAX];
+	daklakwl_seat_previous_word(seat, prev);
+	struct daklakwl_learn *learn = &seat->state->learn;
+	uint64_t scores[DAKLAKWL_DICT_TOPK];
+	for (size_t i = 0; i < seat->candidates_len; i++) {
+		struct daklakwl_dict_candidate candidate = seat->candidates[i];
+		uint64_t score
+		    = (uint64_t)min(daklakwl_learn_bigram(learn, prev,
+							  candidate.text),
+				    0xffffu)
+			  << 48
+		      | (uint64_t)min(daklakwl_learn_unigram(learn,
+							     candidate.text),
+				      0xffffu)
+			    << 32
+		      | candidate.frequency;
+		size_t j = i;
+		for (; j > 0 && scores[j - 1] < score; j--) {
+			scores[j] = scores[j - 1];
+			seat->candidates[j] = seat->candidates[j - 1];
+		}
+		scores[j] = score;
+		seat->candidates[j] = candidate;
 	}
-	if (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R
-	    || keysym == XKB_KEY_Control_L || keysym == XKB_KEY_Control_R
-	    || keysym == XKB_KEY_Alt_L || keysym == XKB_KEY_Alt_R
-	    || keysym == XKB_KEY_Super_L || keysym == XKB_KEY_Super_R
-	    || keysym == XKB_KEY_Hyper_L || keysym == XKB_KEY_Hyper_R
-	    || keysym == XKB_KEY_Caps_Lock) {
-		return false;
+}
+
+struct daklakwl_key const *daklakwl_seat_key(struct daklakwl_seat *seat,
+					    xkb_keycode_t keycode)
+{
+	struct daklakwl_key *key = keycode < seat->keys_len
+				       ? &seat->keys[keycode]
+				       : &seat->key_scratch;
+	if (key == &seat->key_scratch
+	    || key->generation != seat->keys_generation) {
+		daklakwl_keymap_classify(seat->xkb_state, keycode, key);
+		key->generation = seat->keys_generation;
+	}
+	return key;
+}
+
+void daklakwl_seat_keys_invalidate(struct daklakwl_seat *seat)
+{
+	// generation 0 is what a fresh table holds, never hand it out
+	if (++seat->keys_generation == 0) {
+		memset(seat->keys, 0, seat->keys_len * sizeof *seat->keys);
+		seat->keys_generation = 1;
+	}
+}
+
+static bool daklakwl_seat_process_key(struct daklakwl_seat *seat,
+				      xkb_keycode_t keycode)
+{
+	struct daklakwl_key const *key = daklakwl_seat_key(seat, keycode);
+	struct daklakwl_keymap *keymap = seat->keymap;
+
+	if (seat->is_composing && seat->buffer.len != 0) {
+		enum daklakwl_action action = daklakwl_binding_table_lookup(
+		    &keymap->composing_bindings, keycode, seat->mod_class);
+		DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_BINDING,
+			       action);
+		if (daklakwl_seat_handle_action(seat, action)) {
+			// edits can touch any part of the word, start over
+			seat->shortcut_state = daklakwl_word_shortcut_walk(
+			    &seat->state->shortcuts, &seat->buffer);
+			return true;
+		}
 	}
-	if (seat->is_composing) {
-		bool ctrl_active = xkb_state_mod_name_is_active(
-			seat->xkb_state, XKB_MOD_NAME_CTRL, XKB_STATE_EFFECTIVE);
-		bool shift_active = xkb_state_mod_name_is_active(
-			seat->xkb_state, XKB_MOD_NAME_SHIFT, XKB_STATE_EFFECTIVE);
-		if (ctrl_active || (ctrl_active && shift_active)) {
+	if (key->class == DAKLAKWL_KEY_MODIFIER)
+		return false;
+	if (seat->is_composing && seat->policy == DAKLAKWL_INPUT_COMPOSE) {
+		if (seat->mod_mask & keymap->ctrl_mods) {
 			// like move cursor or select word or select all
 			daklakwl_seat_composing_commit(seat);
 			return false;
 		}
-		xkb_keysym_t keysym
-		    = xkb_state_key_get_one_sym(seat->xkb_state, keycode);
-
-		if (!((keysym >= XKB_KEY_a && keysym <= XKB_KEY_z)
-		      || (keysym >= XKB_KEY_A && keysym <= XKB_KEY_Z))) {
-			if (seat->buffer.len == 0)
+		if (key->class != DAKLAKWL_KEY_LETTER
+		    && (key->class != DAKLAKWL_KEY_DIGIT
+			|| !seat->engine->takes_digits)) {
+			if (seat->buffer.len == 0
+			    && seat->buffer.prefix[0] == '\0')
 				return false;
 			daklakwl_seat_composing_commit(seat);
 			return false;
 		}
 
-		uint32_t codepoint
-		    = xkb_state_key_get_utf32(seat->xkb_state, keycode);
-		if (codepoint != 0 && codepoint < 32)
-			return false;
-
-		int utf8_len
-		    = xkb_state_key_get_utf8(seat->xkb_state, keycode, NULL, 0);
-		if (utf8_len == 0)
+		char const *utf8 = key->utf8;
+		bool at_end = seat->buffer.pos == seat->buffer.len;
+		if (seat->buffer.prefix[0] == '\0'
+		    && seat->buffer.raw[0] == '\0')
+			seat->shortcut_state = DAKLAKWL_SHORTCUT_ROOT;
+		uint64_t start = daklakwl_metrics_now();
+		enum daklakwl_engine_result result
+		    = seat->engine->feed(&seat->buffer, utf8);
+		daklakwl_metrics_record(DAKLAKWL_HISTOGRAM_COMPOSE,
+					daklakwl_metrics_now() - start);
+		if (result == DAKLAKWL_ENGINE_PASS) {
+			seat->engine->reset(&seat->buffer);
 			return false;
-
-		char *utf8 = malloc(utf8_len + 1);
-		xkb_state_key_get_utf8(seat->xkb_state, keycode, utf8,
-				       utf8_len + 1);
-
-		daklakwl_buffer_gi_append(&seat->buffer, utf8);
-		if (daklakwl_buffer_should_not_append(&seat->buffer, utf8)) {
-			free(utf8);
+		}
+		// abbreviations can start with consonants, "ko" is one
+		if (result == DAKLAKWL_ENGINE_PREFIX) {
+			seat->shortcut_state = daklakwl_shortcuts_feed(
+			    &seat->state->shortcuts, seat->shortcut_state,
+			    utf8[0]);
 			return false;
 		}
-		daklakwl_buffer_raw_append(&seat->buffer, utf8);
-		daklakwl_buffer_append(&seat->buffer, utf8);
-		daklakwl_buffer_compose(&seat->buffer);
+		DAKLAKWL_TRACE(daklakwl_seat_id(seat),
+			       DAKLAKWL_TRACE_RAW_APPEND, (uint8_t)utf8[0]);
+		if (at_end)
+			seat->shortcut_state = daklakwl_shortcuts_feed(
+			    &seat->state->shortcuts, seat->shortcut_state,
+			    utf8[0]);
+		else
+			seat->shortcut_state = daklakwl_word_shortcut_walk(
+			    &seat->state->shortcuts, &seat->buffer);
+		if (result == DAKLAKWL_ENGINE_COMPOSED)
+			DAKLAKWL_TRACE(daklakwl_seat_id(seat),
+				       DAKLAKWL_TRACE_COMPOSE,
+				       (uint8_t)utf8[0]);
 		daklakwl_seat_composing_update(seat);
-		free(utf8);
 		return true;
 	}
+	// consonants typed before composing stopped are not this word's
+	if (seat->buffer.prefix[0] != '\0')
+		seat->engine->reset(&seat->buffer);
 	return false;
 }
 
-static void timespec_correct(struct timespec *ts)
+bool daklakwl_seat_handle_key(struct daklakwl_seat *seat, xkb_keycode_t keycode)
 {
-	while (ts->tv_nsec >= 1000000000) {
-		ts->tv_sec += 1;
-		ts->tv_nsec -= 1000000000;
-	}
+	uint64_t start = daklakwl_metrics_now();
+	bool handled = daklakwl_seat_process_key(seat, keycode);
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_KEYS, 1);
+	daklakwl_metrics_record(DAKLAKWL_HISTOGRAM_KEY,
+				daklakwl_metrics_now() - start);
+	return handled;
 }
 
-void daklakwl_seat_repeat_timer_callback(struct daklakwl_timer *timer)
+void daklakwl_seat_repeat_start(struct daklakwl_seat *seat)
 {
-	struct daklakwl_seat *seat = wl_container_of(timer, seat, repeat_timer);
-	seat->repeating_timestamp += 1000 / seat->repeat_rate;
-	if (!daklakwl_seat_handle_key(seat, seat->repeating_keycode)) {
-		wl_list_remove(&timer->link);
-		zwp_virtual_keyboard_v1_key(
-		    seat->zwp_virtual_keyboard_v1, seat->repeating_timestamp,
-		    seat->repeating_keycode - 8, WL_KEYBOARD_KEY_STATE_PRESSED);
-		seat->repeating_keycode = 0;
-	}
-	else {
-		clock_gettime(CLOCK_MONOTONIC, &seat->repeat_timer.time);
-		timer->time.tv_nsec += 1000000000 / seat->repeat_rate;
-		timespec_correct(&timer->time);
+	if (seat->repeat_rate == 0) {
+		daklakwl_timer_disarm(&seat->state->timers, &seat->repeat_timer);
+		return;
 	}
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	daklakwl_timespec_add_ns(&time, seat->repeat_delay * 1000000LL);
+	daklakwl_timer_arm(&seat->state->timers, &seat->repeat_timer, time);
 }
 
-struct keycode_matches {
-	struct daklakwl_seat *seat;
-	xkb_keysym_t keysym;
-	struct wl_array keycodes;
-};
-
-static void find_keycode(struct xkb_keymap *keymap, xkb_keycode_t keycode,
-			 void *data)
+void daklakwl_seat_repeat_timer_callback(struct daklakwl_timer *timer)
 {
-	struct keycode_matches *matches = data;
-	xkb_keysym_t keysym
-	    = xkb_state_key_get_one_sym(matches->seat->xkb_state, keycode);
-	if (keysym == XKB_KEY_NoSymbol)
+	struct daklakwl_seat *seat = wl_container_of(timer, seat, repeat_timer);
+	// a release waiting in the backlog ends the repeat
+	daklakwl_seat_backlog_drain(seat, NULL);
+	if (seat->repeating_keycode == 0)
 		return;
-	if (matches->keysym == keysym) {
-		xkb_keycode_t *keycode_spot
-		    = wl_array_add(&matches->keycodes, sizeof(xkb_keycode_t));
-		*keycode_spot = keycode;
+	// Every tick that expired while we were busy is applied here in
+	// one go, up to a second's worth, and flushed once afterwards.
+	int64_t period = 1000000000 / seat->repeat_rate;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t late = (now.tv_sec - timer->time.tv_sec) * 1000000000LL
+		       + (now.tv_nsec - timer->time.tv_nsec);
+	int64_t ticks = min(late / period + 1, (int64_t)seat->repeat_rate);
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_REPEAT_TICKS, ticks);
+	DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_TIMER, ticks);
+	for (int64_t i = 0; i < ticks; i++) {
+		seat->repeating_timestamp += 1000 / seat->repeat_rate;
+		if (!daklakwl_seat_handle_key(seat,
+					      seat->repeating_keycode)) {
+			daklakwl_seat_forward_key(
+			    seat, seat->repeating_timestamp,
+			    seat->repeating_keycode - 8,
+			    WL_KEYBOARD_KEY_STATE_PRESSED);
+			seat->repeating_keycode = 0;
+			return;
+		}
 	}
-}
 
-int daklakwl_seat_binding_compare(void const *_a, void const *_b)
-{
-	const struct daklakwl_seat_binding *a = _a;
-	const struct daklakwl_seat_binding *b = _b;
-	int keycode = a->keycode - b->keycode;
-	if (keycode != 0)
-		return keycode;
-	int mod_mask = a->mod_mask - b->mod_mask;
-	if (mod_mask != 0)
-		return mod_mask;
-	return a->action - b->action;
-}
-
-void daklakwl_seat_set_up_bindings(struct daklakwl_seat *seat,
-				   struct wl_array *state_bindings,
-				   struct wl_array *seat_bindings)
-{
-	struct daklakwl_binding *state_binding;
-	struct keycode_matches matches = {
-	    .seat = seat,
-	};
-	wl_array_init(&matches.keycodes);
-	wl_array_for_each(state_binding, state_bindings)
-	{
-		matches.keysym = state_binding->keysym;
-		matches.keycodes.size = 0;
-		xkb_keymap_key_for_each(seat->xkb_keymap, find_keycode,
-					&matches);
-		assert(matches.keycodes.size);
-		xkb_mod_mask_t mod_mask = 0;
-		for (int i = 0; i < _DAKLAKWL_MOD_LAST; i++) {
-			if (state_binding->modifiers & (1 << i)) {
-				mod_mask |= 1 << seat->mod_indices[i];
-			}
-		}
-		xkb_keycode_t *keycode;
-		wl_array_for_each(keycode, &matches.keycodes)
-		{
-			struct daklakwl_seat_binding *seat_binding
-			    = wl_array_add(
-				seat_bindings,
-				sizeof(struct daklakwl_seat_binding));
-			seat_binding->keycode = *keycode;
-			seat_binding->mod_mask = mod_mask;
-			seat_binding->action = state_binding->action;
-		}
+	// Step from the previous deadline so the rate does not drift with
+	// dispatch latency; if the backlog was cut short, start over.
+	struct timespec next = timer->time;
+	daklakwl_timespec_add_ns(&next, ticks * period);
+	if (next.tv_sec < now.tv_sec
+	    || (next.tv_sec == now.tv_sec && next.tv_nsec < now.tv_nsec)) {
+		next = now;
+		daklakwl_timespec_add_ns(&next, period);
 	}
-	qsort(seat_bindings->data,
-	      seat_bindings->size / sizeof(struct daklakwl_seat_binding),
-	      sizeof(struct daklakwl_seat_binding),
-	      daklakwl_seat_binding_compare);
-	wl_array_release(&matches.keycodes);
+	daklakwl_timer_arm(&seat->state->timers, timer, next);
 }
 
 void zwp_input_method_keyboard_grab_v2_keymap(
@@ -362,77 +507,138 @@ void zwp_input_method_keyboard_grab_v2_keymap(
     uint32_t format, int32_t fd, uint32_t size)
 {
 	struct daklakwl_seat *seat = data;
+	struct daklakwl_state *state = seat->state;
+	// keys sent before the new keymap are read with the old one
+	daklakwl_seat_backlog_drain(seat, NULL);
 	char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (seat->xkb_keymap_string == NULL
-	    || strcmp(seat->xkb_keymap_string, map) != 0) {
+	if (map == MAP_FAILED) {
+		perror("mmap keymap");
+		close(fd);
+		return;
+	}
+	if (state->recorder.file != NULL)
+		daklakwl_recorder_keymap(&state->recorder,
+					 daklakwl_seat_id(seat), map, size);
+	struct daklakwl_keymap *keymap = daklakwl_keymap_cache_get(
+	    &state->keymaps, map, size, &state->config);
+	if (keymap != NULL && keymap != seat->keymap) {
 		zwp_virtual_keyboard_v1_keymap(seat->zwp_virtual_keyboard_v1,
 					       format, fd, size);
-		xkb_keymap_unref(seat->xkb_keymap);
 		xkb_state_unref(seat->xkb_state);
-		seat->xkb_keymap = xkb_keymap_new_from_string(
-		    seat->xkb_context, map, XKB_KEYMAP_FORMAT_TEXT_V1,
-		    XKB_KEYMAP_COMPILE_NO_FLAGS);
-		seat->mod_indices[DAKLAKWL_SHIFT_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap,
-					       XKB_MOD_NAME_SHIFT);
-		seat->mod_indices[DAKLAKWL_CAPS_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap,
-					       XKB_MOD_NAME_CAPS);
-		seat->mod_indices[DAKLAKWL_CTRL_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap,
-					       XKB_MOD_NAME_CTRL);
-		seat->mod_indices[DAKLAKWL_ALT_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap,
-					       XKB_MOD_NAME_ALT);
-		seat->mod_indices[DAKLAKWL_NUM_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap,
-					       XKB_MOD_NAME_NUM);
-		seat->mod_indices[DAKLAKWL_MOD3_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap, "Mod3");
-		seat->mod_indices[DAKLAKWL_LOGO_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap,
-					       XKB_MOD_NAME_LOGO);
-		seat->mod_indices[DAKLAKWL_MOD5_INDEX]
-		    = xkb_keymap_mod_get_index(seat->xkb_keymap, "Mod5");
-		seat->xkb_state = xkb_state_new(seat->xkb_keymap);
-		free(seat->xkb_keymap_string);
-		seat->xkb_keymap_string = strdup(map);
-		daklakwl_seat_set_up_bindings(
-		    seat, &seat->state->config.composing_bindings,
-		    &seat->composing_bindings);
+		seat->xkb_state = xkb_state_new(keymap->xkb_keymap);
+		daklakwl_keymap_unref(&state->keymaps, seat->keymap);
+		seat->keymap = keymap;
+		seat->mod_mask = 0;
+		seat->mod_class = 0;
+		xkb_keycode_t keys_len = keymap->max_keycode + 1;
+		struct daklakwl_key *keys
+		    = realloc(seat->keys, keys_len * sizeof *keys);
+		if (keys != NULL) {
+			memset(keys, 0, keys_len * sizeof *keys);
+			seat->keys = keys;
+			seat->keys_len = keys_len;
+		}
+		daklakwl_seat_keys_invalidate(seat);
 	}
+	else
+		daklakwl_keymap_unref(&state->keymaps, keymap);
 	close(fd);
 	munmap(map, size);
+	if (seat->grab_requested != 0) {
+		daklakwl_metrics_record(DAKLAKWL_HISTOGRAM_GRAB,
+					daklakwl_metrics_now()
+					    - seat->grab_requested);
+		seat->grab_requested = 0;
+	}
+	if (!state->started && seat->keymap != NULL) {
+		// keys work now, the rest of startup goes next
+		daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_GRAB);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		daklakwl_timer_arm(&state->timers, &state->startup_timer, now);
+	}
 }
 
-void zwp_input_method_keyboard_grab_v2_key(
-    void *data,
-    struct zwp_input_method_keyboard_grab_v2 *zwp_input_method_keyboard_grab_v2,
-    uint32_t serial, uint32_t time, uint32_t key, uint32_t state)
+// Whether the focused field holds something like a password, whatever the
+// config lets daklak do with it.
+static bool daklakwl_seat_is_sensitive(struct daklakwl_seat *seat)
+{
+	return seat->active
+	       && (seat->content_type_purpose
+		       == ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PASSWORD
+		   || seat->content_type_purpose
+			  == ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PIN
+		   || seat->content_type_hint
+			  & (ZWP_TEXT_INPUT_V3_CONTENT_HINT_HIDDEN_TEXT
+			     | ZWP_TEXT_INPUT_V3_CONTENT_HINT_SENSITIVE_DATA));
+}
+
+static void daklakwl_seat_grab_key(struct daklakwl_seat *seat, uint32_t time,
+				   uint32_t key, uint32_t state)
 {
-	struct daklakwl_seat *seat = data;
 	xkb_keycode_t keycode = key + 8;
+	if (seat->state->recorder.file != NULL
+	    && seat->policy != DAKLAKWL_INPUT_BYPASS
+	    && !daklakwl_seat_is_sensitive(seat))
+		daklakwl_recorder_key(&seat->state->recorder,
+				      daklakwl_seat_id(seat), key, state);
+	DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_GRAB_KEY,
+		       keycode | (state == WL_KEYBOARD_KEY_STATE_PRESSED) << 16);
+	if (seat->keymap == NULL) {
+		daklakwl_seat_forward_key(seat, time, key, state);
+		return;
+	}
 	bool handled = false;
 
+	enum daklakwl_action action = DAKLAKWL_ACTION_INVALID;
+	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+		action = daklakwl_binding_table_lookup(
+		    &seat->keymap->global_bindings, keycode, seat->mod_class);
+		DAKLAKWL_TRACE(daklakwl_seat_id(seat), DAKLAKWL_TRACE_BINDING,
+			       action);
+	}
+	if (daklakwl_state_handle_action(seat->state, seat, action)) {
+		// swallow the release too
+		for (size_t i = 0;
+		     i < sizeof seat->pressed / sizeof seat->pressed[0]; i++) {
+			if (seat->pressed[i] == 0) {
+				seat->pressed[i] = keycode;
+				break;
+			}
+		}
+		return;
+	}
+	if (seat->policy == DAKLAKWL_INPUT_BYPASS) {
+		for (size_t i = 0;
+		     i < sizeof seat->pressed / sizeof seat->pressed[0]; i++) {
+			if (state == WL_KEYBOARD_KEY_STATE_RELEASED
+			    && seat->pressed[i] == keycode) {
+				seat->pressed[i] = 0;
+				return;
+			}
+		}
+		daklakwl_seat_forward_key(seat, time, key, state);
+		return;
+	}
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED
 	    && seat->repeating_keycode != 0
 	    && seat->repeating_keycode != keycode) {
 		if (!daklakwl_seat_handle_key(seat, keycode)) {
 			seat->repeating_keycode = 0;
-			wl_list_remove(&seat->repeat_timer.link);
+			daklakwl_timer_disarm(&seat->state->timers,
+					      &seat->repeat_timer);
 			goto forward;
 		}
-		if (xkb_keymap_key_repeats(seat->xkb_keymap, keycode)) {
+		if (daklakwl_seat_key(seat, keycode)->repeats) {
 			seat->repeating_keycode = keycode;
 			seat->repeating_timestamp = time + seat->repeat_delay;
-			clock_gettime(CLOCK_MONOTONIC,
-				      &seat->repeat_timer.time);
-			seat->repeat_timer.time.tv_nsec
-			    += seat->repeat_delay * 1000000;
-			timespec_correct(&seat->repeat_timer.time);
+			daklakwl_seat_repeat_start(seat);
 		}
 		else {
 			seat->repeating_keycode = 0;
+			daklakwl_timer_disarm(&seat->state->timers,
+					      &seat->repeat_timer);
 		}
 		return;
 	}
@@ -440,7 +646,8 @@ void zwp_input_method_keyboard_grab_v2_key(
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED
 	    && seat->repeating_keycode == keycode) {
 		seat->repeating_keycode = 0;
-		wl_list_remove(&seat->repeat_timer.link);
+		daklakwl_timer_disarm(&seat->state->timers,
+				      &seat->repeat_timer);
 		return;
 	}
 
@@ -448,13 +655,10 @@ void zwp_input_method_keyboard_grab_v2_key(
 		handled |= daklakwl_seat_handle_key(seat, keycode);
 
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED
-	    && xkb_key_repeats(seat->xkb_keymap, keycode) && handled) {
+	    && daklakwl_seat_key(seat, keycode)->repeats && handled) {
 		seat->repeating_keycode = keycode;
 		seat->repeating_timestamp = time + seat->repeat_delay;
-		clock_gettime(CLOCK_MONOTONIC, &seat->repeat_timer.time);
-		seat->repeat_timer.time.tv_nsec += seat->repeat_delay * 1000000;
-		timespec_correct(&seat->repeat_timer.time);
-		wl_list_insert(&seat->state->timers, &seat->repeat_timer.link);
+		daklakwl_seat_repeat_start(seat);
 		return;
 	}
 
@@ -482,8 +686,106 @@ void zwp_input_method_keyboard_grab_v2_key(
 		return;
 
 forward:
-	zwp_virtual_keyboard_v1_key(seat->zwp_virtual_keyboard_v1, time, key,
-				    state);
+	daklakwl_seat_forward_key(seat, time, key, state);
+}
+
+static void daklakwl_seat_key_event(struct daklakwl_seat *seat, uint32_t time,
+				    uint32_t key, uint32_t state)
+{
+	// counted before a press is handled, in case it ends the grab
+	if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
+		seat->keys_down++;
+	daklakwl_seat_grab_key(seat, time, key, state);
+	if (state == WL_KEYBOARD_KEY_STATE_RELEASED && seat->keys_down > 0)
+		seat->keys_down--;
+	if (seat->ungrab_pending && seat->keys_down == 0)
+		daklakwl_seat_grab_update(seat);
+}
+
+static void daklakwl_seat_modifiers_event(struct daklakwl_seat *seat,
+					  uint32_t mods_depressed,
+					  uint32_t mods_latched,
+					  uint32_t mods_locked, uint32_t group)
+{
+	if (seat->state->recorder.file != NULL)
+		daklakwl_recorder_modifiers(
+		    &seat->state->recorder, daklakwl_seat_id(seat),
+		    mods_depressed, mods_latched, mods_locked, group);
+	if (seat->keymap != NULL) {
+		xkb_state_update_mask(seat->xkb_state, mods_depressed,
+				      mods_latched, mods_locked, 0, 0, group);
+		seat->mod_mask = xkb_state_serialize_mods(
+				     seat->xkb_state, XKB_STATE_MODS_EFFECTIVE)
+				 & ~seat->keymap->ignored_mods;
+		seat->mod_class
+		    = daklakwl_keymap_mod_class(seat->keymap, seat->mod_mask);
+		daklakwl_seat_keys_invalidate(seat);
+	}
+	daklakwl_seat_flush(seat);
+	zwp_virtual_keyboard_v1_modifiers(seat->zwp_virtual_keyboard_v1,
+					  mods_depressed, mods_latched,
+					  mods_locked, group);
+}
+
+bool daklakwl_seat_backlog_drain(struct daklakwl_seat *seat, uint32_t *budget)
+{
+	struct daklakwl_grab_event *events = seat->backlog.data;
+	size_t len = seat->backlog.size / sizeof *events;
+	while (seat->backlog_pos < len) {
+		struct daklakwl_grab_event *event = &events[seat->backlog_pos];
+		if (event->is_key && budget != NULL) {
+			if (*budget == 0)
+				return false;
+			(*budget)--;
+		}
+		seat->backlog_pos++;
+		if (event->is_key)
+			daklakwl_seat_key_event(seat, event->time, event->key,
+						event->state);
+		else
+			daklakwl_seat_modifiers_event(seat, event->depressed,
+						      event->latched,
+						      event->locked,
+						      event->group);
+	}
+	seat->backlog.size = 0;
+	seat->backlog_pos = 0;
+	return true;
+}
+
+static bool daklakwl_seat_backlog_push(struct daklakwl_seat *seat,
+				       struct daklakwl_grab_event event)
+{
+	struct daklakwl_grab_event *slot
+	    = wl_array_add(&seat->backlog, sizeof *slot);
+	if (slot == NULL) {
+		perror("wl_array_add");
+		return false;
+	}
+	*slot = event;
+	seat->state->backlogged = true;
+	return true;
+}
+
+void zwp_input_method_keyboard_grab_v2_key(
+    void *data,
+    struct zwp_input_method_keyboard_grab_v2 *zwp_input_method_keyboard_grab_v2,
+    uint32_t serial, uint32_t time, uint32_t key, uint32_t state)
+{
+	struct daklakwl_seat *seat = data;
+	// past the budget, or behind keys that are, it waits its turn
+	if ((seat->key_budget == 0 || seat->backlog.size != 0)
+	    && daklakwl_seat_backlog_push(
+		seat, (struct daklakwl_grab_event){
+			  .is_key = true,
+			  .time = time,
+			  .key = key,
+			  .state = state,
+		      }))
+		return;
+	if (seat->key_budget > 0)
+		seat->key_budget--;
+	daklakwl_seat_key_event(seat, time, key, state);
 }
 
 void zwp_input_method_keyboard_grab_v2_modifiers(
@@ -493,11 +795,18 @@ void zwp_input_method_keyboard_grab_v2_modifiers(
     uint32_t mods_locked, uint32_t group)
 {
 	struct daklakwl_seat *seat = data;
-	xkb_state_update_mask(seat->xkb_state, mods_depressed, mods_latched,
-			      mods_locked, 0, 0, group);
-	zwp_virtual_keyboard_v1_modifiers(seat->zwp_virtual_keyboard_v1,
-					  mods_depressed, mods_latched,
-					  mods_locked, group);
+	// keys held back have to see the modifiers they were pressed with
+	if (seat->backlog.size != 0
+	    && daklakwl_seat_backlog_push(
+		seat, (struct daklakwl_grab_event){
+			  .depressed = mods_depressed,
+			  .latched = mods_latched,
+			  .locked = mods_locked,
+			  .group = group,
+		      }))
+		return;
+	daklakwl_seat_modifiers_event(seat, mods_depressed, mods_latched,
+				      mods_locked, group);
 }
 
 void zwp_input_method_keyboard_grab_v2_repeat_info(
@@ -581,8 +890,38 @@ void zwp_input_method_v2_done(void *data,
 	seat->content_type_purpose = seat->pending_content_type_purpose;
 	seat->done_events_received++;
 	if (!was_active && seat->active) {
-		daklakwl_buffer_clear(&seat->buffer);
+		seat->engine->reset(&seat->buffer);
+	}
+	daklakwl_seat_policy_update(seat);
+	if (was_active != seat->active)
+		daklakwl_popup_update(&seat->popup);
+	// a new content type may bypass daklak
+	daklakwl_seat_grab_update(seat);
+}
+
+void daklakwl_seat_policy_update(struct daklakwl_seat *seat)
+{
+	struct daklakwl_config *config = &seat->state->config;
+	enum daklakwl_input_policy policy = DAKLAKWL_INPUT_COMPOSE;
+	if (seat->active) {
+		if (seat->content_type_purpose < DAKLAKWL_CONTENT_PURPOSES)
+			policy = config->purpose_policies
+				     [seat->content_type_purpose];
+		if (seat->content_type_hint
+		    & (ZWP_TEXT_INPUT_V3_CONTENT_HINT_HIDDEN_TEXT
+		       | ZWP_TEXT_INPUT_V3_CONTENT_HINT_SENSITIVE_DATA))
+			policy = max(policy, config->sensitive_policy);
+	}
+	if (policy == seat->policy)
+		return;
+	if (seat->active && seat->buffer.len != 0)
+		daklakwl_seat_composing_commit(seat);
+	if (policy == DAKLAKWL_INPUT_BYPASS && seat->repeating_keycode != 0) {
+		seat->repeating_keycode = 0;
+		daklakwl_timer_disarm(&seat->state->timers,
+				      &seat->repeat_timer);
 	}
+	seat->policy = policy;
 }
 
 void zwp_input_method_v2_unavailable(
@@ -591,7 +930,8 @@ void zwp_input_method_v2_unavailable(
 	struct daklakwl_seat *seat = data;
 	fprintf(stderr, "Input method unavailable on seat \"%s\".\n",
 		seat->name);
-	daklakwl_seat_destroy(seat);
+	// still inside the dispatch of this seat's queue
+	seat->unavailable = true;
 }
 
 struct zwp_input_method_v2_listener const zwp_input_method_v2_listener = {
@@ -630,6 +970,44 @@ void wl_seat_global(struct daklakwl_state *state, void *data)
 	wl_list_insert(&state->seats, &seat->link);
 }
 
+void wl_output_geometry(void *data, struct wl_output *wl_output, int32_t x,
+			int32_t y, int32_t physical_width,
+			int32_t physical_height, int32_t subpixel,
+			const char *make, const char *model, int32_t transform)
+{
+}
+
+void wl_output_mode(void *data, struct wl_output *wl_output, uint32_t flags,
+		    int32_t width, int32_t height, int32_t refresh)
+{
+}
+
+void wl_output_done(void *data, struct wl_output *wl_output) {}
+
+void wl_output_scale(void *data, struct wl_output *wl_output, int32_t factor)
+{
+	struct daklakwl_output *output = data;
+	output->scale = factor;
+}
+
+struct wl_output_listener const wl_output_listener = {
+    .geometry = wl_output_geometry,
+    .mode = wl_output_mode,
+    .done = wl_output_done,
+    .scale = wl_output_scale,
+};
+
+void wl_output_global(struct daklakwl_state *state, void *data)
+{
+	struct wl_output *wl_output = data;
+	struct daklakwl_output *output = calloc(1, sizeof *output);
+	output->state = state;
+	output->wl_output = wl_output;
+	output->scale = 1;
+	wl_output_add_listener(wl_output, &wl_output_listener, output);
+	wl_list_insert(&state->outputs, &output->link);
+}
+
 struct daklakwl_global {
 	char const *name;
 	struct wl_interface const *interface;
@@ -655,6 +1033,13 @@ static struct daklakwl_global const globals[] = {
 	.is_singleton = true,
 	.offset = offsetof(struct daklakwl_state, wl_compositor),
     },
+    {
+	.name = "wl_output",
+	.interface = &wl_output_interface,
+	.version = 2,
+	.is_singleton = false,
+	.callback = wl_output_global,
+    },
     {
 	.name = "wl_seat",
 	.interface = &wl_seat_interface,
@@ -722,11 +1107,37 @@ struct wl_registry_listener const wl_registry_listener = {
 bool daklakwl_state_init(struct daklakwl_state *state)
 {
 	wl_list_init(&state->seats);
-	wl_list_init(&state->timers);
+	wl_list_init(&state->outputs);
+	wl_list_init(&state->clients);
+	state->engine = &daklakwl_engine_telex;
+	state->loop.epoll_fd = -1;
+	state->listen_source.fd = -1;
+	state->signal_source.fd = -1;
+	state->to_tray.fd = -1;
+	state->from_tray.fd = -1;
+	state->reload.fd = -1;
+	state->reload.done.fd = -1;
+	state->startup_start = daklakwl_metrics_now();
+	state->startup_timer.callback = daklakwl_state_startup_callback;
 	daklakwl_config_init(&state->config);
 
-	if (!daklakwl_config_load(&state->config))
+	// Only what the first key needs is set up here; the rest waits for
+	// daklakwl_state_startup_callback.
+	char config_path[PATH_MAX];
+	if (!daklakwl_config_path(config_path, sizeof config_path)
+	    || !daklakwl_keymap_cache_init(&state->keymaps))
 		return false;
+	// a malformed file leaves the defaults, better than not starting
+	daklakwl_config_read(&state->config, config_path);
+	if (state->config.record_path != NULL
+	    && daklakwl_recorder_open(&state->recorder,
+				      state->config.record_path))
+		fprintf(stderr, "recording keys to %s\n",
+			state->config.record_path);
+	daklakwl_atlas_init(&state->atlas);
+	daklakwl_shortcuts_init(&state->shortcuts);
+	daklakwl_shortcuts_compile(&state->shortcuts, &state->config.shortcuts);
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_CONFIG);
 
 	state->wl_display = wl_display_connect(NULL);
 	if (state->wl_display == NULL) {
@@ -753,12 +1164,14 @@ bool daklakwl_state_init(struct daklakwl_state *state)
 			return false;
 		}
 	}
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_CONNECT);
 
 	struct daklakwl_seat *seat;
 	wl_list_for_each(seat, &state->seats, link)
 	    daklakwl_seat_init_protocols(seat);
 
 	wl_display_flush(state->wl_display);
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_SEATS);
 
 	int rc, on = 1;
 	int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -775,7 +1188,7 @@ bool daklakwl_state_init(struct daklakwl_state *state)
 	struct sockaddr_un server;
 	memset(&server, 0, sizeof(server));
 	server.sun_family = AF_UNIX;
-	strncpy(server.sun_path, "/tmp/daklak.sock",
+	strncpy(server.sun_path, DAKLAKWL_CONTROL_SOCKET,
 		sizeof(server.sun_path) - 1);
 
 	unlink(server.sun_path);
@@ -785,213 +1198,515 @@ bool daklakwl_state_init(struct daklakwl_state *state)
 	}
 	listen(sock_fd, SOMAXCONN);
 	state->sock_server = server;
-	memset(state->fds, 0, sizeof(state->fds));
-	state->fds[0].fd = wl_display_get_fd(state->wl_display);
-	state->fds[0].events = POLLIN;
 
-	state->fds[1].fd = sock_fd;
-	state->fds[1].events = POLLIN;
-	state->nfds = 2;
+	// Signals are read from a signalfd, so block them before the tray
+	// thread starts and inherits the mask.
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	// toggles the key path trace
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd == -1) {
+		perror("signalfd");
+		return false;
+	}
+
+	if (!daklakwl_loop_init(&state->loop)
+	    || !daklakwl_channel_init(&state->to_tray)
+	    || !daklakwl_channel_init(&state->from_tray)
+	    || !daklakwl_timers_init(&state->timers, &state->loop)
+	    || !daklakwl_loop_add(&state->loop, &state->display_source,
+				  wl_display_get_fd(state->wl_display),
+				  EPOLLIN, daklakwl_state_display_callback)
+	    || !daklakwl_loop_add(&state->loop, &state->listen_source, sock_fd,
+				  EPOLLIN, daklakwl_state_listen_callback)
+	    || !daklakwl_loop_add(&state->loop, &state->signal_source,
+				  signal_fd, EPOLLIN,
+				  daklakwl_state_signal_callback)
+	    || !daklakwl_loop_add(&state->loop, &state->tray_source,
+				  state->from_tray.fd, EPOLLIN,
+				  daklakwl_state_tray_callback))
+		return false;
+	if (daklakwl_reload_init(&state->reload, config_path)
+	    && (!daklakwl_loop_add(&state->loop, &state->config_source,
+				   state->reload.fd, EPOLLIN,
+				   daklakwl_state_config_callback)
+		|| !daklakwl_loop_add(&state->loop, &state->reload_source,
+				      state->reload.done.fd, EPOLLIN,
+				      daklakwl_state_reload_callback)))
+		return false;
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_LOOP);
+
+	// in case no grab ever becomes live, e.g. without a text field
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	daklakwl_timespec_add_ns(&deadline, 1000000000);
+	daklakwl_timer_arm(&state->timers, &state->startup_timer, deadline);
 	return true;
 }
 
-static bool interrupted;
-static void sigint(int signal) { interrupted = true; }
+char const *const daklakwl_startup_phase_names[_DAKLAKWL_STARTUP_LAST] = {
+    [DAKLAKWL_STARTUP_CONFIG] = "config",
+    [DAKLAKWL_STARTUP_CONNECT] = "connect",
+    [DAKLAKWL_STARTUP_SEATS] = "seats",
+    [DAKLAKWL_STARTUP_LOOP] = "loop",
+    [DAKLAKWL_STARTUP_GRAB] = "grab",
+    [DAKLAKWL_STARTUP_DATA] = "data",
+    [DAKLAKWL_STARTUP_FONT] = "font",
+    [DAKLAKWL_STARTUP_TRAY] = "tray",
+};
 
-int daklakwl_state_next_timer(struct daklakwl_state *state)
+void daklakwl_state_startup_mark(struct daklakwl_state *state,
+				 enum daklakwl_startup_phase phase)
 {
-	int timeout = INT_MAX;
-	if (wl_list_empty(&state->timers))
-		return -1;
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	struct daklakwl_timer *timer;
-	wl_list_for_each(timer, &state->timers, link)
+	if (state->startup[phase] == 0)
+		state->startup[phase]
+		    = daklakwl_metrics_now() - state->startup_start;
+}
+
+// The deferred part of startup, run from the loop right after the first
+// grab got its keymap, so none of it stands between login and typing.
+void daklakwl_state_startup_callback(struct daklakwl_timer *timer)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(timer, state, startup_timer);
+	if (state->started)
+		return;
+	state->started = true;
+	daklakwl_state_open_dict(state);
+	daklakwl_state_open_english(state);
+	daklakwl_state_open_learn(state);
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_DATA);
+	daklakwl_state_open_font(state);
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_FONT);
+	state->has_tray_thread
+	    = pthread_create(&state->tray_thread, NULL, (void *)&run_tray,
+			     state)
+	      == 0;
+	daklakwl_state_startup_mark(state, DAKLAKWL_STARTUP_TRAY);
+
+	fprintf(stderr, "startup:");
+	for (int i = 0; i < _DAKLAKWL_STARTUP_LAST; i++) {
+		if (state->startup[i] != 0)
+			fprintf(stderr, " %s %.1f ms",
+				daklakwl_startup_phase_names[i],
+				state->startup[i] / 1e6);
+	}
+	fprintf(stderr, "\n");
+}
+
+void daklakwl_state_open_font(struct daklakwl_state *state)
+{
+	if (!daklakwl_font_init(&state->font,
+				state->config.popup_font
+				    ? state->config.popup_font
+				    : "sans-serif:pixelsize=16")) {
+		fprintf(stderr, "no usable font, candidate popup disabled\n");
+		return;
+	}
+	// Output scales are not known yet; 1 and 2 cover nearly every setup
+	// and anything else is rasterized on first use.
+	static int const scales[] = {1, 2};
+	daklakwl_atlas_warm(&state->atlas, &state->font, scales, 2);
+	// seats set up before the font was there have no popup yet
+	struct daklakwl_seat *seat;
+	wl_list_for_each(seat, &state->seats, link)
 	{
-		int time = (timer->time.tv_sec - now.tv_sec) * 1000
-			   + (timer->time.tv_nsec - now.tv_nsec) / 1000000;
-		if (time < timeout)
-			timeout = time;
+		if (seat->are_protocols_initted && seat->popup.wl_surface == NULL)
+			daklakwl_popup_init(&seat->popup, seat);
 	}
-	return timeout;
 }
 
-void daklakwl_state_run_timers(struct daklakwl_state *state)
+void daklakwl_state_open_dict(struct daklakwl_state *state)
 {
-	if (wl_list_empty(&state->timers))
+	if (state->config.dictionary_path) {
+		if (!daklakwl_dict_open(&state->dict,
+					state->config.dictionary_path))
+			fprintf(stderr, "failed to open dictionary %s\n",
+				state->config.dictionary_path);
 		return;
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	struct daklakwl_timer *timer, *tmp;
-	wl_list_for_each_safe(timer, tmp, &state->timers, link)
+	}
+
+	char path[PATH_MAX];
+	char const *prefix;
+	if ((prefix = getenv("XDG_DATA_HOME")))
+		snprintf(path, sizeof path, "%s/daklak/vi.dict", prefix);
+	else if ((prefix = getenv("HOME")))
+		snprintf(path, sizeof path, "%s/.local/share/daklak/vi.dict",
+			 prefix);
+	else
+		path[0] = '\0';
+	if (path[0] && daklakwl_dict_open(&state->dict, path))
+		return;
+	if (!daklakwl_dict_open(&state->dict, DAKLAKWL_DATADIR "/vi.dict"))
+		fprintf(stderr, "no dictionary found, word completion "
+				"disabled\n");
+}
+
+void daklakwl_state_open_english(struct daklakwl_state *state)
+{
+	if (state->config.english_words_path) {
+		if (!daklakwl_bloom_open(&state->english,
+					 state->config.english_words_path))
+			fprintf(stderr, "failed to open English words %s\n",
+				state->config.english_words_path);
+		return;
+	}
+
+	char path[PATH_MAX];
+	char const *prefix;
+	if ((prefix = getenv("XDG_DATA_HOME")))
+		snprintf(path, sizeof path, "%s/daklak/en.bloom", prefix);
+	else if ((prefix = getenv("HOME")))
+		snprintf(path, sizeof path, "%s/.local/share/daklak/en.bloom",
+			 prefix);
+	else
+		path[0] = '\0';
+	if (path[0] && daklakwl_bloom_open(&state->english, path))
+		return;
+	if (!daklakwl_bloom_open(&state->english,
+				 DAKLAKWL_DATADIR "/en.bloom"))
+		fprintf(stderr, "no English word list found, auto-restore "
+				"disabled\n");
+}
+
+void daklakwl_state_open_learn(struct daklakwl_state *state)
+{
+	char path[PATH_MAX];
+	char const *prefix;
+	if ((prefix = getenv("XDG_DATA_HOME")))
+		snprintf(path, sizeof path, "%s/daklak", prefix);
+	else if ((prefix = getenv("HOME")))
+		snprintf(path, sizeof path, "%s/.local/share/daklak", prefix);
+	else {
+		fprintf(stderr, "cannot find data directory, learning "
+				"disabled\n");
+		return;
+	}
+	for (char *p = path + 1; *p; p++) {
+		if (*p == '/') {
+			*p = '\0';
+			mkdir(path, 0700);
+			*p = '/';
+		}
+	}
+	if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+		perror("learning directory");
+		return;
+	}
+	// counts from words finished before the log was loaded are dropped
+	daklakwl_learn_finish(&state->learn);
+	daklakwl_learn_init(&state->learn, path);
+}
+
+// Turning composition on or off applies to every seat, so all of them
+// and every socket client agree on what the tray shows.
+bool daklakwl_state_handle_action(struct daklakwl_state *state,
+				  struct daklakwl_seat *seat,
+				  enum daklakwl_action action)
+{
+	if (action != DAKLAKWL_ACTION_ENABLE
+	    && action != DAKLAKWL_ACTION_DISABLE
+	    && action != DAKLAKWL_ACTION_TOGGLE)
+		return seat != NULL && daklakwl_seat_handle_action(seat, action);
+
+	bool composing = action == DAKLAKWL_ACTION_ENABLE;
+	if (action == DAKLAKWL_ACTION_TOGGLE) {
+		struct daklakwl_seat *any;
+		wl_list_for_each(any, &state->seats, link)
+		{
+			composing |= any->is_composing;
+		}
+		composing = !composing;
+	}
+	struct daklakwl_seat *each;
+	wl_list_for_each(each, &state->seats, link)
 	{
-		bool expired = timer->time.tv_sec < now.tv_sec
-			       || (timer->time.tv_sec == now.tv_sec
-				   && timer->time.tv_nsec < now.tv_nsec);
-		if (expired)
-			timer->callback(timer);
+		if (!composing && each->is_composing)
+			daklakwl_seat_composing_commit(each);
+		each->is_composing = composing;
+		daklakwl_seat_grab_update(each);
 	}
+	daklakwl_control_broadcast_state(state);
+	daklakwl_channel_send(&state->to_tray, composing ? DAKLAKWL_TRAY_ON
+							 : DAKLAKWL_TRAY_OFF);
+	return true;
 }
 
-void daklakwl_state_run(struct daklakwl_state *state)
+void daklakwl_state_set_engine(struct daklakwl_state *state,
+			       struct daklakwl_engine const *engine)
 {
-	state->running = true;
-	signal(SIGINT, sigint);
-	int current_size, on = 1;
-	bool error = false, compressed_fds = false;
-	char buffer[1024];
-	while (state->running && !interrupted) {
-		if (poll(state->fds, state->nfds,
-			 daklakwl_state_next_timer(state))
-		    == -1) {
-			if (errno == EINTR)
-				continue;
-			perror("poll");
-			break;
+	if (engine == state->engine)
+		return;
+	state->engine = engine;
+	struct daklakwl_seat *seat;
+	wl_list_for_each(seat, &state->seats, link)
+	{
+		// a word is finished by the method it was started in
+		if (seat->buffer.len != 0)
+			daklakwl_seat_composing_commit(seat);
+		seat->engine = engine;
+	}
+	daklakwl_control_broadcast_state(state);
+}
+
+void daklakwl_state_display_callback(struct daklakwl_event_source *source,
+				     uint32_t events)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(source, state, display_source);
+	while (wl_display_prepare_read(state->wl_display) != 0)
+		wl_display_dispatch_pending(state->wl_display);
+	if (events & EPOLLIN)
+		wl_display_read_events(state->wl_display);
+	else
+		wl_display_cancel_read(state->wl_display);
+	if ((events & (EPOLLERR | EPOLLHUP))
+	    || wl_display_dispatch_pending(state->wl_display) == -1) {
+		perror("wl_display_dispatch");
+		state->running = false;
+		return;
+	}
+	daklakwl_state_dispatch_seats(state);
+}
+
+// Seats take turns going first and handle at most DAKLAKWL_SEAT_KEY_BUDGET
+// keys a turn, and whatever a seat has to send goes out as soon as its
+// turn is over. This is fairness rather than isolation: everything runs
+// on this thread, so a seat that is slow on one event, say compiling a
+// new keymap, still delays the others by that much, but a seat with a
+// flood of keys cannot hold them up for longer than its budget.
+void daklakwl_state_dispatch_seats(struct daklakwl_state *state)
+{
+	state->backlogged = false;
+	struct daklakwl_seat *seat, *tmp_seat;
+	wl_list_for_each_safe(seat, tmp_seat, &state->seats, link)
+	{
+		if (seat->queue == NULL)
+			continue;
+		seat->key_budget = DAKLAKWL_SEAT_KEY_BUDGET;
+		bool had_backlog = seat->backlog.size != 0;
+		if (!daklakwl_seat_backlog_drain(seat, &seat->key_budget))
+			state->backlogged = true;
+		int dispatched = wl_display_dispatch_queue_pending(
+		    state->wl_display, seat->queue);
+		if (dispatched == -1) {
+			perror("wl_display_dispatch_queue");
+			state->running = false;
+			return;
 		}
-		current_size = state->nfds;
-		for (int i = 0; i < current_size; i++) {
-			if (state->fds[i].revents == 0) {
-				continue;
-			}
-			else if (state->fds[i].revents != POLLIN) {
-				close(state->fds[i].fd);
-				state->fds[i].fd = -1;
-				compressed_fds = true;
-				perror("revents");
+		if (seat->unavailable) {
+			daklakwl_seat_destroy(seat);
+			continue;
+		}
+		if (dispatched > 0 || had_backlog) {
+			daklakwl_seat_flush(seat);
+			wl_display_flush(state->wl_display);
+		}
+	}
+	if (!wl_list_empty(&state->seats)) {
+		struct wl_list *first = state->seats.next;
+		wl_list_remove(first);
+		wl_list_insert(state->seats.prev, first);
+	}
+}
+
+void daklakwl_state_signal_callback(struct daklakwl_event_source *source,
+				    uint32_t events)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(source, state, signal_source);
+	struct signalfd_siginfo info;
+	while (read(source->fd, &info, sizeof info) == sizeof info) {
+		if (info.ssi_signo != SIGUSR1)
+			state->running = false;
+		else if (!daklakwl_trace_enabled)
+			daklakwl_trace_start();
+		else {
+			daklakwl_trace_stop();
+			char const *dir = getenv("XDG_RUNTIME_DIR");
+			char path[PATH_MAX];
+			if (dir == NULL) {
+				fprintf(stderr, "XDG_RUNTIME_DIR not set, "
+						"trace not written\n");
 				continue;
 			}
-			if (i == 0) {
-				while (
-				    wl_display_prepare_read(state->wl_display)
-				    != 0)
-					wl_display_dispatch_pending(
-					    state->wl_display);
-				if (state->fds[i].events & POLLIN)
-					wl_display_read_events(
-					    state->wl_display);
-				else
-					wl_display_cancel_read(
-					    state->wl_display);
-
-				if (wl_display_dispatch_pending(
-					state->wl_display)
-				    == -1) {
-					perror("wl_display_dispatch");
-					error = true;
-					break;
-				}
-			}
-			else if (i == 1) {
-				int new_fd
-				    = accept(state->fds[1].fd, NULL, NULL);
-				if (new_fd == -1) {
-					perror("connect");
-					continue;
-				}
-
-				printf("New incomming connection: %d\n",
-				       new_fd);
-				ioctl(new_fd, FIONBIO, (char *)&on);
-				state->fds[state->nfds].fd = new_fd;
-				state->fds[state->nfds].events = POLLIN;
-				state->nfds++;
-			}
-			else {
-				memset(buffer, 0, sizeof(buffer));
-				int rc = recv(state->fds[i].fd, buffer,
-					      sizeof(buffer), 0);
-				if (rc == -1) {
-					perror("recv");
-					continue;
-				}
-				else if (rc == 0) {
-					close(state->fds[i].fd);
-					state->fds[i].fd = -1;
-					compressed_fds = true;
-				}
-				printf("recveiced: %s\n", buffer);
-				if (strcmp(buffer, "daklak_toggle\n") == 0) {
-					struct daklakwl_seat *seat, *tmp_seat;
-					wl_list_for_each_safe(
-					    seat, tmp_seat, &state->seats, link)
-					{
-						seat->is_composing
-						    = !seat->is_composing;
-						if (seat->is_composing) {
-							daklakwl_send_message_to_socket_clients(
-							    state,
-							    "daklak_on\n", -1);
-						}
-						else {
-							daklakwl_seat_composing_commit(seat);
-							daklakwl_send_message_to_socket_clients(
-							    state,
-							    "daklak_off\n", -1);
-						}
-					}
-				}
-				else if (strcmp(buffer, "daklak_on\n") == 0) {
-					struct daklakwl_seat *seat, *tmp_seat;
-					wl_list_for_each_safe(
-					    seat, tmp_seat, &state->seats, link)
-					{
-						seat->is_composing = true;
-						daklakwl_send_message_to_socket_clients(
-						    state, "daklak_on\n", -1);
-					}
-				}
-				else if (strcmp(buffer, "daklak_off\n") == 0) {
-					struct daklakwl_seat *seat, *tmp_seat;
-					wl_list_for_each_safe(
-					    seat, tmp_seat, &state->seats, link)
-					{
-						daklakwl_seat_composing_commit(seat);
-						seat->is_composing = false;
-						daklakwl_send_message_to_socket_clients(
-						    state, "daklak_off\n", -1);
-					}
-				}
-			}
+			snprintf(path, sizeof path, "%s/%s", dir,
+				 DAKLAKWL_TRACE_FILE);
+			if (daklakwl_trace_dump(path))
+				fprintf(stderr, "trace written to %s\n", path);
 		}
+	}
+}
 
-		if (error) {
-			break;
+void daklakwl_state_config_callback(struct daklakwl_event_source *source,
+				    uint32_t events)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(source, state, config_source);
+	if (daklakwl_reload_changed(&state->reload))
+		daklakwl_reload_start(&state->reload, &state->keymaps);
+}
+
+void daklakwl_state_reload_callback(struct daklakwl_event_source *source,
+				    uint32_t events)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(source, state, reload_source);
+	struct daklakwl_reload_job *job = daklakwl_reload_take(&state->reload);
+	if (job == NULL)
+		return;
+	if (job->ok)
+		daklakwl_state_reload_apply(state, job);
+	else
+		fprintf(stderr, "config not reloaded, keeping the old one\n");
+	daklakwl_reload_job_free(job, &state->keymaps);
+	if (state->reload.again)
+		daklakwl_reload_start(&state->reload, &state->keymaps);
+}
+
+// Runs from the loop between two events, so every key is handled wholly
+// with the old tables or wholly with the new ones. What gets replaced is
+// left in the job and freed with it.
+void daklakwl_state_reload_apply(struct daklakwl_state *state,
+				 struct daklakwl_reload_job *job)
+{
+	uint64_t swap_start = daklakwl_metrics_now();
+	struct daklakwl_keymap *keymap;
+	wl_list_for_each(keymap, &state->keymaps.keymaps, link)
+	{
+		struct daklakwl_reload_keymap *entry = NULL;
+		for (size_t i = 0; i < job->keymaps_len; i++) {
+			if (job->keymaps[i].keymap == keymap)
+				entry = &job->keymaps[i];
 		}
-		if (compressed_fds) {
-			compressed_fds = false;
-			for (int i = 0; i < state->nfds; i++) {
-				if (state->fds[i].fd == -1) {
-					for (int j = i; j < state->nfds; j++) {
-						state->fds[j].fd
-						    = state->fds[j + 1].fd;
-					}
-					i--;
-					state->nfds--;
-				}
-			}
+		if (entry == NULL) {
+			// compiled against the old config while the job ran
+			daklakwl_keymap_rebind(keymap, &job->config);
+			continue;
 		}
+		struct daklakwl_binding_table old = keymap->composing_bindings;
+		keymap->composing_bindings = entry->composing_bindings;
+		entry->composing_bindings = old;
+		old = keymap->global_bindings;
+		keymap->global_bindings = entry->global_bindings;
+		entry->global_bindings = old;
+	}
+	struct daklakwl_config config = state->config;
+	state->config = job->config;
+	job->config = config;
+	struct daklakwl_shortcuts shortcuts = state->shortcuts;
+	state->shortcuts = job->shortcuts;
+	job->shortcuts = shortcuts;
 
-		daklakwl_state_run_timers(state);
+	struct daklakwl_seat *seat;
+	wl_list_for_each(seat, &state->seats, link)
+	{
+		seat->shortcut_state = daklakwl_word_shortcut_walk(
+		    &state->shortcuts, &seat->buffer);
+		daklakwl_seat_policy_update(seat);
+		// a binding to turn composition on may have come or gone
+		daklakwl_seat_grab_update(seat);
+	}
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_CONFIG_RELOADS, 1);
+	uint64_t end = daklakwl_metrics_now();
+	fprintf(stderr,
+		"config reloaded in %.1f ms, compiling %.1f ms, swapping "
+		"%.3f ms\n",
+		(end - job->start) / 1e6, (job->compiled - job->start) / 1e6,
+		(end - swap_start) / 1e6);
+}
 
-		wl_display_flush(state->wl_display);
+void daklakwl_state_tray_callback(struct daklakwl_event_source *source,
+				  uint32_t events)
+{
+	struct daklakwl_state *state
+	    = wl_container_of(source, state, tray_source);
+	uint64_t message;
+	daklakwl_channel_ack(&state->from_tray);
+	while (daklakwl_channel_receive(&state->from_tray, &message)) {
+		if (message == DAKLAKWL_TRAY_QUIT)
+			state->running = false;
+	}
+}
+
+void daklakwl_state_flush(struct daklakwl_state *state)
+{
+	struct daklakwl_seat *seat;
+	wl_list_for_each(seat, &state->seats, link)
+	    daklakwl_seat_flush(seat);
+	wl_display_flush(state->wl_display);
+	daklakwl_control_flush(state);
+	// a crash should not take the end of the session with it
+	if (state->recorder.file != NULL)
+		fflush(state->recorder.file);
+}
+
+void daklakwl_state_run(struct daklakwl_state *state)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	state->running = true;
+	while (state->running) {
+		wl_display_dispatch_pending(state->wl_display);
+		daklakwl_state_dispatch_seats(state);
+		daklakwl_state_flush(state);
+		// seats with keys left over get their turn without waiting
+		if (daklakwl_loop_dispatch(&state->loop,
+					   state->backlogged ? 0 : -1)
+		    == -1)
+			break;
+
+		daklakwl_state_flush(state);
 
 		if (wl_list_empty(&state->seats)) {
 			fprintf(stderr, "No seats with input-method "
 					"available.\n");
-			error = true;
 			break;
 		}
 	}
-	signal(SIGINT, SIG_DFL);
 	state->running = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec)
+			 + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (seconds > 0)
+		fprintf(stderr,
+			"%llu wakeups (%llu for timers) in %.0f s, %.2f/s\n",
+			(unsigned long long)state->loop.wakeups,
+			(unsigned long long)state->timers.wakeups, seconds,
+			state->loop.wakeups / seconds);
 }
 
 void daklakwl_state_finish(struct daklakwl_state *state)
 {
+	struct daklakwl_client *client, *tmp_client;
+	wl_list_for_each_safe(client, tmp_client, &state->clients, link)
+	    daklakwl_client_destroy(client);
+	if (state->listen_source.fd != -1)
+		close(state->listen_source.fd);
+	if (state->signal_source.fd != -1)
+		close(state->signal_source.fd);
+	daklakwl_timers_finish(&state->timers);
+	daklakwl_loop_finish(&state->loop);
+	daklakwl_channel_finish(&state->to_tray);
+	daklakwl_channel_finish(&state->from_tray);
+	daklakwl_reload_finish(&state->reload, &state->keymaps);
 	struct daklakwl_seat *seat, *tmp_seat;
 	wl_list_for_each_safe(seat, tmp_seat, &state->seats, link)
 	    daklakwl_seat_destroy(seat);
+	struct daklakwl_output *output, *tmp_output;
+	wl_list_for_each_safe(output, tmp_output, &state->outputs, link)
+	{
+		wl_output_destroy(output->wl_output);
+		wl_list_remove(&output->link);
+		free(output);
+	}
+	if (state->wl_shm != NULL)
+		wl_shm_destroy(state->wl_shm);
 	if (state->zwp_virtual_keyboard_manager_v1 != NULL) {
 		zwp_virtual_keyboard_manager_v1_destroy(
 		    state->zwp_virtual_keyboard_manager_v1);
@@ -1005,17 +1720,32 @@ void daklakwl_state_finish(struct daklakwl_state *state)
 		wl_registry_destroy(state->wl_registry);
 	if (state->wl_display != NULL)
 		wl_display_disconnect(state->wl_display);
+	daklakwl_keymap_cache_finish(&state->keymaps);
+	daklakwl_recorder_close(&state->recorder);
 	daklakwl_config_finish(&state->config);
+	daklakwl_dict_close(&state->dict);
+	daklakwl_bloom_close(&state->english);
+	daklakwl_learn_finish(&state->learn);
+	daklakwl_atlas_finish(&state->atlas);
+	daklakwl_shortcuts_finish(&state->shortcuts);
+	daklakwl_font_finish(&state->font);
 }
 
 int main(void)
 {
 	setlocale(LC_CTYPE, "en_US.utf8");
-	pthread_t indicator_thread;
 	struct daklakwl_state state = {0};
 	if (!daklakwl_state_init(&state))
 		return 1;
-	pthread_create(&indicator_thread, NULL, (void *)&run_tray, &state);
 	daklakwl_state_run(&state);
+	if (state.has_tray_thread) {
+		// the tray keeps draining the ring, so a full one only
+		// means waiting a little
+		while (!daklakwl_channel_send(&state.to_tray,
+					      DAKLAKWL_TRAY_QUIT))
+			nanosleep(&(struct timespec){.tv_nsec = 1000000},
+				  NULL);
+		pthread_join(state.tray_thread, NULL);
+	}
 	daklakwl_state_finish(&state);
 }
@@ -1,8 +1,8 @@
 #pragma once
 
+#include <pthread.h>
 #include <stdbool.h>
 
-#include <sys/poll.h>
 #include <sys/un.h>
 #include <wayland-client.h>
 #include <xkbcommon/xkbcommon.h>
@@ -12,36 +12,75 @@
 #include "virtual-keyboard-unstable-v1-client-protocol.h"
 
 #include "actions.h"
+#include "atlas.h"
+#include "bloom.h"
 #include "buffer.h"
+#include "channel.h"
 #include "config.h"
+#include "dict.h"
+#include "engine.h"
+#include "font.h"
+#include "keymap.h"
+#include "learn.h"
+#include "loop.h"
+#include "popup.h"
+#include "record.h"
+#include "reload.h"
+#include "shortcut.h"
+#include "timer.h"
+#include "word.h"
 
-enum daklak_modifier_index {
-	DAKLAKWL_SHIFT_INDEX,
-	DAKLAKWL_CAPS_INDEX,
-	DAKLAKWL_CTRL_INDEX,
-	DAKLAKWL_ALT_INDEX,
-	DAKLAKWL_NUM_INDEX,
-	DAKLAKWL_MOD3_INDEX,
-	DAKLAKWL_LOGO_INDEX,
-	DAKLAKWL_MOD5_INDEX,
-	_DAKLAKWL_MOD_LAST,
+#define min(a, b)                                                              \
+	({                                                                     \
+		__typeof__(a) _a = (a);                                        \
+		__typeof__(b) _b = (b);                                        \
+		_a < _b ? _a : _b;                                             \
+	})
+
+#define max(a, b)                                                              \
+	({                                                                     \
+		__typeof__(a) _a = (a);                                        \
+		__typeof__(b) _b = (b);                                        \
+		_a > _b ? _a : _b;                                             \
+	})
+
+// Messages between the main thread and the tray thread.
+enum daklakwl_tray_message {
+	DAKLAKWL_TRAY_ON,
+	DAKLAKWL_TRAY_OFF,
+	DAKLAKWL_TRAY_QUIT,
 };
 
-enum daklakwl_modifier {
-	DAKLAKWL_SHIFT = 1 << DAKLAKWL_SHIFT_INDEX,
-	DAKLAKWL_CAPS = 1 << DAKLAKWL_CAPS_INDEX,
-	DAKLAKWL_CTRL = 1 << DAKLAKWL_CTRL_INDEX,
-	DAKLAKWL_ALT = 1 << DAKLAKWL_ALT_INDEX,
-	DAKLAKWL_NUM = 1 << DAKLAKWL_NUM_INDEX,
-	DAKLAKWL_MOD3 = 1 << DAKLAKWL_MOD3_INDEX,
-	DAKLAKWL_LOGO = 1 << DAKLAKWL_LOGO_INDEX,
-	DAKLAKWL_MOD5 = 1 << DAKLAKWL_MOD5_INDEX,
+// Startup milestones, in order. Everything after GRAB is deferred until
+// keys already work.
+enum daklakwl_startup_phase {
+	// config read, keymap cache ready
+	DAKLAKWL_STARTUP_CONFIG,
+	// connected and every global bound
+	DAKLAKWL_STARTUP_CONNECT,
+	// input methods and keyboard grabs requested
+	DAKLAKWL_STARTUP_SEATS,
+	// control socket, signals and loop set up
+	DAKLAKWL_STARTUP_LOOP,
+	// first keymap on a grab, keys are handled from here on
+	DAKLAKWL_STARTUP_GRAB,
+	// dictionary, English words and learned counts loaded
+	DAKLAKWL_STARTUP_DATA,
+	// popup font loaded, glyphs warming up in the background
+	DAKLAKWL_STARTUP_FONT,
+	// tray thread started
+	DAKLAKWL_STARTUP_TRAY,
+	_DAKLAKWL_STARTUP_LAST,
 };
 
-struct daklakwl_timer {
+extern char const *const
+    daklakwl_startup_phase_names[_DAKLAKWL_STARTUP_LAST];
+
+struct daklakwl_output {
 	struct wl_list link;
-	struct timespec time;
-	void (*callback)(struct daklakwl_timer *timer);
+	struct daklakwl_state *state;
+	struct wl_output *wl_output;
+	int32_t scale;
 };
 
 struct daklakwl_state {
@@ -53,11 +92,72 @@ struct daklakwl_state {
 	struct zwp_input_method_manager_v2 *zwp_input_method_manager_v2;
 	struct zwp_virtual_keyboard_manager_v1 *zwp_virtual_keyboard_manager_v1;
 	struct wl_list seats;
-	struct wl_list timers;
+	struct wl_list outputs;
+	struct daklakwl_timers timers;
 	struct daklakwl_config config;
-	struct pollfd fds[10];
+	struct daklakwl_keymap_cache keymaps;
+	struct daklakwl_dict dict;
+	struct daklakwl_bloom english;
+	struct daklakwl_learn learn;
+	struct daklakwl_font font;
+	struct daklakwl_atlas atlas;
+	struct daklakwl_shortcuts shortcuts;
+	// typing method new seats start with, and the last one switched to
+	struct daklakwl_engine const *engine;
+	struct daklakwl_loop loop;
+	struct daklakwl_event_source display_source;
+	struct daklakwl_event_source signal_source;
+	struct daklakwl_event_source listen_source;
 	struct sockaddr_un sock_server;
-	int nfds;
+	struct wl_list clients;
+	// the tray runs GTK on its own thread
+	struct daklakwl_channel to_tray, from_tray;
+	struct daklakwl_event_source tray_source;
+	struct daklakwl_recorder recorder;
+	struct daklakwl_reload reload;
+	// config file changes, and compiled configs coming back
+	struct daklakwl_event_source config_source, reload_source;
+	// when each startup phase ended, in nanoseconds since
+	// daklakwl_state_init began
+	uint64_t startup_start;
+	uint64_t startup[_DAKLAKWL_STARTUP_LAST];
+	// runs the deferred part of startup once the first grab is live
+	struct daklakwl_timer startup_timer;
+	bool started;
+	// a seat has grab events left for its next turn
+	bool backlogged;
+	pthread_t tray_thread;
+	bool has_tray_thread;
+};
+
+// A connection to the control socket, e.g. daklakctl or a status bar.
+struct daklakwl_client {
+	struct wl_list link;
+	struct daklakwl_state *state;
+	struct daklakwl_event_source source;
+	// bytes of a message not yet complete, replies not yet sent
+	struct wl_array in, out;
+	bool subscribed;
+	// a state event is owed, sent once the socket takes more
+	bool state_pending;
+	// waiting for EPOLLOUT
+	bool blocked;
+	// more was queued than allowed or there was no memory for it, the
+	// client is dropped
+	bool overflowed;
+};
+
+// Keys a seat handles per turn of daklakwl_state_dispatch_seats, the rest
+// wait for its next turn.
+#define DAKLAKWL_SEAT_KEY_BUDGET 16
+
+// A grab event held back until the seat's next turn.
+struct daklakwl_grab_event {
+	bool is_key;
+	// key
+	uint32_t time, key, state;
+	// modifiers
+	uint32_t depressed, latched, locked, group;
 };
 
 struct daklakwl_seat {
@@ -66,18 +166,30 @@ struct daklakwl_seat {
 	struct wl_seat *wl_seat;
 
 	bool are_protocols_initted;
+	// events of every object below, dispatched on their own so one busy
+	// seat does not hold up the rest
+	struct wl_event_queue *queue;
+	// the input method went away, destroyed once its queue is dispatched
+	bool unavailable;
 	struct zwp_text_input_v3 *zwp_text_input_v3;
 	struct zwp_input_method_v2 *zwp_input_method_v2;
+	// NULL while keys go straight to the client, see
+	// daklakwl_seat_grab_update
 	struct zwp_input_method_keyboard_grab_v2
 	    *zwp_input_method_keyboard_grab_v2;
 	struct zwp_virtual_keyboard_v1 *zwp_virtual_keyboard_v1;
 
-	char *xkb_keymap_string;
-	struct xkb_context *xkb_context;
-	struct xkb_keymap *xkb_keymap;
+	struct daklakwl_keymap *keymap;
 	struct xkb_state *xkb_state;
-	xkb_mod_index_t mod_indices[_DAKLAKWL_MOD_LAST];
-	struct wl_array composing_bindings;
+	// what each keycode produces under the current modifiers, filled on
+	// first press and dropped whenever the modifiers or keymap change
+	struct daklakwl_key *keys;
+	xkb_keycode_t keys_len;
+	uint32_t keys_generation;
+	struct daklakwl_key key_scratch;
+	// effective modifiers without Caps Lock and Num Lock
+	xkb_mod_mask_t mod_mask;
+	uint8_t mod_class;
 
 	// wl_seat
 	char *name;
@@ -93,6 +205,17 @@ struct daklakwl_seat {
 	uint32_t done_events_received;
 
 	// zwp_input_method_keyboard_grab_v2
+	// keys held on the grab, which is only let go once there are none
+	uint32_t keys_down;
+	bool ungrab_pending;
+	// keys left to handle this turn
+	uint32_t key_budget;
+	// struct daklakwl_grab_event past the budget, handled from
+	// backlog_pos on in later turns
+	struct wl_array backlog;
+	size_t backlog_pos;
+	// when the grab was asked for, until its keymap arrives
+	uint64_t grab_requested;
 	uint32_t repeat_rate;
 	uint32_t repeat_delay;
 	xkb_keycode_t pressed[64];
@@ -100,7 +223,22 @@ struct daklakwl_seat {
 	uint32_t repeating_timestamp;
 	struct daklakwl_timer repeat_timer;
 
+	enum daklakwl_input_policy policy;
+
+	// input method requests held back until the end of the dispatch
+	bool needs_flush;
+	struct wl_array pending_commit;
+	// bytes before the cursor to delete ahead of pending_commit
+	uint32_t pending_delete;
+
+	// the typing method that edits buffer
+	struct daklakwl_engine const *engine;
 	struct daklakwl_buffer buffer;
+	// shortcut automaton state after the raw keys of the buffer
+	uint32_t shortcut_state;
+	struct daklakwl_dict_candidate candidates[DAKLAKWL_DICT_TOPK];
+	size_t candidates_len;
+	struct daklakwl_popup popup;
 
 	// composing
 	bool is_composing;
@@ -112,12 +250,6 @@ struct daklakwl_binding {
 	enum daklakwl_action action;
 };
 
-struct daklakwl_seat_binding {
-	xkb_keycode_t keycode;
-	xkb_mod_mask_t mod_mask;
-	enum daklakwl_action action;
-};
-
 void zwp_input_popup_surface_v2_text_input_rectangle(
     void *data, struct zwp_input_popup_surface_v2 *zwp_input_popup_surface_v2,
     int32_t x, int32_t y, int32_t width, int32_t height);
@@ -207,29 +339,63 @@ void daklakwl_seat_init_protocols(struct daklakwl_seat *seat);
 void daklakwl_seat_init(struct daklakwl_seat *seat,
 			struct daklakwl_state *state, struct wl_seat *wl_seat);
 void daklakwl_seat_destroy(struct daklakwl_seat *seat);
+void daklakwl_seat_grab_update(struct daklakwl_seat *seat);
 void daklakwl_seat_composing_update(struct daklakwl_seat *seat);
+void daklakwl_seat_flush(struct daklakwl_seat *seat);
+void daklakwl_seat_forward_key(struct daklakwl_seat *seat, uint32_t time,
+			       uint32_t key, uint32_t state);
+void daklakwl_seat_policy_update(struct daklakwl_seat *seat);
+bool daklakwl_seat_should_restore(struct daklakwl_seat *seat);
+void daklakwl_seat_candidates_update(struct daklakwl_seat *seat);
+void daklakwl_seat_candidates_rank(struct daklakwl_seat *seat);
+bool daklakwl_seat_previous_word(struct daklakwl_seat *seat,
+				 char word[DAKLAKWL_WORD_MAX]);
 void daklakwl_seat_composing_commit(struct daklakwl_seat *seat);
 void daklakwl_seat_selecting_update(struct daklakwl_seat *seat);
 void daklakwl_seat_selecting_commit(struct daklakwl_seat *seat);
-int daklakwl_binding_compare(void const *_a, void const *_b);
-int daklakwl_seat_binding_compare(void const *_a, void const *_b);
-int daklakwl_seat_binding_compare_without_action(void const *_a,
-						 void const *_b);
-bool daklakwl_seat_handle_key_bindings(struct daklakwl_seat *seat,
-				       struct wl_array *bindings,
-				       struct daklakwl_seat_binding *press);
 bool daklakwl_seat_handle_key(struct daklakwl_seat *seat,
 			      xkb_keycode_t keycode);
+void daklakwl_seat_repeat_start(struct daklakwl_seat *seat);
+// Handles held back grab events in order, each key taking one from budget
+// unless it is NULL. True once none are left.
+bool daklakwl_seat_backlog_drain(struct daklakwl_seat *seat, uint32_t *budget);
 void daklakwl_seat_repeat_timer_callback(struct daklakwl_timer *timer);
-void daklakwl_seat_set_up_bindings(struct daklakwl_seat *seat,
-				   struct wl_array *state_bindings,
-				   struct wl_array *seat_bindings);
 void daklakwl_seat_cursor_update(struct daklakwl_seat *seat);
 void daklakwl_seat_cursor_timer_callback(struct daklakwl_timer *timer);
 
 bool daklakwl_state_init(struct daklakwl_state *state);
-int daklakwl_state_next_timer(struct daklakwl_state *state);
-void daklakwl_state_run_timers(struct daklakwl_state *state);
+bool daklakwl_state_handle_action(struct daklakwl_state *state,
+				  struct daklakwl_seat *seat,
+				  enum daklakwl_action action);
+// Commits every word in progress and switches all seats to engine.
+void daklakwl_state_set_engine(struct daklakwl_state *state,
+			       struct daklakwl_engine const *engine);
+void daklakwl_state_open_dict(struct daklakwl_state *state);
+void daklakwl_state_open_english(struct daklakwl_state *state);
+void daklakwl_state_open_learn(struct daklakwl_state *state);
+void daklakwl_state_open_font(struct daklakwl_state *state);
+void daklakwl_state_startup_mark(struct daklakwl_state *state,
+				 enum daklakwl_startup_phase phase);
+void daklakwl_state_startup_callback(struct daklakwl_timer *timer);
+void daklakwl_state_display_callback(struct daklakwl_event_source *source,
+				     uint32_t events);
+void daklakwl_state_listen_callback(struct daklakwl_event_source *source,
+				    uint32_t events);
+void daklakwl_state_dispatch_seats(struct daklakwl_state *state);
+void daklakwl_client_destroy(struct daklakwl_client *client);
+void daklakwl_control_broadcast_state(struct daklakwl_state *state);
+void daklakwl_control_flush(struct daklakwl_state *state);
+void daklakwl_state_tray_callback(struct daklakwl_event_source *source,
+				  uint32_t events);
+void daklakwl_state_config_callback(struct daklakwl_event_source *source,
+				    uint32_t events);
+void daklakwl_state_reload_callback(struct daklakwl_event_source *source,
+				    uint32_t events);
+void daklakwl_state_reload_apply(struct daklakwl_state *state,
+				 struct daklakwl_reload_job *job);
+void daklakwl_state_signal_callback(struct daklakwl_event_source *source,
+				    uint32_t events);
+void daklakwl_state_flush(struct daklakwl_state *state);
 void daklakwl_state_run(struct daklakwl_state *state);
 void daklakwl_state_finish(struct daklakwl_state *state);
 
@@ -0,0 +1,189 @@
+#include "dict.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DAKLAKWL_DICT_MAGIC "DKDA"
+#define DAKLAKWL_DICT_VERSION 1
+#define DAKLAKWL_DICT_NONE UINT32_MAX
+
+struct daklakwl_dict_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t units_len;
+	uint32_t entries_len;
+	uint32_t top_len;
+	uint32_t strings_len;
+	uint32_t topk;
+	uint32_t reserved;
+};
+
+bool daklakwl_dict_open(struct daklakwl_dict *dict, char const *path)
+{
+	memset(dict, 0, sizeof *dict);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+	if ((size_t)st.st_size < sizeof(struct daklakwl_dict_header)) {
+		fprintf(stderr, "%s: dictionary too short\n", path);
+		close(fd);
+		return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap dictionary");
+		return false;
+	}
+
+	struct daklakwl_dict_header const *header = map;
+	size_t units_size
+	    = (size_t)header->units_len * sizeof(struct daklakwl_dict_unit);
+	size_t entries_size
+	    = (size_t)header->entries_len * sizeof(struct daklakwl_dict_entry);
+	size_t top_size = (size_t)header->top_len * sizeof(uint32_t);
+	size_t expected = sizeof *header + units_size + entries_size + top_size
+			  + header->strings_len;
+	if (memcmp(header->magic, DAKLAKWL_DICT_MAGIC, 4) != 0
+	    || header->version != DAKLAKWL_DICT_VERSION
+	    || header->topk != DAKLAKWL_DICT_TOPK || header->units_len == 0
+	    || expected != (size_t)st.st_size) {
+		fprintf(stderr, "%s: invalid dictionary\n", path);
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	char const *p = (char const *)map + sizeof *header;
+	dict->map = map;
+	dict->size = st.st_size;
+	dict->units = (struct daklakwl_dict_unit const *)p;
+	dict->units_len = header->units_len;
+	p += units_size;
+	dict->entries = (struct daklakwl_dict_entry const *)p;
+	dict->entries_len = header->entries_len;
+	p += entries_size;
+	dict->top = (uint32_t const *)p;
+	dict->top_len = header->top_len;
+	p += top_size;
+	dict->strings = p;
+	dict->strings_len = header->strings_len;
+
+	// The lookup path trusts the file, so make sure it stays in bounds.
+	if (dict->strings_len == 0 || dict->strings[dict->strings_len - 1]) {
+		fprintf(stderr, "%s: invalid dictionary\n", path);
+		daklakwl_dict_close(dict);
+		return false;
+	}
+	for (uint32_t i = 0; i < dict->entries_len; i++) {
+		if (dict->entries[i].text >= dict->strings_len) {
+			fprintf(stderr, "%s: invalid dictionary\n", path);
+			daklakwl_dict_close(dict);
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < dict->units_len; i++) {
+		struct daklakwl_dict_unit const *unit = &dict->units[i];
+		if ((uint64_t)unit->lo + unit->count > dict->entries_len
+		    || (unit->top != DAKLAKWL_DICT_NONE
+			&& (uint64_t)unit->top + DAKLAKWL_DICT_TOPK
+			       > dict->top_len)) {
+			fprintf(stderr, "%s: invalid dictionary\n", path);
+			daklakwl_dict_close(dict);
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < dict->top_len; i++) {
+		if (dict->top[i] >= dict->entries_len) {
+			fprintf(stderr, "%s: invalid dictionary\n", path);
+			daklakwl_dict_close(dict);
+			return false;
+		}
+	}
+	return true;
+}
+
+void daklakwl_dict_close(struct daklakwl_dict *dict)
+{
+	if (dict->map)
+		munmap(dict->map, dict->size);
+	memset(dict, 0, sizeof *dict);
+}
+
+static struct daklakwl_dict_unit const *
+daklakwl_dict_walk(struct daklakwl_dict const *dict, char const *prefix)
+{
+	uint32_t s = 0;
+	for (unsigned char const *c = (unsigned char const *)prefix; *c; c++) {
+		uint64_t t = (int64_t)dict->units[s].base + *c + 1;
+		if (t >= dict->units_len || dict->units[t].check != s)
+			return NULL;
+		s = t;
+	}
+	return &dict->units[s];
+}
+
+bool daklakwl_dict_contains(struct daklakwl_dict const *dict, char const *word)
+{
+	if (dict->map == NULL)
+		return false;
+	struct daklakwl_dict_unit const *unit = daklakwl_dict_walk(dict, word);
+	// entries are sorted by bytes, so an exact match comes first
+	return unit != NULL && unit->count != 0
+	       && strcmp(dict->strings + dict->entries[unit->lo].text, word)
+		      == 0;
+}
+
+size_t daklakwl_dict_lookup(struct daklakwl_dict const *dict,
+			    char const *prefix,
+			    struct daklakwl_dict_candidate *candidates,
+			    size_t max)
+{
+	if (dict->map == NULL || max == 0)
+		return 0;
+	struct daklakwl_dict_unit const *unit
+	    = daklakwl_dict_walk(dict, prefix);
+	if (unit == NULL || unit->count == 0)
+		return 0;
+
+	size_t len = 0;
+	if (unit->count <= DAKLAKWL_DICT_TOPK) {
+		// Few enough to rank in place: insertion sort by frequency.
+		for (uint32_t i = unit->lo; i < unit->lo + unit->count; i++) {
+			struct daklakwl_dict_entry const *entry
+			    = &dict->entries[i];
+			size_t j = len < max ? len++ : max;
+			while (j > 0
+			       && candidates[j - 1].frequency
+				      < entry->frequency) {
+				if (j < max)
+					candidates[j] = candidates[j - 1];
+				j--;
+			}
+			if (j < max) {
+				candidates[j].text
+				    = dict->strings + entry->text;
+				candidates[j].frequency = entry->frequency;
+			}
+		}
+		return len;
+	}
+
+	for (; len < max && len < DAKLAKWL_DICT_TOPK; len++) {
+		struct daklakwl_dict_entry const *entry
+		    = &dict->entries[dict->top[unit->top + len]];
+		candidates[len].text = dict->strings + entry->text;
+		candidates[len].frequency = entry->frequency;
+	}
+	return len;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DAKLAKWL_DICT_TOPK 8
+
+struct daklakwl_dict_unit {
+	int32_t base;
+	uint32_t check;
+	uint32_t lo;
+	uint32_t count;
+	uint32_t top;
+};
+
+struct daklakwl_dict_entry {
+	uint32_t text;
+	uint32_t frequency;
+};
+
+struct daklakwl_dict_candidate {
+	char const *text;
+	uint32_t frequency;
+};
+
+// A read-only word list compiled by buildtools/dictcompile.py, mapped
+// straight from disk so its pages are shared by every daklak process.
+struct daklakwl_dict {
+	void *map;
+	size_t size;
+	struct daklakwl_dict_unit const *units;
+	uint32_t units_len;
+	struct daklakwl_dict_entry const *entries;
+	uint32_t entries_len;
+	uint32_t const *top;
+	uint32_t top_len;
+	char const *strings;
+	uint32_t strings_len;
+};
+
+bool daklakwl_dict_open(struct daklakwl_dict *, char const *path);
+void daklakwl_dict_close(struct daklakwl_dict *);
+bool daklakwl_dict_contains(struct daklakwl_dict const *, char const *word);
+size_t daklakwl_dict_lookup(struct daklakwl_dict const *, char const *prefix,
+			    struct daklakwl_dict_candidate *, size_t max);
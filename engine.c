@@ -0,0 +1,188 @@
+#include "engine.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "control.h"
+
+// Appends a key as typed, the way both methods start a word: consonants
+// before the first vowel go straight to the client.
+static enum daklakwl_engine_result
+daklakwl_engine_append(struct daklakwl_buffer *buffer, char const *utf8)
+{
+	daklakwl_buffer_gi_append(buffer, utf8);
+	if (daklakwl_buffer_should_not_append(buffer, utf8)) {
+		daklakwl_buffer_prefix_append(buffer, utf8);
+		return DAKLAKWL_ENGINE_PREFIX;
+	}
+	daklakwl_buffer_raw_append(buffer, utf8);
+	daklakwl_buffer_append(buffer, utf8);
+	return DAKLAKWL_ENGINE_APPENDED;
+}
+
+static void daklakwl_engine_delete_left(struct daklakwl_buffer *buffer)
+{
+	daklakwl_buffer_delete_backwards_all(buffer, 1);
+}
+
+static void daklakwl_engine_delete_right(struct daklakwl_buffer *buffer)
+{
+	daklakwl_buffer_delete_forwards_all(buffer, 1);
+}
+
+static char const *
+daklakwl_engine_preedit(struct daklakwl_buffer const *buffer, size_t *cursor)
+{
+	*cursor = buffer->pos;
+	return buffer->text;
+}
+
+static char const *
+daklakwl_engine_commit(struct daklakwl_buffer const *buffer)
+{
+	return buffer->text;
+}
+
+static enum daklakwl_engine_result
+daklakwl_telex_feed(struct daklakwl_buffer *buffer, char const *utf8)
+{
+	enum daklakwl_engine_result result = daklakwl_engine_append(buffer, utf8);
+	if (result == DAKLAKWL_ENGINE_PREFIX)
+		return result;
+	return daklakwl_buffer_compose(buffer) ? DAKLAKWL_ENGINE_COMPOSED
+					       : DAKLAKWL_ENGINE_APPENDED;
+}
+
+struct daklakwl_engine const daklakwl_engine_telex = {
+    .name = "telex",
+    .method = DAKLAKWL_CONTROL_METHOD_TELEX,
+    .feed = daklakwl_telex_feed,
+    .delete_left = daklakwl_engine_delete_left,
+    .delete_right = daklakwl_engine_delete_right,
+    .move_left = daklakwl_buffer_move_left,
+    .move_right = daklakwl_buffer_move_right,
+    .preedit = daklakwl_engine_preedit,
+    .commit = daklakwl_engine_commit,
+    .reset = daklakwl_buffer_clear,
+};
+
+// Last vowel of the word that is one of set, ignoring tone marks.
+static wchar_t daklakwl_vni_last_vowel(struct daklakwl_buffer const *buffer,
+				       wchar_t const *const *sets)
+{
+	wchar_t text[64];
+	mbstate_t state = {0};
+	char const *src = buffer->text;
+	size_t len = mbsrtowcs(text, &src, sizeof text / sizeof text[0] - 1,
+			       &state);
+	if (len == (size_t)-1)
+		return 0;
+	for (size_t i = len; i > 0; i--) {
+		wchar_t c = towlower(text[i - 1]);
+		for (size_t j = 0; sets[j] != NULL; j++) {
+			if (wcschr(sets[j], c))
+				return sets[j][0];
+		}
+	}
+	return 0;
+}
+
+// VNI puts diacritics on digits typed after the letters. Each does what
+// a Telex key does to the same word, so the Telex rules do the work.
+static char daklakwl_vni_telex_key(struct daklakwl_buffer const *buffer,
+				   char digit)
+{
+	static wchar_t const *const circumflexed[]
+	    = {L"aáàảãạ", L"eéèẻẽẹ", L"oóòỏõọ", NULL};
+	static wchar_t const *const horned[]
+	    = {L"oóòỏõọ", L"uúùủũụ", NULL};
+	static wchar_t const *const breved[] = {L"aáàảãạ", NULL};
+	switch (digit) {
+	case '1':
+		return 's';
+	case '2':
+		return 'f';
+	case '3':
+		return 'r';
+	case '4':
+		return 'x';
+	case '5':
+		return 'j';
+	case '6':
+		// Telex doubles the vowel that takes the circumflex
+		return daklakwl_vni_last_vowel(buffer, circumflexed);
+	case '7':
+		return daklakwl_vni_last_vowel(buffer, horned) ? 'w' : 0;
+	case '8':
+		return daklakwl_vni_last_vowel(buffer, breved) ? 'w' : 0;
+	case '9':
+		return tolower(buffer->gi[0]) == 'd' ? 'd' : 0;
+	default:
+		return 0;
+	}
+}
+
+static enum daklakwl_engine_result
+daklakwl_vni_feed(struct daklakwl_buffer *buffer, char const *utf8)
+{
+	// letters are only ever letters, unlike in Telex
+	if (utf8[0] < '0' || utf8[0] > '9')
+		return daklakwl_engine_append(buffer, utf8);
+	if (buffer->len == 0)
+		return DAKLAKWL_ENGINE_PASS;
+	char telex[2] = {daklakwl_vni_telex_key(buffer, utf8[0]), '\0'};
+	daklakwl_buffer_raw_append(buffer, utf8);
+	if (telex[0] != '\0') {
+		daklakwl_buffer_append(buffer, telex);
+		if (daklakwl_buffer_compose(buffer))
+			return DAKLAKWL_ENGINE_COMPOSED;
+		daklakwl_buffer_delete_backwards(buffer, 1);
+	}
+	// a digit that does nothing here is just a digit
+	daklakwl_buffer_append(buffer, utf8);
+	return DAKLAKWL_ENGINE_APPENDED;
+}
+
+struct daklakwl_engine const daklakwl_engine_vni = {
+    .name = "vni",
+    .method = DAKLAKWL_CONTROL_METHOD_VNI,
+    .takes_digits = true,
+    .feed = daklakwl_vni_feed,
+    .delete_left = daklakwl_engine_delete_left,
+    .delete_right = daklakwl_engine_delete_right,
+    .move_left = daklakwl_buffer_move_left,
+    .move_right = daklakwl_buffer_move_right,
+    .preedit = daklakwl_engine_preedit,
+    .commit = daklakwl_engine_commit,
+    .reset = daklakwl_buffer_clear,
+};
+
+static struct daklakwl_engine const *const daklakwl_engines[] = {
+    &daklakwl_engine_telex,
+    &daklakwl_engine_vni,
+};
+
+#define DAKLAKWL_ENGINES (sizeof daklakwl_engines / sizeof daklakwl_engines[0])
+
+struct daklakwl_engine const *daklakwl_engine_from_name(char const *name,
+							 size_t len)
+{
+	for (size_t i = 0; i < DAKLAKWL_ENGINES; i++) {
+		if (strlen(daklakwl_engines[i]->name) == len
+		    && memcmp(daklakwl_engines[i]->name, name, len) == 0)
+			return daklakwl_engines[i];
+	}
+	return NULL;
+}
+
+struct daklakwl_engine const *
+daklakwl_engine_next(struct daklakwl_engine const *engine)
+{
+	for (size_t i = 0; i < DAKLAKWL_ENGINES; i++) {
+		if (daklakwl_engines[i] == engine)
+			return daklakwl_engines[(i + 1) % DAKLAKWL_ENGINES];
+	}
+	return daklakwl_engines[0];
+}
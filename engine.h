@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+// What an engine made of a key.
+enum daklakwl_engine_result {
+	// not part of the word, the key goes on to the client as is and
+	// ends the word
+	DAKLAKWL_ENGINE_PASS,
+	// a consonant before the word's first vowel, kept in the buffer's
+	// prefix and sent on to the client as is
+	DAKLAKWL_ENGINE_PREFIX,
+	// added to the word as typed
+	DAKLAKWL_ENGINE_APPENDED,
+	// added, and a rule rewrote the word or undid the one before
+	DAKLAKWL_ENGINE_COMPOSED,
+};
+
+// A typing method. Seats call theirs through this table, so switching is
+// one pointer store, and what an engine does with a word stays behind it.
+// Every engine edits a struct daklakwl_buffer: text is the word so far,
+// raw the keys that were typed for it.
+struct daklakwl_engine {
+	char const *name;
+	// the method as daklakctl and socket clients know it
+	uint8_t method;
+	// digits can be part of a word, not just letters
+	bool takes_digits;
+	enum daklakwl_engine_result (*feed)(struct daklakwl_buffer *,
+					    char const *utf8);
+	void (*delete_left)(struct daklakwl_buffer *);
+	void (*delete_right)(struct daklakwl_buffer *);
+	void (*move_left)(struct daklakwl_buffer *);
+	void (*move_right)(struct daklakwl_buffer *);
+	// the text to show and the cursor in it, in bytes
+	char const *(*preedit)(struct daklakwl_buffer const *, size_t *cursor);
+	// the finished word, valid until the next reset
+	char const *(*commit)(struct daklakwl_buffer const *);
+	void (*reset)(struct daklakwl_buffer *);
+};
+
+extern struct daklakwl_engine const daklakwl_engine_telex;
+extern struct daklakwl_engine const daklakwl_engine_vni;
+
+// NULL when no engine has that name.
+struct daklakwl_engine const *daklakwl_engine_from_name(char const *name,
+							 size_t len);
+// The engine after this one, for cycling through them with a key.
+struct daklakwl_engine const *
+daklakwl_engine_next(struct daklakwl_engine const *);
@@ -0,0 +1,97 @@
+#include "font.h"
+
+#include <fontconfig/fontconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool daklakwl_font_init(struct daklakwl_font *font, char const *pattern)
+{
+	memset(font, 0, sizeof *font);
+	if (!FcInit()) {
+		fprintf(stderr, "failed to initialize fontconfig\n");
+		return false;
+	}
+	FcPattern *pat = FcNameParse((FcChar8 const *)pattern);
+	if (pat == NULL) {
+		fprintf(stderr, "invalid font pattern '%s'\n", pattern);
+		return false;
+	}
+	FcConfigSubstitute(NULL, pat, FcMatchPattern);
+	FcDefaultSubstitute(pat);
+	FcResult result;
+	FcPattern *match = FcFontMatch(NULL, pat, &result);
+	FcPatternDestroy(pat);
+	if (match == NULL) {
+		fprintf(stderr, "no font matches '%s'\n", pattern);
+		return false;
+	}
+
+	FcChar8 *file;
+	int index = 0;
+	double pixel_size = 16;
+	FcPatternGetInteger(match, FC_INDEX, 0, &index);
+	FcPatternGetDouble(match, FC_PIXEL_SIZE, 0, &pixel_size);
+	if (FcPatternGetString(match, FC_FILE, 0, &file) != FcResultMatch
+	    || FT_Init_FreeType(&font->ft_library) != 0
+	    || FT_New_Face(font->ft_library, (char const *)file, index,
+			   &font->ft_face)
+		   != 0) {
+		fprintf(stderr, "failed to load font for '%s'\n", pattern);
+		FcPatternDestroy(match);
+		daklakwl_font_finish(font);
+		return false;
+	}
+	font->file = strdup((char const *)file);
+	font->index = index;
+	FcPatternDestroy(match);
+	font->pixel_size = pixel_size + 0.5;
+	daklakwl_font_set_scale(font, 1);
+	return true;
+}
+
+void daklakwl_font_finish(struct daklakwl_font *font)
+{
+	if (font->ft_face)
+		FT_Done_Face(font->ft_face);
+	if (font->ft_library)
+		FT_Done_FreeType(font->ft_library);
+	free(font->file);
+	memset(font, 0, sizeof *font);
+}
+
+void daklakwl_font_set_scale(struct daklakwl_font *font, int scale)
+{
+	font->scale = scale;
+	FT_Set_Pixel_Sizes(font->ft_face, 0, font->pixel_size * scale);
+	FT_Size_Metrics const *metrics = &font->ft_face->size->metrics;
+	font->ascent = metrics->ascender >> 6;
+	font->height = metrics->height >> 6;
+}
+
+uint32_t daklakwl_utf8_next(char const **s)
+{
+	unsigned char const *p = (unsigned char const *)*s;
+	uint32_t c = p[0];
+	int len = 1;
+	if (c >= 0xf0 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80
+	    && (p[3] & 0xc0) == 0x80) {
+		c = (c & 0x07) << 18 | (p[1] & 0x3f) << 12 | (p[2] & 0x3f) << 6
+		    | (p[3] & 0x3f);
+		len = 4;
+	}
+	else if (c >= 0xe0 && (p[1] & 0xc0) == 0x80
+		 && (p[2] & 0xc0) == 0x80) {
+		c = (c & 0x0f) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+		len = 3;
+	}
+	else if (c >= 0xc0 && (p[1] & 0xc0) == 0x80) {
+		c = (c & 0x1f) << 6 | (p[1] & 0x3f);
+		len = 2;
+	}
+	else if (c >= 0x80) {
+		c = 0xfffd;
+	}
+	*s += len;
+	return c;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+struct daklakwl_font {
+	FT_Library ft_library;
+	FT_Face ft_face;
+	char *file;
+	int index;
+	int pixel_size;
+	int scale;
+	int ascent;
+	int height;
+};
+
+bool daklakwl_font_init(struct daklakwl_font *, char const *pattern);
+void daklakwl_font_finish(struct daklakwl_font *);
+void daklakwl_font_set_scale(struct daklakwl_font *, int scale);
+uint32_t daklakwl_utf8_next(char const **s);
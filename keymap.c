@@ -0,0 +1,318 @@
+#include "keymap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "daklakwl.h"
+#include "metrics.h"
+
+// Keep a few layouts around after their last seat lets go, so switching
+// back and forth does not recompile.
+#define DAKLAKWL_KEYMAP_CACHE_MAX 8
+
+static uint64_t daklakwl_keymap_hash(char const *data, size_t size)
+{
+	// Eight bytes per step; keymaps are tens of kilobytes and this runs
+	// every time a compositor re-sends one.
+	uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+	hash ^= hash >> 29;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+struct keycode_matches {
+	struct xkb_state *xkb_state;
+	xkb_keysym_t keysym;
+	struct wl_array keycodes;
+};
+
+static void find_keycode(struct xkb_keymap *keymap, xkb_keycode_t keycode,
+			 void *data)
+{
+	struct keycode_matches *matches = data;
+	xkb_keysym_t keysym
+	    = xkb_state_key_get_one_sym(matches->xkb_state, keycode);
+	if (keysym == XKB_KEY_NoSymbol)
+		return;
+	if (matches->keysym == keysym) {
+		xkb_keycode_t *keycode_spot
+		    = wl_array_add(&matches->keycodes, sizeof(xkb_keycode_t));
+		*keycode_spot = keycode;
+	}
+}
+
+// Modifier class bit of each modifier, -1 for those that never select
+// a binding.
+static int const daklakwl_mod_class_bits[_DAKLAKWL_MOD_LAST] = {
+    [DAKLAKWL_SHIFT_INDEX] = 0, [DAKLAKWL_CAPS_INDEX] = -1,
+    [DAKLAKWL_CTRL_INDEX] = 1,	[DAKLAKWL_ALT_INDEX] = 2,
+    [DAKLAKWL_NUM_INDEX] = -1,	[DAKLAKWL_MOD3_INDEX] = 3,
+    [DAKLAKWL_LOGO_INDEX] = 4,	[DAKLAKWL_MOD5_INDEX] = 5,
+};
+
+static void
+daklakwl_binding_table_init(struct daklakwl_binding_table *table,
+			    struct daklakwl_keymap const *keymap,
+			    struct keycode_matches *matches,
+			    struct wl_array const *bindings)
+{
+	table->keycodes = keymap->max_keycode + 1;
+	table->actions = calloc(table->keycodes, DAKLAKWL_MOD_CLASSES);
+	if (table->actions == NULL) {
+		// nothing bound, every lookup misses
+		table->keycodes = 0;
+		return;
+	}
+	struct daklakwl_binding *binding;
+	wl_array_for_each(binding, bindings)
+	{
+		// the pressed modifiers never include these
+		if (binding->modifiers & (DAKLAKWL_CAPS | DAKLAKWL_NUM))
+			continue;
+		uint8_t mod_class = 0;
+		for (int i = 0; i < _DAKLAKWL_MOD_LAST; i++) {
+			if (binding->modifiers & (1 << i))
+				mod_class |= 1 << daklakwl_mod_class_bits[i];
+		}
+		matches->keysym = binding->keysym;
+		matches->keycodes.size = 0;
+		xkb_keymap_key_for_each(keymap->xkb_keymap, find_keycode,
+					matches);
+		xkb_keycode_t *keycode;
+		wl_array_for_each(keycode, &matches->keycodes)
+		{
+			// later directives win
+			table->actions[*keycode * DAKLAKWL_MOD_CLASSES
+				       + mod_class]
+			    = binding->action;
+		}
+	}
+}
+
+void daklakwl_keymap_bindings_build(struct daklakwl_keymap const *keymap,
+				    struct xkb_state *xkb_state,
+				    struct daklakwl_config const *config,
+				    struct daklakwl_binding_table *composing,
+				    struct daklakwl_binding_table *global)
+{
+	struct keycode_matches matches = {
+	    .xkb_state = xkb_state,
+	};
+	wl_array_init(&matches.keycodes);
+	daklakwl_binding_table_init(composing, keymap, &matches,
+				    &config->composing_bindings);
+	daklakwl_binding_table_init(global, keymap, &matches,
+				    &config->global_bindings);
+	wl_array_release(&matches.keycodes);
+}
+
+void daklakwl_binding_table_finish(struct daklakwl_binding_table *table)
+{
+	free(table->actions);
+	table->actions = NULL;
+	table->keycodes = 0;
+}
+
+void daklakwl_keymap_rebind(struct daklakwl_keymap *keymap,
+			    struct daklakwl_config const *config)
+{
+	struct xkb_state *xkb_state = xkb_state_new(keymap->xkb_keymap);
+	daklakwl_binding_table_finish(&keymap->composing_bindings);
+	daklakwl_binding_table_finish(&keymap->global_bindings);
+	daklakwl_keymap_bindings_build(keymap, xkb_state, config,
+				       &keymap->composing_bindings,
+				       &keymap->global_bindings);
+	xkb_state_unref(xkb_state);
+}
+
+enum daklakwl_action
+daklakwl_binding_table_lookup(struct daklakwl_binding_table const *table,
+			      xkb_keycode_t keycode, uint8_t mod_class)
+{
+	if (keycode >= table->keycodes)
+		return DAKLAKWL_ACTION_INVALID;
+	return table->actions[keycode * DAKLAKWL_MOD_CLASSES + mod_class];
+}
+
+uint8_t daklakwl_keymap_mod_class(struct daklakwl_keymap const *keymap,
+				  xkb_mod_mask_t mod_mask)
+{
+	uint8_t mod_class = 0;
+	for (int i = 0; i < _DAKLAKWL_MOD_LAST; i++) {
+		xkb_mod_index_t mod = keymap->mod_indices[i];
+		if (daklakwl_mod_class_bits[i] < 0 || mod >= 32)
+			continue;
+		if (mod_mask & (1u << mod))
+			mod_class |= 1 << daklakwl_mod_class_bits[i];
+	}
+	return mod_class;
+}
+
+static xkb_mod_mask_t
+daklakwl_keymap_mod_mask(struct daklakwl_keymap const *keymap,
+			 enum daklak_modifier_index index)
+{
+	xkb_mod_index_t mod = keymap->mod_indices[index];
+	return mod == XKB_MOD_INVALID || mod >= 32 ? 0 : 1u << mod;
+}
+
+void daklakwl_keymap_classify(struct xkb_state *xkb_state,
+			      xkb_keycode_t keycode, struct daklakwl_key *key)
+{
+	key->keysym = xkb_state_key_get_one_sym(xkb_state, keycode);
+	key->repeats = xkb_keymap_key_repeats(xkb_state_get_keymap(xkb_state),
+					      keycode);
+	key->utf8[0] = '\0';
+	switch (key->keysym) {
+	case XKB_KEY_Shift_L:
+	case XKB_KEY_Shift_R:
+	case XKB_KEY_Control_L:
+	case XKB_KEY_Control_R:
+	case XKB_KEY_Alt_L:
+	case XKB_KEY_Alt_R:
+	case XKB_KEY_Super_L:
+	case XKB_KEY_Super_R:
+	case XKB_KEY_Hyper_L:
+	case XKB_KEY_Hyper_R:
+	case XKB_KEY_Caps_Lock:
+		key->class = DAKLAKWL_KEY_MODIFIER;
+		return;
+	}
+	key->class = DAKLAKWL_KEY_PASSTHROUGH;
+	enum daklakwl_key_class class = DAKLAKWL_KEY_LETTER;
+	if (key->keysym >= XKB_KEY_0 && key->keysym <= XKB_KEY_9)
+		class = DAKLAKWL_KEY_DIGIT;
+	else if (!((key->keysym >= XKB_KEY_a && key->keysym <= XKB_KEY_z)
+		   || (key->keysym >= XKB_KEY_A && key->keysym <= XKB_KEY_Z)))
+		return;
+	uint32_t codepoint = xkb_state_key_get_utf32(xkb_state, keycode);
+	if (codepoint != 0 && codepoint < 32)
+		return;
+	int len = xkb_state_key_get_utf8(xkb_state, keycode, key->utf8,
+					 sizeof key->utf8);
+	if (len > 0 && (size_t)len < sizeof key->utf8)
+		key->class = class;
+}
+
+static void daklakwl_keymap_destroy(struct daklakwl_keymap_cache *cache,
+				    struct daklakwl_keymap *keymap)
+{
+	wl_list_remove(&keymap->link);
+	cache->keymaps_len--;
+	xkb_keymap_unref(keymap->xkb_keymap);
+	daklakwl_binding_table_finish(&keymap->composing_bindings);
+	daklakwl_binding_table_finish(&keymap->global_bindings);
+	free(keymap);
+}
+
+bool daklakwl_keymap_cache_init(struct daklakwl_keymap_cache *cache)
+{
+	memset(cache, 0, sizeof *cache);
+	wl_list_init(&cache->keymaps);
+	cache->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (cache->xkb_context == NULL) {
+		fprintf(stderr, "failed to create xkb context\n");
+		return false;
+	}
+	return true;
+}
+
+void daklakwl_keymap_cache_finish(struct daklakwl_keymap_cache *cache)
+{
+	struct daklakwl_keymap *keymap, *tmp;
+	wl_list_for_each_safe(keymap, tmp, &cache->keymaps, link)
+	    daklakwl_keymap_destroy(cache, keymap);
+	xkb_context_unref(cache->xkb_context);
+	memset(cache, 0, sizeof *cache);
+}
+
+struct daklakwl_keymap *
+daklakwl_keymap_cache_get(struct daklakwl_keymap_cache *cache,
+			  char const *data, size_t size,
+			  struct daklakwl_config const *config)
+{
+	uint64_t hash = daklakwl_keymap_hash(data, size);
+	struct daklakwl_keymap *keymap;
+	wl_list_for_each(keymap, &cache->keymaps, link)
+	{
+		if (keymap->hash == hash && keymap->size == size
+		    && memcmp(keymap->data, data, size) == 0) {
+			// most recently used first
+			wl_list_remove(&keymap->link);
+			wl_list_insert(&cache->keymaps, &keymap->link);
+			keymap->refs++;
+			cache->hits++;
+			return keymap;
+		}
+	}
+
+	cache->misses++;
+	daklakwl_metrics_count(DAKLAKWL_COUNTER_KEYMAP_COMPILES, 1);
+	struct xkb_keymap *xkb_keymap = xkb_keymap_new_from_buffer(
+	    cache->xkb_context, data, strnlen(data, size),
+	    XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (xkb_keymap == NULL) {
+		fprintf(stderr, "failed to compile keymap\n");
+		return NULL;
+	}
+	keymap = calloc(1, sizeof *keymap + size);
+	if (keymap == NULL) {
+		perror("calloc");
+		xkb_keymap_unref(xkb_keymap);
+		return NULL;
+	}
+	keymap->refs = 1;
+	keymap->hash = hash;
+	keymap->size = size;
+	memcpy(keymap->data, data, size);
+	keymap->xkb_keymap = xkb_keymap;
+	static char const *const mod_names[_DAKLAKWL_MOD_LAST] = {
+	    [DAKLAKWL_SHIFT_INDEX] = XKB_MOD_NAME_SHIFT,
+	    [DAKLAKWL_CAPS_INDEX] = XKB_MOD_NAME_CAPS,
+	    [DAKLAKWL_CTRL_INDEX] = XKB_MOD_NAME_CTRL,
+	    [DAKLAKWL_ALT_INDEX] = XKB_MOD_NAME_ALT,
+	    [DAKLAKWL_NUM_INDEX] = XKB_MOD_NAME_NUM,
+	    [DAKLAKWL_MOD3_INDEX] = "Mod3",
+	    [DAKLAKWL_LOGO_INDEX] = XKB_MOD_NAME_LOGO,
+	    [DAKLAKWL_MOD5_INDEX] = "Mod5",
+	};
+	for (int i = 0; i < _DAKLAKWL_MOD_LAST; i++)
+		keymap->mod_indices[i]
+		    = xkb_keymap_mod_get_index(xkb_keymap, mod_names[i]);
+	keymap->ignored_mods
+	    = daklakwl_keymap_mod_mask(keymap, DAKLAKWL_CAPS_INDEX)
+	      | daklakwl_keymap_mod_mask(keymap, DAKLAKWL_NUM_INDEX);
+	keymap->ctrl_mods = daklakwl_keymap_mod_mask(keymap, DAKLAKWL_CTRL_INDEX);
+	keymap->max_keycode = xkb_keymap_max_keycode(xkb_keymap);
+	daklakwl_keymap_rebind(keymap, config);
+	wl_list_insert(&cache->keymaps, &keymap->link);
+	cache->keymaps_len++;
+	return keymap;
+}
+
+void daklakwl_keymap_unref(struct daklakwl_keymap_cache *cache,
+			   struct daklakwl_keymap *keymap)
+{
+	if (keymap == NULL || --keymap->refs > 0)
+		return;
+	// evict from the least recently used end
+	struct daklakwl_keymap *old, *tmp;
+	wl_list_for_each_reverse_safe(old, tmp, &cache->keymaps, link)
+	{
+		if (cache->keymaps_len <= DAKLAKWL_KEYMAP_CACHE_MAX)
+			break;
+		if (old->refs == 0)
+			daklakwl_keymap_destroy(cache, old);
+	}
+}
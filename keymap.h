@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-util.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "actions.h"
+
+struct daklakwl_config;
+
+enum daklak_modifier_index {
+	DAKLAKWL_SHIFT_INDEX,
+	DAKLAKWL_CAPS_INDEX,
+	DAKLAKWL_CTRL_INDEX,
+	DAKLAKWL_ALT_INDEX,
+	DAKLAKWL_NUM_INDEX,
+	DAKLAKWL_MOD3_INDEX,
+	DAKLAKWL_LOGO_INDEX,
+	DAKLAKWL_MOD5_INDEX,
+	_DAKLAKWL_MOD_LAST,
+};
+
+enum daklakwl_modifier {
+	DAKLAKWL_SHIFT = 1 << DAKLAKWL_SHIFT_INDEX,
+	DAKLAKWL_CAPS = 1 << DAKLAKWL_CAPS_INDEX,
+	DAKLAKWL_CTRL = 1 << DAKLAKWL_CTRL_INDEX,
+	DAKLAKWL_ALT = 1 << DAKLAKWL_ALT_INDEX,
+	DAKLAKWL_NUM = 1 << DAKLAKWL_NUM_INDEX,
+	DAKLAKWL_MOD3 = 1 << DAKLAKWL_MOD3_INDEX,
+	DAKLAKWL_LOGO = 1 << DAKLAKWL_LOGO_INDEX,
+	DAKLAKWL_MOD5 = 1 << DAKLAKWL_MOD5_INDEX,
+};
+
+// Bindings are selected by Shift, Control, Alt, Mod3, Mod4 and Mod5,
+// packed into six bits; Caps Lock and Num Lock never take part.
+#define DAKLAKWL_MOD_CLASSES 64
+
+// Action per keycode and modifier class, DAKLAKWL_ACTION_INVALID where
+// nothing is bound.
+struct daklakwl_binding_table {
+	uint8_t *actions;
+	xkb_keycode_t keycodes;
+};
+
+enum daklakwl_key_class {
+	// anything the composer does not take, sent on as is
+	DAKLAKWL_KEY_PASSTHROUGH,
+	// a-z or A-Z, fed to the composer
+	DAKLAKWL_KEY_LETTER,
+	// 0-9, fed to the composer when the typing method takes digits
+	DAKLAKWL_KEY_DIGIT,
+	// Shift, Control, Alt, Super, Hyper or Caps Lock
+	DAKLAKWL_KEY_MODIFIER,
+};
+
+// What a key produces under the modifiers of one xkb_state. Valid while
+// generation matches the seat's.
+struct daklakwl_key {
+	uint32_t generation;
+	xkb_keysym_t keysym;
+	uint8_t class;
+	bool repeats;
+	char utf8[7];
+};
+
+// A compiled keymap and the tables derived from it, shared by every seat
+// whose compositor sends the same keymap bytes.
+struct daklakwl_keymap {
+	struct wl_list link;
+	int refs;
+	uint64_t hash;
+	size_t size;
+	struct xkb_keymap *xkb_keymap;
+	xkb_mod_index_t mod_indices[_DAKLAKWL_MOD_LAST];
+	// Caps Lock and Num Lock never take part in bindings
+	xkb_mod_mask_t ignored_mods;
+	xkb_mod_mask_t ctrl_mods;
+	xkb_keycode_t max_keycode;
+	struct daklakwl_binding_table composing_bindings;
+	struct daklakwl_binding_table global_bindings;
+	// the keymap bytes, compared on a hash match
+	char data[];
+};
+
+struct daklakwl_keymap_cache {
+	struct xkb_context *xkb_context;
+	struct wl_list keymaps;
+	size_t keymaps_len;
+	uint64_t hits, misses;
+};
+
+bool daklakwl_keymap_cache_init(struct daklakwl_keymap_cache *);
+void daklakwl_keymap_cache_finish(struct daklakwl_keymap_cache *);
+struct daklakwl_keymap *
+daklakwl_keymap_cache_get(struct daklakwl_keymap_cache *, char const *data,
+			  size_t size, struct daklakwl_config const *);
+uint8_t daklakwl_keymap_mod_class(struct daklakwl_keymap const *,
+				  xkb_mod_mask_t);
+enum daklakwl_action
+daklakwl_binding_table_lookup(struct daklakwl_binding_table const *,
+			      xkb_keycode_t, uint8_t mod_class);
+void daklakwl_keymap_classify(struct xkb_state *, xkb_keycode_t,
+			      struct daklakwl_key *);
+void daklakwl_keymap_unref(struct daklakwl_keymap_cache *,
+			   struct daklakwl_keymap *);
+// Builds the binding tables of a config for a keymap. Only reads the
+// keymap, so it can run on another thread as long as the xkb_state is its
+// own: xkb reference counts are not atomic.
+void daklakwl_keymap_bindings_build(struct daklakwl_keymap const *,
+				    struct xkb_state *,
+				    struct daklakwl_config const *,
+				    struct daklakwl_binding_table *composing,
+				    struct daklakwl_binding_table *global);
+// Replaces the keymap's tables with ones built here for config.
+void daklakwl_keymap_rebind(struct daklakwl_keymap *,
+			    struct daklakwl_config const *);
+void daklakwl_binding_table_finish(struct daklakwl_binding_table *);
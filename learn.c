@@ -0,0 +1,556 @@
+#include "learn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAKLAKWL_LEARN_LOG_MAGIC "DKLL"
+#define DAKLAKWL_LEARN_SNAPSHOT_MAGIC "DKLS"
+#define DAKLAKWL_LEARN_VERSION 1
+
+// The writer syncs at most once per interval unless this many records
+// are waiting, and folds the log into the snapshot once it grows past
+// the compaction threshold.
+#define DAKLAKWL_LEARN_BATCH 256
+#define DAKLAKWL_LEARN_FLUSH_INTERVAL_MS 2000
+#define DAKLAKWL_LEARN_COMPACT_SIZE (256 * 1024)
+
+struct daklakwl_learn_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t generation;
+	uint64_t count;
+};
+
+static uint64_t daklakwl_learn_hash(uint64_t hash, char const *s)
+{
+	for (; *s; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint64_t daklakwl_learn_unigram_key(char const *word)
+{
+	uint64_t key = daklakwl_learn_hash(0xcbf29ce484222325ULL, word);
+	return key ? key : 1;
+}
+
+static uint64_t daklakwl_learn_bigram_key(char const *prev, char const *word)
+{
+	uint64_t key = daklakwl_learn_hash(0x84222325cbf29ce4ULL, prev);
+	key = daklakwl_learn_hash(key ^ 0x1f, word);
+	return key ? key : 1;
+}
+
+static struct daklakwl_learn_record *
+daklakwl_learn_find(struct daklakwl_learn_record *table, size_t cap,
+		    uint64_t key)
+{
+	size_t mask = cap - 1;
+	for (size_t i = key & mask;; i = (i + 1) & mask) {
+		if (table[i].key == key || table[i].key == 0)
+			return &table[i];
+	}
+}
+
+// Counts stop at the top instead of wrapping.
+static uint32_t daklakwl_learn_sum(uint32_t a, uint32_t b)
+{
+	return a > UINT32_MAX - b ? UINT32_MAX : a + b;
+}
+
+static void daklakwl_learn_add(struct daklakwl_learn *learn, uint64_t key,
+			       uint32_t count)
+{
+	if ((learn->table_len + 1) * 10 >= learn->table_cap * 7) {
+		size_t cap = learn->table_cap ? learn->table_cap * 2 : 1024;
+		struct daklakwl_learn_record *table
+		    = calloc(cap, sizeof *table);
+		if (table == NULL) {
+			perror("learning table");
+			// the old table is fuller than it should be, but
+			// lookups still end as long as a slot is free
+			if (learn->table_len + 1 >= learn->table_cap)
+				return;
+		}
+		else {
+			for (size_t i = 0; i < learn->table_cap; i++) {
+				if (learn->table[i].key)
+					*daklakwl_learn_find(
+					    table, cap, learn->table[i].key)
+					    = learn->table[i];
+			}
+			free(learn->table);
+			learn->table = table;
+			learn->table_cap = cap;
+		}
+	}
+	struct daklakwl_learn_record *record
+	    = daklakwl_learn_find(learn->table, learn->table_cap, key);
+	if (record->key == 0) {
+		record->key = key;
+		learn->table_len++;
+	}
+	record->count = daklakwl_learn_sum(record->count, count);
+}
+
+static uint32_t daklakwl_learn_get(struct daklakwl_learn const *learn,
+				   uint64_t key)
+{
+	if (learn->table_cap == 0)
+		return 0;
+	return daklakwl_learn_find(learn->table, learn->table_cap, key)->count;
+}
+
+static int daklakwl_learn_record_compare(void const *_a, void const *_b)
+{
+	struct daklakwl_learn_record const *a = _a;
+	struct daklakwl_learn_record const *b = _b;
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+static bool daklakwl_learn_write_all(int fd, void const *data, size_t size)
+{
+	char const *p = data;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Maps a log or snapshot file. Returns the records after the header, or
+// NULL when the file is missing or not the expected kind.
+static struct daklakwl_learn_record const *
+daklakwl_learn_map(char const *path, char const *magic, void **map,
+		   size_t *size, uint64_t *generation, size_t *count)
+{
+	*map = NULL;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) == -1
+	    || (size_t)st.st_size < sizeof(struct daklakwl_learn_header)) {
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	*map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (*map == MAP_FAILED) {
+		*map = NULL;
+		return NULL;
+	}
+	struct daklakwl_learn_header const *header = *map;
+	if (memcmp(header->magic, magic, 4) != 0
+	    || header->version != DAKLAKWL_LEARN_VERSION) {
+		fprintf(stderr, "%s: not a daklak learning file, ignoring\n",
+			path);
+		munmap(*map, *size);
+		*map = NULL;
+		return NULL;
+	}
+	*generation = header->generation;
+	// A torn tail from a crash mid-append is dropped.
+	*count = (*size - sizeof *header)
+		 / sizeof(struct daklakwl_learn_record);
+	return (struct daklakwl_learn_record const *)(header + 1);
+}
+
+static int daklakwl_learn_create(char const *path, char const *magic,
+				 uint64_t generation, size_t count)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return -1;
+	struct daklakwl_learn_header header = {
+	    .version = DAKLAKWL_LEARN_VERSION,
+	    .generation = generation,
+	    .count = count,
+	};
+	memcpy(header.magic, magic, 4);
+	if (!daklakwl_learn_write_all(fd, &header, sizeof header)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Folds the log into a new snapshot. The snapshot records the log
+// generation it includes, so a crash before the log is replaced cannot
+// count the same records twice. The next log is ready before the
+// snapshot goes in place: from then on the current one is part of the
+// snapshot and must not be appended to. Returns the log to append to,
+// -1 if there is none.
+static int daklakwl_learn_compact(struct daklakwl_learn *learn, int log_fd,
+				  uint64_t *log_generation)
+{
+	char log_tmp_path[PATH_MAX];
+	snprintf(log_tmp_path, sizeof log_tmp_path, "%s.tmp", learn->log_path);
+	int new_fd = daklakwl_learn_create(
+	    log_tmp_path, DAKLAKWL_LEARN_LOG_MAGIC, *log_generation + 1, 0);
+	if (new_fd == -1 || fsync(new_fd) == -1) {
+		perror("learning log");
+		if (new_fd != -1)
+			close(new_fd);
+		unlink(log_tmp_path);
+		return log_fd;
+	}
+
+	void *snapshot_map, *log_map;
+	size_t snapshot_size, log_size, snapshot_len = 0, log_len = 0;
+	uint64_t snapshot_generation = 0, generation;
+	struct daklakwl_learn_record const *snapshot = daklakwl_learn_map(
+	    learn->snapshot_path, DAKLAKWL_LEARN_SNAPSHOT_MAGIC, &snapshot_map,
+	    &snapshot_size, &snapshot_generation, &snapshot_len);
+	struct daklakwl_learn_record const *log = daklakwl_learn_map(
+	    learn->log_path, DAKLAKWL_LEARN_LOG_MAGIC, &log_map, &log_size,
+	    &generation, &log_len);
+
+	struct daklakwl_learn_record *sorted
+	    = malloc((log_len ? log_len : 1) * sizeof *sorted);
+	if (sorted != NULL) {
+		memcpy(sorted, log, log_len * sizeof *sorted);
+		qsort(sorted, log_len, sizeof *sorted,
+		      daklakwl_learn_record_compare);
+	}
+
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof tmp_path, "%s.tmp", learn->snapshot_path);
+	int fd = sorted == NULL
+		     ? -1
+		     : daklakwl_learn_create(tmp_path,
+					     DAKLAKWL_LEARN_SNAPSHOT_MAGIC,
+					     *log_generation, 0);
+	size_t written = 0;
+	bool ok = fd != -1;
+	size_t i = 0, j = 0;
+	while (ok && (i < snapshot_len || j < log_len)) {
+		struct daklakwl_learn_record out;
+		if (j == log_len
+		    || (i < snapshot_len && snapshot[i].key < sorted[j].key))
+			out = snapshot[i++];
+		else {
+			out = sorted[j++];
+			while (j < log_len && sorted[j].key == out.key)
+				out.count = daklakwl_learn_sum(
+				    out.count, sorted[j++].count);
+			if (i < snapshot_len && snapshot[i].key == out.key)
+				out.count = daklakwl_learn_sum(
+				    out.count, snapshot[i++].count);
+		}
+		ok = daklakwl_learn_write_all(fd, &out, sizeof out);
+		written++;
+	}
+	free(sorted);
+	if (snapshot_map)
+		munmap(snapshot_map, snapshot_size);
+	if (log_map)
+		munmap(log_map, log_size);
+
+	if (ok) {
+		struct daklakwl_learn_header header = {
+		    .version = DAKLAKWL_LEARN_VERSION,
+		    .generation = *log_generation,
+		    .count = written,
+		};
+		memcpy(header.magic, DAKLAKWL_LEARN_SNAPSHOT_MAGIC, 4);
+		ok = pwrite(fd, &header, sizeof header, 0) == sizeof header
+		     && fsync(fd) == 0;
+	}
+	if (fd != -1)
+		close(fd);
+	if (!ok || rename(tmp_path, learn->snapshot_path) == -1) {
+		perror("learning snapshot");
+		unlink(tmp_path);
+		close(new_fd);
+		unlink(log_tmp_path);
+		return log_fd;
+	}
+
+	close(log_fd);
+	if (rename(log_tmp_path, learn->log_path) == -1) {
+		perror("learning log");
+		close(new_fd);
+		unlink(log_tmp_path);
+		return -1;
+	}
+	*log_generation += 1;
+	return new_fd;
+}
+
+// Opens the log for appending, or starts the generation after the
+// snapshot's when there is none or the snapshot already includes it.
+static int daklakwl_learn_open_log(struct daklakwl_learn *learn,
+				   uint64_t *generation)
+{
+	void *snapshot_map;
+	size_t snapshot_size, snapshot_len;
+	uint64_t snapshot_generation = 0;
+	if (daklakwl_learn_map(learn->snapshot_path,
+			       DAKLAKWL_LEARN_SNAPSHOT_MAGIC, &snapshot_map,
+			       &snapshot_size, &snapshot_generation,
+			       &snapshot_len))
+		munmap(snapshot_map, snapshot_size);
+
+	void *map;
+	size_t size, count;
+	if (daklakwl_learn_map(learn->log_path, DAKLAKWL_LEARN_LOG_MAGIC, &map,
+			       &size, generation, &count))
+		munmap(map, size);
+	if (map != NULL && *generation > snapshot_generation) {
+		int fd = open(learn->log_path,
+			      O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (fd != -1) {
+			// Drop a torn tail so appends stay aligned.
+			off_t end = sizeof(struct daklakwl_learn_header)
+				    + count * sizeof(struct daklakwl_learn_record);
+			if (ftruncate(fd, end) == -1)
+				perror("learning log");
+			return fd;
+		}
+	}
+
+	*generation = snapshot_generation + 1;
+	int fd = daklakwl_learn_create(learn->log_path,
+				       DAKLAKWL_LEARN_LOG_MAGIC, *generation, 0);
+	if (fd == -1)
+		return -1;
+	close(fd);
+	return open(learn->log_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+}
+
+static void *daklakwl_learn_writer(void *data)
+{
+	struct daklakwl_learn *learn = data;
+	uint64_t generation;
+	int fd = daklakwl_learn_open_log(learn, &generation);
+	if (fd == -1)
+		perror("learning log");
+	off_t log_size = fd == -1 ? 0 : lseek(fd, 0, SEEK_END);
+
+	struct daklakwl_learn_record *batch = NULL;
+	size_t batch_cap = 0, batch_len;
+
+	pthread_mutex_lock(&learn->lock);
+	for (;;) {
+		bool has_deadline = false;
+		struct timespec deadline;
+		while (learn->running
+		       && learn->pending_len < DAKLAKWL_LEARN_BATCH) {
+			if (learn->pending_len == 0) {
+				has_deadline = false;
+				pthread_cond_wait(&learn->cond, &learn->lock);
+				continue;
+			}
+			if (!has_deadline) {
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				deadline.tv_sec
+				    += DAKLAKWL_LEARN_FLUSH_INTERVAL_MS / 1000;
+				deadline.tv_nsec
+				    += (DAKLAKWL_LEARN_FLUSH_INTERVAL_MS % 1000)
+				       * 1000000;
+				if (deadline.tv_nsec >= 1000000000) {
+					deadline.tv_sec += 1;
+					deadline.tv_nsec -= 1000000000;
+				}
+				has_deadline = true;
+			}
+			if (pthread_cond_timedwait(&learn->cond, &learn->lock,
+						   &deadline)
+			    == ETIMEDOUT)
+				break;
+		}
+
+		// Swap buffers so the commit path can keep appending while
+		// this thread writes.
+		struct daklakwl_learn_record *tmp = learn->pending;
+		learn->pending = batch;
+		batch = tmp;
+		size_t tmp_cap = learn->pending_cap;
+		learn->pending_cap = batch_cap;
+		batch_cap = tmp_cap;
+		batch_len = learn->pending_len;
+		learn->pending_len = 0;
+		bool running = learn->running;
+		pthread_mutex_unlock(&learn->lock);
+
+		if (fd != -1 && batch_len > 0) {
+			size_t size = batch_len * sizeof *batch;
+			if (daklakwl_learn_write_all(fd, batch, size)
+			    && fdatasync(fd) == 0)
+				log_size += size;
+			else
+				perror("learning log");
+		}
+		if (fd != -1 && log_size >= DAKLAKWL_LEARN_COMPACT_SIZE) {
+			fd = daklakwl_learn_compact(learn, fd, &generation);
+			// the old log is in the snapshot, so a fresh one
+			// starts after it
+			if (fd == -1)
+				fd = daklakwl_learn_open_log(learn,
+							     &generation);
+			if (fd == -1)
+				perror("learning log");
+			log_size = fd == -1 ? 0 : lseek(fd, 0, SEEK_END);
+		}
+
+		pthread_mutex_lock(&learn->lock);
+		if (!running && learn->pending_len == 0)
+			break;
+	}
+	pthread_mutex_unlock(&learn->lock);
+
+	free(batch);
+	if (fd != -1)
+		close(fd);
+	return NULL;
+}
+
+static void daklakwl_learn_load(struct daklakwl_learn *learn)
+{
+	void *map;
+	size_t size, len;
+	uint64_t snapshot_generation = 0, log_generation;
+	struct daklakwl_learn_record const *records = daklakwl_learn_map(
+	    learn->snapshot_path, DAKLAKWL_LEARN_SNAPSHOT_MAGIC, &map, &size,
+	    &snapshot_generation, &len);
+	for (size_t i = 0; records && i < len; i++)
+		daklakwl_learn_add(learn, records[i].key, records[i].count);
+	if (map)
+		munmap(map, size);
+
+	records = daklakwl_learn_map(learn->log_path, DAKLAKWL_LEARN_LOG_MAGIC,
+				     &map, &size, &log_generation, &len);
+	if (records && log_generation > snapshot_generation) {
+		for (size_t i = 0; i < len; i++)
+			daklakwl_learn_add(learn, records[i].key,
+					   records[i].count);
+	}
+	if (map)
+		munmap(map, size);
+}
+
+bool daklakwl_learn_init(struct daklakwl_learn *learn, char const *dir)
+{
+	memset(learn, 0, sizeof *learn);
+	char path[PATH_MAX];
+	snprintf(path, sizeof path, "%s/learn.log", dir);
+	learn->log_path = strdup(path);
+	snprintf(path, sizeof path, "%s/learn.snapshot", dir);
+	learn->snapshot_path = strdup(path);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&learn->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&learn->lock, NULL);
+
+	daklakwl_learn_load(learn);
+
+	learn->running = true;
+	if (pthread_create(&learn->thread, NULL, daklakwl_learn_writer, learn)
+	    != 0) {
+		fprintf(stderr, "failed to start learning writer, new words "
+				"will not be saved\n");
+		learn->running = false;
+		return false;
+	}
+	learn->has_thread = true;
+	return true;
+}
+
+void daklakwl_learn_finish(struct daklakwl_learn *learn)
+{
+	if (learn->has_thread) {
+		pthread_mutex_lock(&learn->lock);
+		learn->running = false;
+		pthread_cond_signal(&learn->cond);
+		pthread_mutex_unlock(&learn->lock);
+		pthread_join(learn->thread, NULL);
+	}
+	if (learn->log_path) {
+		pthread_cond_destroy(&learn->cond);
+		pthread_mutex_destroy(&learn->lock);
+	}
+	free(learn->pending);
+	free(learn->table);
+	free(learn->log_path);
+	free(learn->snapshot_path);
+	memset(learn, 0, sizeof *learn);
+}
+
+static void daklakwl_learn_queue(struct daklakwl_learn *learn, uint64_t key)
+{
+	if (learn->pending_len == learn->pending_cap) {
+		size_t cap = learn->pending_cap ? learn->pending_cap * 2 : 64;
+		struct daklakwl_learn_record *pending
+		    = realloc(learn->pending, cap * sizeof *pending);
+		if (pending == NULL) {
+			// still counted in memory, just not saved
+			perror("learning queue");
+			return;
+		}
+		learn->pending = pending;
+		learn->pending_cap = cap;
+	}
+	learn->pending[learn->pending_len++]
+	    = (struct daklakwl_learn_record){.key = key, .count = 1};
+}
+
+void daklakwl_learn_record(struct daklakwl_learn *learn, char const *prev,
+			   char const *word)
+{
+	if (word == NULL || word[0] == '\0')
+		return;
+	uint64_t unigram = daklakwl_learn_unigram_key(word);
+	uint64_t bigram = 0;
+	daklakwl_learn_add(learn, unigram, 1);
+	if (prev && prev[0]) {
+		bigram = daklakwl_learn_bigram_key(prev, word);
+		daklakwl_learn_add(learn, bigram, 1);
+	}
+
+	if (!learn->has_thread)
+		return;
+	pthread_mutex_lock(&learn->lock);
+	daklakwl_learn_queue(learn, unigram);
+	if (bigram)
+		daklakwl_learn_queue(learn, bigram);
+	if (learn->pending_len == 1
+	    || learn->pending_len >= DAKLAKWL_LEARN_BATCH)
+		pthread_cond_signal(&learn->cond);
+	pthread_mutex_unlock(&learn->lock);
+}
+
+uint32_t daklakwl_learn_unigram(struct daklakwl_learn const *learn,
+				char const *word)
+{
+	return daklakwl_learn_get(learn, daklakwl_learn_unigram_key(word));
+}
+
+uint32_t daklakwl_learn_bigram(struct daklakwl_learn const *learn,
+			       char const *prev, char const *word)
+{
+	if (prev == NULL || prev[0] == '\0')
+		return 0;
+	return daklakwl_learn_get(learn,
+				  daklakwl_learn_bigram_key(prev, word));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One count, keyed by a hash of either a word or a (previous word, word)
+// pair. The same record is used in memory, in the log and in the snapshot.
+struct daklakwl_learn_record {
+	uint64_t key;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct daklakwl_learn {
+	// owned by the main thread
+	struct daklakwl_learn_record *table;
+	size_t table_cap;
+	size_t table_len;
+
+	// handed over to the writer thread under lock
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct daklakwl_learn_record *pending;
+	size_t pending_len;
+	size_t pending_cap;
+	bool running;
+
+	pthread_t thread;
+	bool has_thread;
+	char *log_path;
+	char *snapshot_path;
+};
+
+bool daklakwl_learn_init(struct daklakwl_learn *, char const *dir);
+void daklakwl_learn_finish(struct daklakwl_learn *);
+void daklakwl_learn_record(struct daklakwl_learn *, char const *prev,
+			   char const *word);
+uint32_t daklakwl_learn_unigram(struct daklakwl_learn const *,
+				char const *word);
+uint32_t daklakwl_learn_bigram(struct daklakwl_learn const *,
+			       char const *prev, char const *word);
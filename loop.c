@@ -0,0 +1,92 @@
+#include "loop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+bool daklakwl_loop_init(struct daklakwl_loop *loop)
+{
+	memset(loop, 0, sizeof *loop);
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd == -1) {
+		perror("epoll_create1");
+		return false;
+	}
+	return true;
+}
+
+void daklakwl_loop_finish(struct daklakwl_loop *loop)
+{
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+	memset(loop, 0, sizeof *loop);
+	loop->epoll_fd = -1;
+}
+
+bool daklakwl_loop_add(struct daklakwl_loop *loop,
+		       struct daklakwl_event_source *source, int fd,
+		       uint32_t events,
+		       void (*callback)(struct daklakwl_event_source *,
+					uint32_t))
+{
+	source->fd = fd;
+	source->events = events;
+	source->callback = callback;
+	struct epoll_event event = {.events = events, .data.ptr = source};
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		perror("epoll_ctl add");
+		return false;
+	}
+	return true;
+}
+
+bool daklakwl_loop_modify(struct daklakwl_loop *loop,
+			  struct daklakwl_event_source *source,
+			  uint32_t events)
+{
+	if (source->events == events)
+		return true;
+	source->events = events;
+	struct epoll_event event = {.events = events, .data.ptr = source};
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event)
+	    == -1) {
+		perror("epoll_ctl mod");
+		return false;
+	}
+	return true;
+}
+
+void daklakwl_loop_remove(struct daklakwl_loop *loop,
+			  struct daklakwl_event_source *source)
+{
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	// The owner may be freed right after this, so drop any event for it
+	// that is still waiting in the current batch.
+	for (int i = loop->ready_pos; i < loop->ready_len; i++) {
+		if (loop->ready[i].data.ptr == source)
+			loop->ready[i].data.ptr = NULL;
+	}
+}
+
+int daklakwl_loop_dispatch(struct daklakwl_loop *loop, int timeout)
+{
+	int ready = epoll_wait(loop->epoll_fd, loop->ready,
+			       DAKLAKWL_LOOP_MAX_EVENTS, timeout);
+	if (ready == -1) {
+		if (errno == EINTR)
+			return 0;
+		perror("epoll_wait");
+		return -1;
+	}
+	loop->wakeups++;
+	loop->ready_len = ready;
+	for (loop->ready_pos = 0; loop->ready_pos < ready;) {
+		struct epoll_event *event = &loop->ready[loop->ready_pos++];
+		struct daklakwl_event_source *source = event->data.ptr;
+		if (source != NULL)
+			source->callback(source, event->events);
+	}
+	loop->ready_len = loop->ready_pos = 0;
+	return ready;
+}
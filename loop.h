@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define DAKLAKWL_LOOP_MAX_EVENTS 32
+
+// A file descriptor watched by the loop. Embed it in the owning struct
+// and get back to the owner with wl_container_of, like timers.
+struct daklakwl_event_source {
+	int fd;
+	uint32_t events;
+	void (*callback)(struct daklakwl_event_source *source, uint32_t events);
+};
+
+// epoll-based loop: registering a source is O(1) and a wakeup only costs
+// the sources that are ready.
+struct daklakwl_loop {
+	int epoll_fd;
+	struct epoll_event ready[DAKLAKWL_LOOP_MAX_EVENTS];
+	int ready_len, ready_pos;
+	uint64_t wakeups;
+};
+
+bool daklakwl_loop_init(struct daklakwl_loop *);
+void daklakwl_loop_finish(struct daklakwl_loop *);
+bool daklakwl_loop_add(struct daklakwl_loop *, struct daklakwl_event_source *,
+		       int fd, uint32_t events,
+		       void (*callback)(struct daklakwl_event_source *,
+					uint32_t));
+bool daklakwl_loop_modify(struct daklakwl_loop *,
+			  struct daklakwl_event_source *, uint32_t events);
+// Stops watching source. Its fd stays open and is still the caller's to
+// close.
+void daklakwl_loop_remove(struct daklakwl_loop *,
+			  struct daklakwl_event_source *);
+int daklakwl_loop_dispatch(struct daklakwl_loop *, int timeout);
@@ -0,0 +1,215 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Only the owning thread writes a block, with relaxed load and store
+// pairs that compile to plain moves; other threads only read it.
+struct daklakwl_metrics_block {
+	struct daklakwl_metrics_block *next;
+	_Atomic uint64_t counters[_DAKLAKWL_COUNTER_LAST];
+	struct {
+		_Atomic uint64_t count, max;
+		_Atomic uint64_t buckets[DAKLAKWL_HISTOGRAM_BUCKETS];
+	} histograms[_DAKLAKWL_HISTOGRAM_LAST];
+};
+
+static char const *const daklakwl_counter_names[_DAKLAKWL_COUNTER_LAST] = {
+    [DAKLAKWL_COUNTER_KEYS] = "keys",
+    [DAKLAKWL_COUNTER_REPEAT_TICKS] = "repeat_ticks",
+    [DAKLAKWL_COUNTER_PREEDITS] = "preedits",
+    [DAKLAKWL_COUNTER_PREEDIT_BYTES] = "preedit_bytes",
+    [DAKLAKWL_COUNTER_COMMITS] = "commits",
+    [DAKLAKWL_COUNTER_COMMIT_BYTES] = "commit_bytes",
+    [DAKLAKWL_COUNTER_IM_COMMITS] = "im_commits",
+    [DAKLAKWL_COUNTER_KEYMAP_COMPILES] = "keymap_compiles",
+    [DAKLAKWL_COUNTER_GLYPHS] = "glyphs_rasterized",
+    [DAKLAKWL_COUNTER_CLIENTS_ACCEPTED] = "clients_accepted",
+    [DAKLAKWL_COUNTER_CLIENTS_CLOSED] = "clients_closed",
+    [DAKLAKWL_COUNTER_CONFIG_RELOADS] = "config_reloads",
+};
+
+static char const *const daklakwl_histogram_names[_DAKLAKWL_HISTOGRAM_LAST]
+    = {
+	[DAKLAKWL_HISTOGRAM_KEY] = "key_ns",
+	[DAKLAKWL_HISTOGRAM_COMPOSE] = "compose_ns",
+	[DAKLAKWL_HISTOGRAM_GRAB] = "grab_ns",
+};
+
+// Blocks of threads that exited stay on the list so their counts are not
+// lost; there are only ever a handful of threads.
+static pthread_mutex_t daklakwl_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct daklakwl_metrics_block *daklakwl_metrics_blocks;
+static _Thread_local struct daklakwl_metrics_block *daklakwl_metrics_block;
+
+static struct daklakwl_metrics_block *daklakwl_metrics_thread_block(void)
+{
+	struct daklakwl_metrics_block *block = daklakwl_metrics_block;
+	if (block != NULL)
+		return block;
+	block = calloc(1, sizeof *block);
+	if (block == NULL)
+		return NULL;
+	pthread_mutex_lock(&daklakwl_metrics_lock);
+	block->next = daklakwl_metrics_blocks;
+	daklakwl_metrics_blocks = block;
+	pthread_mutex_unlock(&daklakwl_metrics_lock);
+	daklakwl_metrics_block = block;
+	return block;
+}
+
+static inline void daklakwl_metrics_add(_Atomic uint64_t *value, uint64_t n)
+{
+	atomic_store_explicit(
+	    value, atomic_load_explicit(value, memory_order_relaxed) + n,
+	    memory_order_relaxed);
+}
+
+uint64_t daklakwl_metrics_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void daklakwl_metrics_count(enum daklakwl_counter counter, uint64_t n)
+{
+	struct daklakwl_metrics_block *block = daklakwl_metrics_thread_block();
+	if (block != NULL)
+		daklakwl_metrics_add(&block->counters[counter], n);
+}
+
+static size_t daklakwl_histogram_bucket(uint64_t value)
+{
+	if (value < (1 << DAKLAKWL_HISTOGRAM_SUB_BITS))
+		return value;
+	int exponent = 63 - __builtin_clzll(value);
+	int shift = exponent - DAKLAKWL_HISTOGRAM_SUB_BITS;
+	size_t sub = (value >> shift) & ((1 << DAKLAKWL_HISTOGRAM_SUB_BITS) - 1);
+	return ((size_t)(shift + 1) << DAKLAKWL_HISTOGRAM_SUB_BITS) + sub;
+}
+
+// largest value that lands in a bucket
+static uint64_t daklakwl_histogram_bucket_value(size_t bucket)
+{
+	if (bucket < (1 << DAKLAKWL_HISTOGRAM_SUB_BITS))
+		return bucket;
+	int shift = (bucket >> DAKLAKWL_HISTOGRAM_SUB_BITS) - 1;
+	uint64_t sub = bucket & ((1 << DAKLAKWL_HISTOGRAM_SUB_BITS) - 1);
+	uint64_t base = ((1 << DAKLAKWL_HISTOGRAM_SUB_BITS) + sub) << shift;
+	return base + ((uint64_t)1 << shift) - 1;
+}
+
+void daklakwl_metrics_record(enum daklakwl_histogram histogram, uint64_t ns)
+{
+	struct daklakwl_metrics_block *block = daklakwl_metrics_thread_block();
+	if (block == NULL)
+		return;
+	daklakwl_metrics_add(&block->histograms[histogram].count, 1);
+	daklakwl_metrics_add(
+	    &block->histograms[histogram].buckets[daklakwl_histogram_bucket(ns)],
+	    1);
+	if (ns > atomic_load_explicit(&block->histograms[histogram].max,
+				      memory_order_relaxed))
+		atomic_store_explicit(&block->histograms[histogram].max, ns,
+				      memory_order_relaxed);
+}
+
+void daklakwl_metrics_snapshot(struct daklakwl_metrics_snapshot *snapshot)
+{
+	memset(snapshot, 0, sizeof *snapshot);
+	pthread_mutex_lock(&daklakwl_metrics_lock);
+	for (struct daklakwl_metrics_block *block = daklakwl_metrics_blocks;
+	     block != NULL; block = block->next) {
+		for (int i = 0; i < _DAKLAKWL_COUNTER_LAST; i++)
+			snapshot->counters[i] += atomic_load_explicit(
+			    &block->counters[i], memory_order_relaxed);
+		for (int i = 0; i < _DAKLAKWL_HISTOGRAM_LAST; i++) {
+			struct daklakwl_histogram_snapshot *histogram
+			    = &snapshot->histograms[i];
+			histogram->count += atomic_load_explicit(
+			    &block->histograms[i].count, memory_order_relaxed);
+			uint64_t max = atomic_load_explicit(
+			    &block->histograms[i].max, memory_order_relaxed);
+			if (max > histogram->max)
+				histogram->max = max;
+			for (size_t j = 0; j < DAKLAKWL_HISTOGRAM_BUCKETS; j++)
+				histogram->buckets[j] += atomic_load_explicit(
+				    &block->histograms[i].buckets[j],
+				    memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&daklakwl_metrics_lock);
+}
+
+uint64_t
+daklakwl_histogram_percentile(struct daklakwl_histogram_snapshot const *histogram,
+			      double percentile)
+{
+	// the count may run ahead of the buckets in a snapshot taken while
+	// another thread records, so go by the buckets alone
+	uint64_t total = 0;
+	for (size_t i = 0; i < DAKLAKWL_HISTOGRAM_BUCKETS; i++)
+		total += histogram->buckets[i];
+	if (total == 0)
+		return 0;
+	uint64_t rank = (uint64_t)(total * percentile / 100.0);
+	if (rank >= total)
+		rank = total - 1;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < DAKLAKWL_HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank) {
+			uint64_t value = daklakwl_histogram_bucket_value(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+// "name value" lines, as the control socket's stats reply carries them
+size_t daklakwl_metrics_format(char *buffer, size_t size)
+{
+	struct daklakwl_metrics_snapshot *snapshot = malloc(sizeof *snapshot);
+	if (snapshot == NULL)
+		return 0;
+	daklakwl_metrics_snapshot(snapshot);
+	size_t len = 0;
+#define APPEND(...)                                                            \
+	do {                                                                   \
+		int n = snprintf(buffer + len, size - len, __VA_ARGS__);       \
+		if (n < 0 || (size_t)n >= size - len)                          \
+			goto out;                                              \
+		len += n;                                                      \
+	} while (0)
+	for (int i = 0; i < _DAKLAKWL_COUNTER_LAST; i++)
+		APPEND("%s %llu\n", daklakwl_counter_names[i],
+		       (unsigned long long)snapshot->counters[i]);
+	for (int i = 0; i < _DAKLAKWL_HISTOGRAM_LAST; i++) {
+		struct daklakwl_histogram_snapshot *histogram
+		    = &snapshot->histograms[i];
+		char const *name = daklakwl_histogram_names[i];
+		APPEND("%s_count %llu\n", name,
+		       (unsigned long long)histogram->count);
+		APPEND("%s_p50 %llu\n", name,
+		       (unsigned long long)daklakwl_histogram_percentile(
+			   histogram, 50));
+		APPEND("%s_p90 %llu\n", name,
+		       (unsigned long long)daklakwl_histogram_percentile(
+			   histogram, 90));
+		APPEND("%s_p99 %llu\n", name,
+		       (unsigned long long)daklakwl_histogram_percentile(
+			   histogram, 99));
+		APPEND("%s_max %llu\n", name,
+		       (unsigned long long)histogram->max);
+	}
+#undef APPEND
+out:
+	free(snapshot);
+	return len;
+}
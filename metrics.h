@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Always-on counters and latency histograms. Each thread records into a
+// block of its own, so recording is a couple of plain stores with no lock
+// or locked instruction; a snapshot adds the blocks of every thread up.
+
+enum daklakwl_counter {
+	DAKLAKWL_COUNTER_KEYS,
+	DAKLAKWL_COUNTER_REPEAT_TICKS,
+	DAKLAKWL_COUNTER_PREEDITS,
+	DAKLAKWL_COUNTER_PREEDIT_BYTES,
+	DAKLAKWL_COUNTER_COMMITS,
+	DAKLAKWL_COUNTER_COMMIT_BYTES,
+	DAKLAKWL_COUNTER_IM_COMMITS,
+	DAKLAKWL_COUNTER_KEYMAP_COMPILES,
+	DAKLAKWL_COUNTER_GLYPHS,
+	DAKLAKWL_COUNTER_CLIENTS_ACCEPTED,
+	DAKLAKWL_COUNTER_CLIENTS_CLOSED,
+	DAKLAKWL_COUNTER_CONFIG_RELOADS,
+	_DAKLAKWL_COUNTER_LAST,
+};
+
+enum daklakwl_histogram {
+	// key event received to handled, in nanoseconds
+	DAKLAKWL_HISTOGRAM_KEY,
+	// one key fed to the typing method
+	DAKLAKWL_HISTOGRAM_COMPOSE,
+	// keyboard grab requested to its keymap received
+	DAKLAKWL_HISTOGRAM_GRAB,
+	_DAKLAKWL_HISTOGRAM_LAST,
+};
+
+// Log-linear buckets: eight per power of two, so any value lands in a
+// bucket within 12.5% of it, from nanoseconds up to centuries.
+#define DAKLAKWL_HISTOGRAM_SUB_BITS 3
+#define DAKLAKWL_HISTOGRAM_BUCKETS                                             \
+	((64 - DAKLAKWL_HISTOGRAM_SUB_BITS + 1) << DAKLAKWL_HISTOGRAM_SUB_BITS)
+
+struct daklakwl_histogram_snapshot {
+	uint64_t count, max;
+	uint64_t buckets[DAKLAKWL_HISTOGRAM_BUCKETS];
+};
+
+struct daklakwl_metrics_snapshot {
+	uint64_t counters[_DAKLAKWL_COUNTER_LAST];
+	struct daklakwl_histogram_snapshot histograms[_DAKLAKWL_HISTOGRAM_LAST];
+};
+
+uint64_t daklakwl_metrics_now(void);
+void daklakwl_metrics_count(enum daklakwl_counter, uint64_t n);
+void daklakwl_metrics_record(enum daklakwl_histogram, uint64_t ns);
+void daklakwl_metrics_snapshot(struct daklakwl_metrics_snapshot *);
+uint64_t
+daklakwl_histogram_percentile(struct daklakwl_histogram_snapshot const *,
+			      double percentile);
+size_t daklakwl_metrics_format(char *buffer, size_t size);
@@ -0,0 +1,352 @@
+#include "popup.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input-method-unstable-v2-client-protocol.h"
+
+#include "daklakwl.h"
+#include "font.h"
+
+#define DAKLAKWL_POPUP_PADDING 4
+#define DAKLAKWL_POPUP_WIDTH_STEP 64
+#define DAKLAKWL_POPUP_BACKGROUND 0xff282828
+#define DAKLAKWL_POPUP_FOREGROUND 0xffeeeeee
+#define DAKLAKWL_POPUP_HINT 0xff9e9e9e
+#define DAKLAKWL_POPUP_EMPTY_ROW 1
+
+struct daklakwl_popup_row {
+	char const *text;
+	uint32_t color;
+};
+
+static uint64_t daklakwl_popup_row_hash(struct daklakwl_popup_row const *row)
+{
+	if (row->text == NULL)
+		return DAKLAKWL_POPUP_EMPTY_ROW;
+	uint64_t hash = 0xcbf29ce484222325ULL ^ row->color;
+	for (char const *c = row->text; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash > DAKLAKWL_POPUP_EMPTY_ROW ? hash : hash + 2;
+}
+
+static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct daklakwl_popup *popup = data;
+	for (size_t i = 0; i < 2; i++) {
+		if (popup->buffers[i].wl_buffer == wl_buffer)
+			popup->buffers[i].busy = false;
+	}
+	if (popup->dirty)
+		daklakwl_popup_update(popup);
+}
+
+static struct wl_buffer_listener const wl_buffer_listener = {
+    .release = wl_buffer_release,
+};
+
+static void daklakwl_popup_destroy_buffers(struct daklakwl_popup *popup)
+{
+	for (size_t i = 0; i < 2; i++) {
+		struct daklakwl_popup_buffer *buffer = &popup->buffers[i];
+		if (buffer->wl_buffer)
+			wl_buffer_destroy(buffer->wl_buffer);
+		memset(buffer, 0, sizeof *buffer);
+	}
+	popup->front = NULL;
+}
+
+// Sizes the pool for two buffers of the given geometry. The pool only
+// grows, so steady typing never reallocates shared memory.
+static bool daklakwl_popup_resize(struct daklakwl_popup *popup, int width,
+				  int height)
+{
+	struct daklakwl_state *state = popup->seat->state;
+	int stride = width * 4;
+	size_t size = (size_t)stride * height * 2;
+	if (size > popup->size) {
+		if (popup->fd == -1) {
+			popup->fd = memfd_create("daklak-popup",
+						 MFD_CLOEXEC | MFD_ALLOW_SEALING);
+			if (popup->fd == -1) {
+				perror("memfd_create");
+				return false;
+			}
+		}
+		if (ftruncate(popup->fd, size) == -1) {
+			perror("ftruncate");
+			return false;
+		}
+		if (popup->data)
+			munmap(popup->data, popup->size);
+		popup->data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, popup->fd, 0);
+		if (popup->data == MAP_FAILED) {
+			perror("mmap");
+			popup->data = NULL;
+			popup->size = 0;
+			return false;
+		}
+		if (popup->wl_shm_pool) {
+			wl_shm_pool_resize(popup->wl_shm_pool, size);
+		}
+		else {
+			popup->wl_shm_pool
+			    = wl_shm_create_pool(state->wl_shm, popup->fd, size);
+			// buffers made from the pool inherit the queue
+			wl_proxy_set_queue((struct wl_proxy *)popup->wl_shm_pool,
+					   popup->seat->queue);
+		}
+		popup->size = size;
+	}
+
+	daklakwl_popup_destroy_buffers(popup);
+	popup->width = width;
+	popup->height = height;
+	popup->stride = stride;
+	for (size_t i = 0; i < 2; i++) {
+		struct daklakwl_popup_buffer *buffer = &popup->buffers[i];
+		size_t offset = (size_t)stride * height * i;
+		buffer->wl_buffer = wl_shm_pool_create_buffer(
+		    popup->wl_shm_pool, offset, width, height, stride,
+		    WL_SHM_FORMAT_ARGB8888);
+		wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener,
+				       popup);
+		buffer->data = (uint32_t *)((char *)popup->data + offset);
+	}
+	return true;
+}
+
+static void daklakwl_popup_draw_row(struct daklakwl_popup *popup,
+				    struct daklakwl_popup_buffer *buffer,
+				    size_t i,
+				    struct daklakwl_popup_row const *row)
+{
+	struct daklakwl_state *state = popup->seat->state;
+	int y = i * popup->row_height;
+	uint32_t fill = row->text ? DAKLAKWL_POPUP_BACKGROUND : 0;
+	for (int py = y; py < y + popup->row_height; py++) {
+		uint32_t *line = buffer->data + py * (popup->stride / 4);
+		for (int px = 0; px < popup->width; px++)
+			line[px] = fill;
+	}
+	if (row->text == NULL)
+		return;
+	int padding = DAKLAKWL_POPUP_PADDING * popup->scale;
+	uint32_t *origin = buffer->data + y * (popup->stride / 4);
+	daklakwl_atlas_draw(&state->atlas, &state->font, origin, popup->stride,
+			    popup->width, popup->row_height, padding, padding,
+			    row->text, row->color);
+}
+
+static void daklakwl_popup_hide(struct daklakwl_popup *popup)
+{
+	if (!popup->visible)
+		return;
+	wl_surface_attach(popup->wl_surface, NULL, 0, 0);
+	wl_surface_commit(popup->wl_surface);
+	popup->visible = false;
+	popup->front = NULL;
+}
+
+void daklakwl_popup_update(struct daklakwl_popup *popup)
+{
+	struct daklakwl_seat *seat = popup->seat;
+	struct daklakwl_state *state = seat->state;
+	popup->dirty = false;
+	if (popup->wl_surface == NULL || state->font.ft_face == NULL)
+		return;
+	if (!seat->active || !seat->is_composing || seat->buffer.len == 0) {
+		daklakwl_popup_hide(popup);
+		return;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	char keys[DAKLAKWL_WORD_MAX];
+	if (!daklakwl_word_get(&seat->buffer, seat->buffer.raw, keys))
+		snprintf(keys, sizeof keys, "%s", seat->buffer.raw);
+	struct daklakwl_popup_row rows[DAKLAKWL_POPUP_ROWS] = {
+	    {.text = keys, .color = DAKLAKWL_POPUP_HINT},
+	};
+	for (size_t i = 0; i < seat->candidates_len; i++) {
+		rows[i + 1].text = seat->candidates[i].text;
+		rows[i + 1].color = DAKLAKWL_POPUP_FOREGROUND;
+	}
+
+	struct daklakwl_font *font = &state->font;
+	if (font->scale != popup->scale)
+		daklakwl_font_set_scale(font, popup->scale);
+	int padding = DAKLAKWL_POPUP_PADDING * popup->scale;
+	int row_height = font->height + 2 * padding;
+	int width = 0;
+	for (size_t i = 0; i < DAKLAKWL_POPUP_ROWS && rows[i].text; i++)
+		width = max(width, daklakwl_atlas_measure(&state->atlas, font,
+							  rows[i].text));
+	int step = DAKLAKWL_POPUP_WIDTH_STEP * popup->scale;
+	width = (width + 2 * padding + step - 1) / step * step;
+
+	// Keep the geometry while the popup is up so buffers are reused;
+	// unused rows are drawn transparent instead of shrinking.
+	if (popup->visible && popup->row_height == row_height)
+		width = max(width, popup->width);
+	if (width != popup->width || row_height != popup->row_height
+	    || popup->buffers[0].wl_buffer == NULL) {
+		popup->row_height = row_height;
+		if (!daklakwl_popup_resize(popup, width,
+					   row_height * DAKLAKWL_POPUP_ROWS))
+			return;
+	}
+
+	struct daklakwl_popup_buffer *back = &popup->buffers[0];
+	if (back == popup->front || back->busy)
+		back = &popup->buffers[1];
+	if (back == popup->front || back->busy) {
+		popup->dirty = true;
+		return;
+	}
+
+	for (size_t i = 0; i < DAKLAKWL_POPUP_ROWS; i++) {
+		uint64_t hash = daklakwl_popup_row_hash(&rows[i]);
+		if (back->rows[i] != hash) {
+			daklakwl_popup_draw_row(popup, back, i, &rows[i]);
+			back->rows[i] = hash;
+		}
+		if (popup->front == NULL || popup->front->rows[i] != hash)
+			wl_surface_damage_buffer(popup->wl_surface, 0,
+						 i * row_height, popup->width,
+						 row_height);
+	}
+
+	wl_surface_set_buffer_scale(popup->wl_surface, popup->scale);
+	wl_surface_attach(popup->wl_surface, back->wl_buffer, 0, 0);
+	wl_surface_commit(popup->wl_surface);
+	back->busy = true;
+	popup->front = back;
+	popup->visible = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	uint64_t ns = (end.tv_sec - start.tv_sec) * 1000000000ULL
+		      + end.tv_nsec - start.tv_nsec;
+	popup->redraws++;
+	popup->redraw_ns += ns;
+	popup->redraw_max_ns = max(popup->redraw_max_ns, ns);
+}
+
+static void daklakwl_popup_update_scale(struct daklakwl_popup *popup)
+{
+	int scale = 1;
+	struct daklakwl_output **output;
+	wl_array_for_each(output, &popup->outputs)
+	{
+		scale = max(scale, (*output)->scale);
+	}
+	if (scale == popup->scale)
+		return;
+	popup->scale = scale;
+	if (popup->visible)
+		daklakwl_popup_update(popup);
+}
+
+void wl_surface_enter(void *data, struct wl_surface *wl_surface,
+		      struct wl_output *wl_output)
+{
+	struct daklakwl_popup *popup = data;
+	struct daklakwl_output *output = wl_output_get_user_data(wl_output);
+	if (output == NULL)
+		return;
+	*(struct daklakwl_output **)wl_array_add(&popup->outputs,
+						 sizeof output)
+	    = output;
+	daklakwl_popup_update_scale(popup);
+}
+
+void wl_surface_leave(void *data, struct wl_surface *wl_surface,
+		      struct wl_output *wl_output)
+{
+	struct daklakwl_popup *popup = data;
+	struct daklakwl_output **output;
+	size_t len = popup->outputs.size / sizeof *output;
+	struct daklakwl_output **outputs = popup->outputs.data;
+	for (size_t i = 0; i < len; i++) {
+		if (outputs[i]->wl_output == wl_output) {
+			outputs[i] = outputs[len - 1];
+			popup->outputs.size -= sizeof *output;
+			break;
+		}
+	}
+	daklakwl_popup_update_scale(popup);
+}
+
+struct wl_surface_listener const wl_surface_listener = {
+    .enter = wl_surface_enter,
+    .leave = wl_surface_leave,
+};
+
+void zwp_input_popup_surface_v2_text_input_rectangle(
+    void *data, struct zwp_input_popup_surface_v2 *zwp_input_popup_surface_v2,
+    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	// The compositor places the popup next to this rectangle already.
+}
+
+struct zwp_input_popup_surface_v2_listener const
+    zwp_input_popup_surface_v2_listener
+    = {
+	.text_input_rectangle
+	= zwp_input_popup_surface_v2_text_input_rectangle,
+};
+
+void daklakwl_popup_init(struct daklakwl_popup *popup,
+			 struct daklakwl_seat *seat)
+{
+	memset(popup, 0, sizeof *popup);
+	popup->seat = seat;
+	popup->fd = -1;
+	popup->scale = 1;
+	wl_array_init(&popup->outputs);
+	if (seat->state->font.ft_face == NULL)
+		return;
+	popup->wl_surface
+	    = wl_compositor_create_surface(seat->state->wl_compositor);
+	wl_proxy_set_queue((struct wl_proxy *)popup->wl_surface, seat->queue);
+	wl_surface_add_listener(popup->wl_surface, &wl_surface_listener,
+				popup);
+	popup->zwp_input_popup_surface_v2
+	    = zwp_input_method_v2_get_input_popup_surface(
+		seat->zwp_input_method_v2, popup->wl_surface);
+	zwp_input_popup_surface_v2_add_listener(
+	    popup->zwp_input_popup_surface_v2,
+	    &zwp_input_popup_surface_v2_listener, popup);
+}
+
+void daklakwl_popup_finish(struct daklakwl_popup *popup)
+{
+	if (popup->redraws)
+		fprintf(stderr,
+			"popup: %llu redraws, avg %llu us, max %llu us\n",
+			(unsigned long long)popup->redraws,
+			(unsigned long long)(popup->redraw_ns / popup->redraws
+					     / 1000),
+			(unsigned long long)(popup->redraw_max_ns / 1000));
+	daklakwl_popup_destroy_buffers(popup);
+	if (popup->wl_shm_pool)
+		wl_shm_pool_destroy(popup->wl_shm_pool);
+	if (popup->data)
+		munmap(popup->data, popup->size);
+	if (popup->fd != -1)
+		close(popup->fd);
+	if (popup->zwp_input_popup_surface_v2)
+		zwp_input_popup_surface_v2_destroy(
+		    popup->zwp_input_popup_surface_v2);
+	if (popup->wl_surface)
+		wl_surface_destroy(popup->wl_surface);
+	wl_array_release(&popup->outputs);
+	memset(popup, 0, sizeof *popup);
+	popup->fd = -1;
+}
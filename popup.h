@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#include "dict.h"
+
+#define DAKLAKWL_POPUP_ROWS (1 + DAKLAKWL_DICT_TOPK)
+
+struct daklakwl_seat;
+
+struct daklakwl_popup_buffer {
+	struct wl_buffer *wl_buffer;
+	uint32_t *data;
+	bool busy;
+	// what each row of this buffer currently shows, 0 if unknown
+	uint64_t rows[DAKLAKWL_POPUP_ROWS];
+};
+
+// Candidate window next to the text cursor. Both buffers live in one
+// wl_shm pool that only grows, and a redraw touches just the rows whose
+// content changed.
+struct daklakwl_popup {
+	struct daklakwl_seat *seat;
+	struct wl_surface *wl_surface;
+	struct zwp_input_popup_surface_v2 *zwp_input_popup_surface_v2;
+	struct wl_shm_pool *wl_shm_pool;
+	int fd;
+	void *data;
+	size_t size;
+	int width, height, stride, row_height, scale;
+	struct daklakwl_popup_buffer buffers[2];
+	struct daklakwl_popup_buffer *front;
+	struct wl_array outputs;
+	bool visible, dirty;
+	// time spent in daklakwl_popup_update per redraw
+	uint64_t redraws, redraw_ns, redraw_max_ns;
+};
+
+void daklakwl_popup_init(struct daklakwl_popup *, struct daklakwl_seat *);
+void daklakwl_popup_finish(struct daklakwl_popup *);
+void daklakwl_popup_update(struct daklakwl_popup *);
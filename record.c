@@ -0,0 +1,161 @@
+#include "record.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// keymaps are some tens of kilobytes, anything far larger is corrupt
+#define DAKLAKWL_RECORD_MAX_KEYMAP (16 * 1024 * 1024)
+
+static void daklakwl_record_write_varint(FILE *file, uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t len = 0;
+	do {
+		bytes[len] = value & 0x7f;
+		value >>= 7;
+		if (value != 0)
+			bytes[len] |= 0x80;
+		len++;
+	} while (value != 0);
+	fwrite(bytes, 1, len, file);
+}
+
+static bool daklakwl_record_read_varint(FILE *file, uint64_t *value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int byte = getc(file);
+		if (byte == EOF)
+			return false;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static bool daklakwl_record_read_u32(FILE *file, uint32_t *value)
+{
+	uint64_t wide;
+	if (!daklakwl_record_read_varint(file, &wide) || wide > UINT32_MAX)
+		return false;
+	*value = wide;
+	return true;
+}
+
+bool daklakwl_recorder_open(struct daklakwl_recorder *recorder,
+			    char const *path)
+{
+	// the keys spell out what was typed, only the user may read them
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+		      0600);
+	recorder->file = fd == -1 ? NULL : fdopen(fd, "w");
+	if (recorder->file == NULL) {
+		perror(path);
+		if (fd != -1)
+			close(fd);
+		return false;
+	}
+	fputs(DAKLAKWL_RECORD_MAGIC, recorder->file);
+	recorder->last = 0;
+	return true;
+}
+
+void daklakwl_recorder_close(struct daklakwl_recorder *recorder)
+{
+	if (recorder->file == NULL)
+		return;
+	if (fclose(recorder->file) != 0)
+		perror("recording");
+	recorder->file = NULL;
+}
+
+static void daklakwl_recorder_begin(struct daklakwl_recorder *recorder,
+				    enum daklakwl_record_type type,
+				    uint32_t seat)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+	// the first event starts the clock
+	uint64_t delta = recorder->last ? us - recorder->last : 0;
+	recorder->last = us;
+	putc(type, recorder->file);
+	daklakwl_record_write_varint(recorder->file, seat);
+	daklakwl_record_write_varint(recorder->file, delta);
+}
+
+void daklakwl_recorder_keymap(struct daklakwl_recorder *recorder,
+			      uint32_t seat, char const *data, uint32_t size)
+{
+	daklakwl_recorder_begin(recorder, DAKLAKWL_RECORD_KEYMAP, seat);
+	daklakwl_record_write_varint(recorder->file, size);
+	fwrite(data, 1, size, recorder->file);
+}
+
+void daklakwl_recorder_key(struct daklakwl_recorder *recorder, uint32_t seat,
+			   uint32_t key, uint32_t state)
+{
+	daklakwl_recorder_begin(recorder, DAKLAKWL_RECORD_KEY, seat);
+	daklakwl_record_write_varint(recorder->file, key);
+	daklakwl_record_write_varint(recorder->file, state);
+}
+
+void daklakwl_recorder_modifiers(struct daklakwl_recorder *recorder,
+				 uint32_t seat, uint32_t depressed,
+				 uint32_t latched, uint32_t locked,
+				 uint32_t group)
+{
+	daklakwl_recorder_begin(recorder, DAKLAKWL_RECORD_MODIFIERS, seat);
+	daklakwl_record_write_varint(recorder->file, depressed);
+	daklakwl_record_write_varint(recorder->file, latched);
+	daklakwl_record_write_varint(recorder->file, locked);
+	daklakwl_record_write_varint(recorder->file, group);
+}
+
+bool daklakwl_record_read_header(FILE *file)
+{
+	char magic[sizeof DAKLAKWL_RECORD_MAGIC - 1];
+	return fread(magic, sizeof magic, 1, file) == 1
+	       && memcmp(magic, DAKLAKWL_RECORD_MAGIC, sizeof magic) == 0;
+}
+
+bool daklakwl_record_read(FILE *file, struct daklakwl_record_event *event)
+{
+	int type = getc(file);
+	if (type == EOF || !daklakwl_record_read_u32(file, &event->seat)
+	    || !daklakwl_record_read_varint(file, &event->delta_us))
+		return false;
+	event->type = type;
+	switch (type) {
+	case DAKLAKWL_RECORD_KEYMAP:
+		if (!daklakwl_record_read_u32(file, &event->keymap.size)
+		    || event->keymap.size > DAKLAKWL_RECORD_MAX_KEYMAP)
+			return false;
+		event->keymap.data = malloc(event->keymap.size);
+		if (event->keymap.data == NULL
+		    || fread(event->keymap.data, 1, event->keymap.size, file)
+			   != event->keymap.size) {
+			free(event->keymap.data);
+			return false;
+		}
+		return true;
+	case DAKLAKWL_RECORD_KEY:
+		return daklakwl_record_read_u32(file, &event->key.key)
+		       && daklakwl_record_read_u32(file, &event->key.state);
+	case DAKLAKWL_RECORD_MODIFIERS:
+		return daklakwl_record_read_u32(file,
+						&event->modifiers.depressed)
+		       && daklakwl_record_read_u32(file,
+						   &event->modifiers.latched)
+		       && daklakwl_record_read_u32(file,
+						   &event->modifiers.locked)
+		       && daklakwl_record_read_u32(file,
+						   &event->modifiers.group);
+	default:
+		return false;
+	}
+}
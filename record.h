@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Log of what the keyboard grab received, for replaying real typing into
+// daklak-bench. Only keymaps, keys and modifiers are kept, never text
+// daklak produced; the keys still spell out what was typed, so the log
+// is created readable only by its owner and keys typed into password or
+// other sensitive fields are left out.
+//
+// After the magic every event is a type byte followed by LEB128 varints:
+// the seat, microseconds since the previous event, then
+//	KEYMAP		size, size bytes of keymap text
+//	KEY		key, state
+//	MODIFIERS	depressed, latched, locked, group
+
+#define DAKLAKWL_RECORD_MAGIC "DAKREC1\n"
+
+enum daklakwl_record_type {
+	DAKLAKWL_RECORD_KEYMAP,
+	DAKLAKWL_RECORD_KEY,
+	DAKLAKWL_RECORD_MODIFIERS,
+};
+
+struct daklakwl_recorder {
+	FILE *file;
+	// CLOCK_MONOTONIC of the last event, in microseconds
+	uint64_t last;
+};
+
+struct daklakwl_record_event {
+	enum daklakwl_record_type type;
+	uint32_t seat;
+	uint64_t delta_us;
+	union {
+		struct {
+			char *data;
+			uint32_t size;
+		} keymap;
+		struct {
+			uint32_t key, state;
+		} key;
+		struct {
+			uint32_t depressed, latched, locked, group;
+		} modifiers;
+	};
+};
+
+bool daklakwl_recorder_open(struct daklakwl_recorder *, char const *path);
+void daklakwl_recorder_close(struct daklakwl_recorder *);
+void daklakwl_recorder_keymap(struct daklakwl_recorder *, uint32_t seat,
+			      char const *data, uint32_t size);
+void daklakwl_recorder_key(struct daklakwl_recorder *, uint32_t seat,
+			   uint32_t key, uint32_t state);
+void daklakwl_recorder_modifiers(struct daklakwl_recorder *, uint32_t seat,
+				 uint32_t depressed, uint32_t latched,
+				 uint32_t locked, uint32_t group);
+
+// Checks the magic at the start of a log.
+bool daklakwl_record_read_header(FILE *);
+// Reads the next event, false at the end of the log or on a bad one.
+// A keymap's data is malloc'd and belongs to the caller.
+bool daklakwl_record_read(FILE *, struct daklakwl_record_event *);
@@ -0,0 +1,162 @@
+#include "reload.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+bool daklakwl_reload_init(struct daklakwl_reload *reload, char const *path)
+{
+	snprintf(reload->path, sizeof reload->path, "%s", path);
+	char const *slash = strrchr(reload->path, '/');
+	if (slash == NULL)
+		return false;
+	reload->name = slash + 1;
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof dir, "%.*s", (int)(slash - reload->path),
+		 reload->path);
+
+	reload->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (reload->fd == -1) {
+		perror("inotify_init1");
+		return false;
+	}
+	if (inotify_add_watch(reload->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)
+	    == -1) {
+		// no config directory is the usual case, not worth a word
+		if (errno != ENOENT)
+			fprintf(stderr, "cannot watch %s: %s\n", dir,
+				strerror(errno));
+		close(reload->fd);
+		reload->fd = -1;
+		return false;
+	}
+	return daklakwl_channel_init(&reload->done);
+}
+
+void daklakwl_reload_finish(struct daklakwl_reload *reload,
+			    struct daklakwl_keymap_cache *cache)
+{
+	if (reload->busy) {
+		pthread_join(reload->thread, NULL);
+		reload->busy = false;
+		uint64_t message;
+		if (daklakwl_channel_receive(&reload->done, &message))
+			daklakwl_reload_job_free(
+			    (struct daklakwl_reload_job *)(uintptr_t)message,
+			    cache);
+	}
+	if (reload->fd != -1)
+		close(reload->fd);
+	reload->fd = -1;
+	daklakwl_channel_finish(&reload->done);
+}
+
+bool daklakwl_reload_changed(struct daklakwl_reload *reload)
+{
+	char buffer[4096]
+	    __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+	while ((len = read(reload->fd, buffer, sizeof buffer)) > 0) {
+		struct inotify_event const *event;
+		for (char const *p = buffer; p < buffer + len;
+		     p += sizeof *event + event->len) {
+			event = (struct inotify_event const *)p;
+			if (event->len != 0
+			    && strcmp(event->name, reload->name) == 0)
+				changed = true;
+		}
+	}
+	return changed;
+}
+
+static void *daklakwl_reload_worker(void *data)
+{
+	struct daklakwl_reload_job *job = data;
+	job->ok = daklakwl_config_read(&job->config, job->reload->path)
+		  && daklakwl_shortcuts_compile(&job->shortcuts,
+						&job->config.shortcuts);
+	for (size_t i = 0; job->ok && i < job->keymaps_len; i++) {
+		struct daklakwl_reload_keymap *entry = &job->keymaps[i];
+		if (entry->xkb_state == NULL) {
+			job->ok = false;
+			break;
+		}
+		daklakwl_keymap_bindings_build(
+		    entry->keymap, entry->xkb_state, &job->config,
+		    &entry->composing_bindings, &entry->global_bindings);
+	}
+	job->compiled = daklakwl_metrics_now();
+	daklakwl_channel_send(&job->reload->done, (uintptr_t)job);
+	return NULL;
+}
+
+void daklakwl_reload_start(struct daklakwl_reload *reload,
+			   struct daklakwl_keymap_cache *cache)
+{
+	if (reload->busy) {
+		reload->again = true;
+		return;
+	}
+	reload->again = false;
+	struct daklakwl_reload_job *job = calloc(
+	    1, sizeof *job + cache->keymaps_len * sizeof *job->keymaps);
+	if (job == NULL) {
+		perror("calloc");
+		return;
+	}
+	job->reload = reload;
+	job->start = daklakwl_metrics_now();
+	daklakwl_config_init(&job->config);
+	daklakwl_shortcuts_init(&job->shortcuts);
+	struct daklakwl_keymap *keymap;
+	wl_list_for_each(keymap, &cache->keymaps, link)
+	{
+		struct daklakwl_reload_keymap *entry
+		    = &job->keymaps[job->keymaps_len++];
+		keymap->refs++;
+		entry->keymap = keymap;
+		// xkb reference counts are not atomic, so the worker must not
+		// take any
+		entry->xkb_state = xkb_state_new(keymap->xkb_keymap);
+	}
+	int err = pthread_create(&reload->thread, NULL, daklakwl_reload_worker,
+				 job);
+	if (err != 0) {
+		fprintf(stderr, "cannot reload config: %s\n", strerror(err));
+		daklakwl_reload_job_free(job, cache);
+		return;
+	}
+	reload->busy = true;
+}
+
+struct daklakwl_reload_job *daklakwl_reload_take(struct daklakwl_reload *reload)
+{
+	uint64_t message;
+	daklakwl_channel_ack(&reload->done);
+	if (!daklakwl_channel_receive(&reload->done, &message))
+		return NULL;
+	pthread_join(reload->thread, NULL);
+	reload->busy = false;
+	return (struct daklakwl_reload_job *)(uintptr_t)message;
+}
+
+void daklakwl_reload_job_free(struct daklakwl_reload_job *job,
+			      struct daklakwl_keymap_cache *cache)
+{
+	for (size_t i = 0; i < job->keymaps_len; i++) {
+		struct daklakwl_reload_keymap *entry = &job->keymaps[i];
+		daklakwl_binding_table_finish(&entry->composing_bindings);
+		daklakwl_binding_table_finish(&entry->global_bindings);
+		xkb_state_unref(entry->xkb_state);
+		daklakwl_keymap_unref(cache, entry->keymap);
+	}
+	daklakwl_config_finish(&job->config);
+	daklakwl_shortcuts_finish(&job->shortcuts);
+	free(job);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "channel.h"
+#include "config.h"
+#include "keymap.h"
+#include "shortcut.h"
+
+// Watches the config file and rebuilds everything compiled from it on a
+// worker thread, so all the main thread does is swap pointers between two
+// events once the new tables are ready.
+
+struct daklakwl_reload_keymap {
+	// held with a reference so the cache cannot evict it meanwhile
+	struct daklakwl_keymap *keymap;
+	// made on the main thread for the worker to use
+	struct xkb_state *xkb_state;
+	struct daklakwl_binding_table composing_bindings, global_bindings;
+};
+
+// Everything compiled from one read of the config. Once swapped in it
+// holds what it replaced, which goes away with the job.
+struct daklakwl_reload_job {
+	struct daklakwl_reload *reload;
+	bool ok;
+	// CLOCK_MONOTONIC nanoseconds when the file change was seen and when
+	// the worker was done with it
+	uint64_t start, compiled;
+	struct daklakwl_config config;
+	struct daklakwl_shortcuts shortcuts;
+	size_t keymaps_len;
+	struct daklakwl_reload_keymap keymaps[];
+};
+
+struct daklakwl_reload {
+	// inotify on the config's directory rather than the file, so editors
+	// that save by renaming a new file over the old one are seen too
+	int fd;
+	char path[PATH_MAX];
+	// file name within the directory
+	char const *name;
+	// the worker hands its finished job back here
+	struct daklakwl_channel done;
+	pthread_t thread;
+	bool busy;
+	// the file changed again while a job was running
+	bool again;
+};
+
+bool daklakwl_reload_init(struct daklakwl_reload *, char const *path);
+void daklakwl_reload_finish(struct daklakwl_reload *,
+			    struct daklakwl_keymap_cache *);
+// Drains the inotify events, true if the config file was written.
+bool daklakwl_reload_changed(struct daklakwl_reload *);
+// Starts a job covering every cached keymap, or owes one if a job is
+// already running.
+void daklakwl_reload_start(struct daklakwl_reload *,
+			   struct daklakwl_keymap_cache *);
+// The job the worker finished, NULL if it is not done yet.
+struct daklakwl_reload_job *daklakwl_reload_take(struct daklakwl_reload *);
+void daklakwl_reload_job_free(struct daklakwl_reload_job *,
+			      struct daklakwl_keymap_cache *);
@@ -0,0 +1,169 @@
+#include "shortcut.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int daklakwl_shortcut_class(char c)
+{
+	if (c >= 'a' && c <= 'z')
+		return c - 'a';
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	return -1;
+}
+
+void daklakwl_shortcuts_init(struct daklakwl_shortcuts *shortcuts)
+{
+	memset(shortcuts, 0, sizeof *shortcuts);
+}
+
+void daklakwl_shortcuts_finish(struct daklakwl_shortcuts *shortcuts)
+{
+	for (size_t i = 0; i < shortcuts->expansions_len; i++)
+		free(shortcuts->expansions[i]);
+	free(shortcuts->expansions);
+	free(shortcuts->next);
+	free(shortcuts->output);
+	free(shortcuts->depth);
+	memset(shortcuts, 0, sizeof *shortcuts);
+}
+
+bool daklakwl_shortcuts_compile(struct daklakwl_shortcuts *shortcuts,
+				struct wl_array const *list)
+{
+	daklakwl_shortcuts_finish(shortcuts);
+	size_t len = list->size / sizeof(struct daklakwl_shortcut);
+	struct daklakwl_shortcut const *items = list->data;
+
+	size_t cap = 1;
+	for (size_t i = 0; i < len; i++)
+		cap += strlen(items[i].abbreviation);
+	shortcuts->next = malloc(cap * DAKLAKWL_SHORTCUT_CLASSES
+				 * sizeof *shortcuts->next);
+	shortcuts->output = malloc(cap * sizeof *shortcuts->output);
+	shortcuts->depth = malloc(cap * sizeof *shortcuts->depth);
+	shortcuts->expansions = calloc(len ? len : 1,
+				       sizeof *shortcuts->expansions);
+	if (!shortcuts->next || !shortcuts->output || !shortcuts->depth
+	    || !shortcuts->expansions) {
+		perror("failed to allocate shortcuts");
+		daklakwl_shortcuts_finish(shortcuts);
+		return false;
+	}
+	// 0 doubles as "no edge" while building the trie, since nothing
+	// points back at the root before failure links are filled in.
+	memset(shortcuts->next, 0,
+	       cap * DAKLAKWL_SHORTCUT_CLASSES * sizeof *shortcuts->next);
+	shortcuts->output[0] = -1;
+	shortcuts->depth[0] = 0;
+	shortcuts->states_len = 1;
+
+	for (size_t i = 0; i < len; i++) {
+		char const *c = items[i].abbreviation;
+		uint32_t state = DAKLAKWL_SHORTCUT_ROOT;
+		for (; *c; c++) {
+			int class = daklakwl_shortcut_class(*c);
+			if (class < 0)
+				break;
+			uint32_t *edge
+			    = &shortcuts->next[state * DAKLAKWL_SHORTCUT_CLASSES
+					       + class];
+			if (*edge == 0) {
+				*edge = shortcuts->states_len++;
+				shortcuts->output[*edge] = -1;
+				shortcuts->depth[*edge]
+				    = shortcuts->depth[state] + 1;
+			}
+			state = *edge;
+		}
+		if (*c || state == DAKLAKWL_SHORTCUT_ROOT) {
+			fprintf(stderr,
+				"shortcut '%s' must be letters only, "
+				"ignoring\n",
+				items[i].abbreviation);
+			continue;
+		}
+		// later definitions win, like the rest of the config
+		if (shortcuts->output[state] >= 0) {
+			free(shortcuts->expansions[shortcuts->output[state]]);
+			shortcuts->expansions[shortcuts->output[state]]
+			    = strdup(items[i].expansion);
+			continue;
+		}
+		shortcuts->output[state] = shortcuts->expansions_len;
+		shortcuts->expansions[shortcuts->expansions_len++]
+		    = strdup(items[i].expansion);
+	}
+
+	// Breadth-first pass turning the trie into a DFA: a missing edge
+	// takes the same edge from the failure state instead.
+	uint32_t *queue = malloc(shortcuts->states_len * sizeof *queue);
+	uint32_t *fail = malloc(shortcuts->states_len * sizeof *fail);
+	if (queue == NULL || fail == NULL) {
+		perror("failed to allocate shortcuts");
+		free(queue);
+		free(fail);
+		daklakwl_shortcuts_finish(shortcuts);
+		return false;
+	}
+	size_t head = 0, tail = 0;
+	uint32_t *root = shortcuts->next;
+	for (int class = 0; class < DAKLAKWL_SHORTCUT_CLASSES; class++) {
+		if (root[class] != 0) {
+			fail[root[class]] = DAKLAKWL_SHORTCUT_ROOT;
+			queue[tail++] = root[class];
+		}
+	}
+	while (head < tail) {
+		uint32_t state = queue[head++];
+		uint32_t *edges
+		    = &shortcuts->next[state * DAKLAKWL_SHORTCUT_CLASSES];
+		uint32_t const *fallback
+		    = &shortcuts->next[fail[state] * DAKLAKWL_SHORTCUT_CLASSES];
+		for (int class = 0; class < DAKLAKWL_SHORTCUT_CLASSES;
+		     class++) {
+			uint32_t child = edges[class];
+			if (child != 0
+			    && shortcuts->depth[child]
+				   == shortcuts->depth[state] + 1) {
+				fail[child] = fallback[class];
+				queue[tail++] = child;
+			}
+			else
+				edges[class] = fallback[class];
+		}
+	}
+	free(queue);
+	free(fail);
+	return true;
+}
+
+uint32_t daklakwl_shortcuts_feed(struct daklakwl_shortcuts const *shortcuts,
+				 uint32_t state, char c)
+{
+	int class = daklakwl_shortcut_class(c);
+	if (shortcuts->next == NULL || class < 0)
+		return DAKLAKWL_SHORTCUT_ROOT;
+	return shortcuts->next[state * DAKLAKWL_SHORTCUT_CLASSES + class];
+}
+
+uint32_t daklakwl_shortcuts_walk(struct daklakwl_shortcuts const *shortcuts,
+				 char const *keys)
+{
+	uint32_t state = DAKLAKWL_SHORTCUT_ROOT;
+	for (; *keys; keys++)
+		state = daklakwl_shortcuts_feed(shortcuts, state, *keys);
+	return state;
+}
+
+char const *daklakwl_shortcuts_match(struct daklakwl_shortcuts const *shortcuts,
+				     uint32_t state, size_t keys_len)
+{
+	// Only a whole-word match expands: "ko" fires for "ko" but not for
+	// the tail of "loko".
+	if (shortcuts->output == NULL || shortcuts->output[state] < 0
+	    || shortcuts->depth[state] != keys_len)
+		return NULL;
+	return shortcuts->expansions[shortcuts->output[state]];
+}
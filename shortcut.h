@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client-core.h>
+
+#define DAKLAKWL_SHORTCUT_CLASSES 26
+#define DAKLAKWL_SHORTCUT_ROOT 0
+
+struct daklakwl_shortcut {
+	char *abbreviation;
+	char *expansion;
+};
+
+// Abbreviations compiled into an Aho-Corasick automaton whose failure
+// links are folded into a dense transition table, so feeding a key is a
+// single lookup however many shortcuts exist. Keys are folded to a-z.
+struct daklakwl_shortcuts {
+	uint32_t *next;
+	int32_t *output;
+	uint16_t *depth;
+	size_t states_len;
+	char **expansions;
+	size_t expansions_len;
+};
+
+void daklakwl_shortcuts_init(struct daklakwl_shortcuts *);
+bool daklakwl_shortcuts_compile(struct daklakwl_shortcuts *,
+				struct wl_array const *shortcuts);
+void daklakwl_shortcuts_finish(struct daklakwl_shortcuts *);
+uint32_t daklakwl_shortcuts_feed(struct daklakwl_shortcuts const *,
+				 uint32_t state, char c);
+uint32_t daklakwl_shortcuts_walk(struct daklakwl_shortcuts const *,
+				 char const *keys);
+char const *daklakwl_shortcuts_match(struct daklakwl_shortcuts const *,
+				     uint32_t state, size_t keys_len);
@@ -0,0 +1,141 @@
+// Types words through an engine the way a seat does and checks what
+// would be committed for them.
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "dict.h"
+#include "engine.h"
+#include "word.h"
+
+static struct daklakwl_bloom english;
+static struct daklakwl_dict dict;
+static struct daklakwl_shortcuts shortcuts;
+static int failures;
+
+static void type(struct daklakwl_buffer *buffer,
+		 struct daklakwl_engine const *engine, char const *keys)
+{
+	engine->reset(buffer);
+	for (; *keys; keys++) {
+		char utf8[2] = {*keys, '\0'};
+		if (engine->feed(buffer, utf8) == DAKLAKWL_ENGINE_PASS)
+			engine->reset(buffer);
+	}
+}
+
+static void check_restore(char const *keys, bool restore)
+{
+	struct daklakwl_buffer buffer = {0};
+	daklakwl_buffer_init(&buffer);
+	type(&buffer, &daklakwl_engine_telex, keys);
+	char text[DAKLAKWL_WORD_MAX];
+	daklakwl_word_get(&buffer, buffer.text, text);
+	bool restored
+	    = daklakwl_word_should_restore(&buffer, &english, &dict);
+	if (restored != restore) {
+		fprintf(stderr, "%s: composed to %s, %s\n", keys, text,
+			restored ? "restored" : "not restored");
+		failures++;
+	}
+	daklakwl_buffer_destroy(&buffer);
+}
+
+static void check_candidate(char const *keys, char const *expected)
+{
+	struct daklakwl_buffer buffer = {0};
+	daklakwl_buffer_init(&buffer);
+	type(&buffer, &daklakwl_engine_telex, keys);
+	char word[DAKLAKWL_WORD_MAX];
+	struct daklakwl_dict_candidate candidates[DAKLAKWL_DICT_TOPK];
+	size_t len = 0;
+	if (daklakwl_word_get(&buffer, buffer.text, word))
+		len = daklakwl_dict_lookup(&dict, word, candidates,
+					   DAKLAKWL_DICT_TOPK);
+	bool found = false;
+	for (size_t i = 0; i < len; i++)
+		found |= strcmp(candidates[i].text, expected) == 0;
+	if (!found) {
+		fprintf(stderr, "%s: %s not offered\n", keys, expected);
+		failures++;
+	}
+	daklakwl_buffer_destroy(&buffer);
+}
+
+// expected is NULL when the keys should not expand
+static void check_shortcut(char const *keys, char const *expected,
+			   size_t deleted)
+{
+	struct daklakwl_buffer buffer = {0};
+	daklakwl_buffer_init(&buffer);
+	type(&buffer, &daklakwl_engine_telex, keys);
+	char *expansion = daklakwl_word_shortcut_expand(
+	    &shortcuts, daklakwl_word_shortcut_walk(&shortcuts, &buffer),
+	    &buffer);
+	if ((expansion == NULL) != (expected == NULL)
+	    || (expected != NULL && strcmp(expansion, expected) != 0)) {
+		fprintf(stderr, "%s: expanded to %s\n", keys,
+			expansion ? expansion : "nothing");
+		failures++;
+	}
+	if (expected != NULL && strlen(buffer.prefix) != deleted) {
+		fprintf(stderr, "%s: %zu bytes to delete\n", keys,
+			strlen(buffer.prefix));
+		failures++;
+	}
+	free(expansion);
+	daklakwl_buffer_destroy(&buffer);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s VI_DICT EN_BLOOM\n", argv[0]);
+		return 1;
+	}
+	setlocale(LC_CTYPE, "C.UTF-8");
+	if (!daklakwl_dict_open(&dict, argv[1])
+	    || !daklakwl_bloom_open(&english, argv[2]))
+		return 1;
+
+	// English words Telex mangles are kept as typed
+	check_restore("text", true);
+	check_restore("Text", true);
+	// unless Telex made a Vietnamese word of them
+	check_restore("car", false);
+	check_restore("Car", false);
+	check_restore("bas", false);
+	check_restore("as", false);
+	check_restore("tieengs", false);
+
+	// completions start with the consonants the client already has
+	check_candidate("cos", "có");
+	check_candidate("khoon", "không");
+
+	struct daklakwl_shortcut list[] = {
+	    {"ko", "không"},
+	    {"dc", "được"},
+	};
+	struct wl_array array = {
+	    .size = sizeof list,
+	    .alloc = sizeof list,
+	    .data = list,
+	};
+	daklakwl_shortcuts_init(&shortcuts);
+	if (!daklakwl_shortcuts_compile(&shortcuts, &array))
+		return 1;
+	// the k already went to the client and has to be deleted
+	check_shortcut("ko", "không", 1);
+	check_shortcut("Ko", "Không", 1);
+	check_shortcut("dc", "được", 0);
+	check_shortcut("loko", NULL, 0);
+	check_shortcut("k", NULL, 0);
+	daklakwl_shortcuts_finish(&shortcuts);
+
+	daklakwl_bloom_close(&english);
+	daklakwl_dict_close(&dict);
+	return failures != 0;
+}
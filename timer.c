@@ -0,0 +1,192 @@
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <wayland-util.h>
+
+void daklakwl_timespec_add_ns(struct timespec *ts, int64_t ns)
+{
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec += ns % 1000000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= 1000000000;
+	}
+	else if (ts->tv_nsec < 0) {
+		ts->tv_sec -= 1;
+		ts->tv_nsec += 1000000000;
+	}
+}
+
+static bool daklakwl_timespec_before(struct timespec const *a,
+				     struct timespec const *b)
+{
+	return a->tv_sec < b->tv_sec
+	       || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void daklakwl_timers_set(struct daklakwl_timers *timers, size_t i,
+				struct daklakwl_timer *timer)
+{
+	timers->heap[i] = timer;
+	timer->index = i + 1;
+}
+
+static void daklakwl_timers_sift_up(struct daklakwl_timers *timers, size_t i)
+{
+	struct daklakwl_timer *timer = timers->heap[i];
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!daklakwl_timespec_before(&timer->time,
+					      &timers->heap[parent]->time))
+			break;
+		daklakwl_timers_set(timers, i, timers->heap[parent]);
+		i = parent;
+	}
+	daklakwl_timers_set(timers, i, timer);
+}
+
+static void daklakwl_timers_sift_down(struct daklakwl_timers *timers,
+				      size_t i)
+{
+	struct daklakwl_timer *timer = timers->heap[i];
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= timers->len)
+			break;
+		if (child + 1 < timers->len
+		    && daklakwl_timespec_before(&timers->heap[child + 1]->time,
+						&timers->heap[child]->time))
+			child++;
+		if (!daklakwl_timespec_before(&timers->heap[child]->time,
+					      &timer->time))
+			break;
+		daklakwl_timers_set(timers, i, timers->heap[child]);
+		i = child;
+	}
+	daklakwl_timers_set(timers, i, timer);
+}
+
+static void daklakwl_timers_remove(struct daklakwl_timers *timers,
+				   struct daklakwl_timer *timer)
+{
+	size_t i = timer->index - 1;
+	timer->index = 0;
+	struct daklakwl_timer *last = timers->heap[--timers->len];
+	if (i == timers->len)
+		return;
+	daklakwl_timers_set(timers, i, last);
+	if (i > 0
+	    && daklakwl_timespec_before(&last->time,
+					&timers->heap[(i - 1) / 2]->time))
+		daklakwl_timers_sift_up(timers, i);
+	else
+		daklakwl_timers_sift_down(timers, i);
+}
+
+static void daklakwl_timers_update(struct daklakwl_timers *timers)
+{
+	if (timers->dispatching)
+		return;
+	struct itimerspec spec = {0};
+	if (timers->len != 0) {
+		spec.it_value = timers->heap[0]->time;
+		// a zero it_value disarms, so nudge deadlines at the epoch
+		if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+			spec.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(timers->source.fd, TFD_TIMER_ABSTIME, &spec, NULL)
+	    == -1)
+		perror("timerfd_settime");
+}
+
+static void daklakwl_timers_callback(struct daklakwl_event_source *source,
+				     uint32_t events)
+{
+	struct daklakwl_timers *timers
+	    = wl_container_of(source, timers, source);
+	uint64_t expirations;
+	if (read(source->fd, &expirations, sizeof expirations) == -1)
+		return;
+	timers->wakeups++;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timers->dispatching = true;
+	while (timers->len != 0
+	       && !daklakwl_timespec_before(&now, &timers->heap[0]->time)) {
+		struct daklakwl_timer *timer = timers->heap[0];
+		daklakwl_timers_remove(timers, timer);
+		// may arm itself again
+		timer->callback(timer);
+	}
+	timers->dispatching = false;
+	daklakwl_timers_update(timers);
+}
+
+bool daklakwl_timers_init(struct daklakwl_timers *timers,
+			  struct daklakwl_loop *loop)
+{
+	memset(timers, 0, sizeof *timers);
+	timers->loop = loop;
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		perror("timerfd_create");
+		return false;
+	}
+	if (!daklakwl_loop_add(loop, &timers->source, fd, EPOLLIN,
+			       daklakwl_timers_callback)) {
+		close(fd);
+		return false;
+	}
+	return true;
+}
+
+void daklakwl_timers_finish(struct daklakwl_timers *timers)
+{
+	if (timers->loop) {
+		daklakwl_loop_remove(timers->loop, &timers->source);
+		close(timers->source.fd);
+	}
+	for (size_t i = 0; i < timers->len; i++)
+		timers->heap[i]->index = 0;
+	free(timers->heap);
+	memset(timers, 0, sizeof *timers);
+}
+
+void daklakwl_timer_arm(struct daklakwl_timers *timers,
+			struct daklakwl_timer *timer, struct timespec time)
+{
+	struct daklakwl_timer *first = timers->len ? timers->heap[0] : NULL;
+	struct timespec old = timer->time;
+	timer->time = time;
+	if (timer->index == 0) {
+		if (timers->len == timers->cap) {
+			timers->cap = timers->cap ? timers->cap * 2 : 8;
+			timers->heap = realloc(timers->heap,
+					       timers->cap * sizeof *timers->heap);
+		}
+		daklakwl_timers_set(timers, timers->len++, timer);
+		daklakwl_timers_sift_up(timers, timers->len - 1);
+	}
+	else if (daklakwl_timespec_before(&time, &old))
+		daklakwl_timers_sift_up(timers, timer->index - 1);
+	else
+		daklakwl_timers_sift_down(timers, timer->index - 1);
+	if (timers->heap[0] != first || first == timer)
+		daklakwl_timers_update(timers);
+}
+
+void daklakwl_timer_disarm(struct daklakwl_timers *timers,
+			   struct daklakwl_timer *timer)
+{
+	if (timer->index == 0)
+		return;
+	bool first = timer->index == 1;
+	daklakwl_timers_remove(timers, timer);
+	if (first)
+		daklakwl_timers_update(timers);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "loop.h"
+
+struct daklakwl_timer {
+	// absolute CLOCK_MONOTONIC deadline
+	struct timespec time;
+	// position in the heap plus one, 0 while not armed
+	size_t index;
+	void (*callback)(struct daklakwl_timer *timer);
+};
+
+// Min-heap of deadlines behind a single timerfd, which is always armed
+// for the earliest one and disarmed when the heap is empty, so an idle
+// daklak never wakes up.
+struct daklakwl_timers {
+	struct daklakwl_loop *loop;
+	struct daklakwl_event_source source;
+	struct daklakwl_timer **heap;
+	size_t len, cap;
+	bool dispatching;
+	uint64_t wakeups;
+};
+
+bool daklakwl_timers_init(struct daklakwl_timers *, struct daklakwl_loop *);
+void daklakwl_timers_finish(struct daklakwl_timers *);
+void daklakwl_timer_arm(struct daklakwl_timers *, struct daklakwl_timer *,
+			struct timespec time);
+void daklakwl_timer_disarm(struct daklakwl_timers *, struct daklakwl_timer *);
+void daklakwl_timespec_add_ns(struct timespec *, int64_t ns);
@@ -0,0 +1,98 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+bool daklakwl_trace_enabled;
+
+char const *const daklakwl_trace_stage_names[_DAKLAKWL_TRACE_LAST] = {
+    [DAKLAKWL_TRACE_GRAB_KEY] = "grab_key",
+    [DAKLAKWL_TRACE_BINDING] = "binding",
+    [DAKLAKWL_TRACE_RAW_APPEND] = "raw_append",
+    [DAKLAKWL_TRACE_COMPOSE] = "compose",
+    [DAKLAKWL_TRACE_PREEDIT] = "preedit",
+    [DAKLAKWL_TRACE_FLUSH] = "flush",
+    [DAKLAKWL_TRACE_TIMER] = "timer",
+};
+
+// allocated on first start and kept, so a dump after stopping still has
+// the records that led up to it
+static struct daklakwl_trace_record *daklakwl_trace_records;
+// records ever written; the ring holds the last DAKLAKWL_TRACE_RECORDS
+static uint64_t daklakwl_trace_written;
+
+bool daklakwl_trace_start(void)
+{
+	if (daklakwl_trace_records == NULL) {
+		daklakwl_trace_records = calloc(
+		    DAKLAKWL_TRACE_RECORDS, sizeof *daklakwl_trace_records);
+		if (daklakwl_trace_records == NULL) {
+			perror("calloc");
+			return false;
+		}
+	}
+	daklakwl_trace_enabled = true;
+	return true;
+}
+
+void daklakwl_trace_stop(void)
+{
+	daklakwl_trace_enabled = false;
+}
+
+void daklakwl_trace_record(uint32_t seat, enum daklakwl_trace_stage stage,
+			   uint64_t payload)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct daklakwl_trace_record *record
+	    = &daklakwl_trace_records[daklakwl_trace_written++
+				      % DAKLAKWL_TRACE_RECORDS];
+	record->time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	record->seat = seat;
+	record->stage = stage;
+	record->reserved = 0;
+	record->payload = payload;
+}
+
+bool daklakwl_trace_dump(char const *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+		      0600);
+	FILE *file = fd == -1 ? NULL : fdopen(fd, "w");
+	if (file == NULL) {
+		perror(path);
+		if (fd != -1)
+			close(fd);
+		return false;
+	}
+	uint64_t count = daklakwl_trace_written < DAKLAKWL_TRACE_RECORDS
+			     ? daklakwl_trace_written
+			     : DAKLAKWL_TRACE_RECORDS;
+	struct daklakwl_trace_header header = {
+	    .magic = DAKLAKWL_TRACE_MAGIC,
+	    .version = DAKLAKWL_TRACE_VERSION,
+	    .count = count,
+	};
+	// the oldest record sits right after the newest once it wrapped
+	size_t first = (daklakwl_trace_written - count) % DAKLAKWL_TRACE_RECORDS;
+	size_t tail = DAKLAKWL_TRACE_RECORDS - first;
+	if (tail > count)
+		tail = count;
+	bool ok = fwrite(&header, sizeof header, 1, file) == 1
+		  && fwrite(daklakwl_trace_records + first,
+			    sizeof *daklakwl_trace_records, tail, file)
+			 == tail
+		  && fwrite(daklakwl_trace_records,
+			    sizeof *daklakwl_trace_records, count - tail, file)
+			 == count - tail;
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "failed to write trace to %s\n", path);
+	return ok;
+}
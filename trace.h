@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Ring of the most recent events on the key path, for finding out after
+// the fact why a key was slow. Off by default; a tracepoint then costs
+// one well-predicted branch. Main thread only.
+
+#define DAKLAKWL_TRACE_RECORDS (64 * 1024)
+// where SIGUSR1 dumps the ring when it stops tracing, in
+// $XDG_RUNTIME_DIR
+#define DAKLAKWL_TRACE_FILE "daklak.trace"
+#define DAKLAKWL_TRACE_MAGIC "DAKTRACE"
+#define DAKLAKWL_TRACE_VERSION 1
+
+enum daklakwl_trace_stage {
+	// payload: keycode | pressed << 16
+	DAKLAKWL_TRACE_GRAB_KEY,
+	// payload: the action bound to the key
+	DAKLAKWL_TRACE_BINDING,
+	// payload: first byte of the text appended
+	DAKLAKWL_TRACE_RAW_APPEND,
+	// payload: the key that fired the rule
+	DAKLAKWL_TRACE_COMPOSE,
+	// payload: preedit length in bytes
+	DAKLAKWL_TRACE_PREEDIT,
+	// payload: committed length in bytes
+	DAKLAKWL_TRACE_FLUSH,
+	// payload: repeat ticks applied
+	DAKLAKWL_TRACE_TIMER,
+	_DAKLAKWL_TRACE_LAST,
+};
+
+struct daklakwl_trace_record {
+	// CLOCK_MONOTONIC, nanoseconds
+	uint64_t time;
+	// wl_seat object id
+	uint32_t seat;
+	uint16_t stage;
+	uint16_t reserved;
+	uint64_t payload;
+};
+
+// A dump is this header followed by count records, oldest first, in host
+// byte order.
+struct daklakwl_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+};
+
+extern bool daklakwl_trace_enabled;
+extern char const *const daklakwl_trace_stage_names[_DAKLAKWL_TRACE_LAST];
+
+#define DAKLAKWL_TRACE(seat, stage, payload)                                   \
+	do {                                                                   \
+		if (__builtin_expect(daklakwl_trace_enabled, 0))               \
+			daklakwl_trace_record((seat), (stage), (payload));     \
+	} while (0)
+
+bool daklakwl_trace_start(void);
+void daklakwl_trace_stop(void);
+void daklakwl_trace_record(uint32_t seat, enum daklakwl_trace_stage,
+			   uint64_t payload);
+// Never follows a symlink at path, and a new file is only readable by us.
+bool daklakwl_trace_dump(char const *path);
@@ -3,8 +3,6 @@
 #include "tray.h"
 
 #include <stdio.h>
-#include <sys/socket.h>
-#include <sys/un.h>
 
 #include <glib.h>
 #include <gtk/gtk.h>
@@ -13,47 +11,37 @@
 #define ICON_NAME_EN "indicator-keyboard-En"
 #define ICON_NAME_VI "indicator-keyboard-Vi"
 
-static void handlecommand(gchar *sz, AppIndicator *indicator)
+static gboolean tray_channel_callback(GIOChannel *gio_channel,
+				      GIOCondition cond, gpointer data)
 {
-	if (g_ascii_strcasecmp(sz, "daklak_off\n") == 0) {
-		app_indicator_set_icon(indicator, ICON_NAME_EN);
+	struct indicator_state *istate = data;
+	struct daklakwl_channel *channel = &istate->state->to_tray;
+	uint64_t message;
+	daklakwl_channel_ack(channel);
+	while (daklakwl_channel_receive(channel, &message)) {
+		switch (message) {
+		case DAKLAKWL_TRAY_ON:
+			app_indicator_set_icon(istate->indicator,
+					       ICON_NAME_VI);
+			break;
+		case DAKLAKWL_TRAY_OFF:
+			app_indicator_set_icon(istate->indicator,
+					       ICON_NAME_EN);
+			break;
+		case DAKLAKWL_TRAY_QUIT:
+			gtk_main_quit();
+			return FALSE;
+		}
 	}
-	else if (g_ascii_strcasecmp(sz, "daklak_on\n") == 0) {
-		app_indicator_set_icon(indicator, ICON_NAME_VI);
-	}
-}
-
-static gboolean mycallback(GIOChannel *channel, GIOCondition cond,
-			   gpointer data)
-{
-	gchar *str_return;
-	gsize length;
-	gsize terminator_pos;
-	GError *error = NULL;
-	AppIndicator *indicator = data;
-	GIOStatus status = g_io_channel_read_line(channel, &str_return, &length,
-						  &terminator_pos, &error);
-	if (status != G_IO_STATUS_NORMAL) {
-		perror("read");
-		return TRUE;
-	}
-	if (error != NULL) {
-		printf("%s\n", error->message);
-		return TRUE;
-	}
-	handlecommand(str_return, indicator);
-	g_free(str_return);
 	return TRUE;
 }
 
 static void quit_activated(GSimpleAction *simple, GVariant *parameter,
 			   gpointer user_data)
 {
-	struct indicator_state *state;
-	state = user_data;
-	state->state->running = false;
-	close(state->sock_fd);
-	gtk_main_quit();
+	// the main thread stops and then tells us to quit
+	struct indicator_state *istate = user_data;
+	daklakwl_channel_send(&istate->state->from_tray, DAKLAKWL_TRAY_QUIT);
 }
 
 static GActionEntry app_entries[]
@@ -88,32 +76,19 @@ AppIndicator *gtr_icon_new(struct indicator_state *state)
 
 void run_tray(struct daklakwl_state *state)
 {
-	gtk_init(NULL, NULL);
-	int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sock_fd == -1) {
-		perror("socket");
-		exit(1);
-	}
-	struct sockaddr_un server;
-
-	memset(&server, 0, sizeof(server));
-	server.sun_family = AF_UNIX;
-	strncpy(server.sun_path, "/tmp/daklak.sock",
-		sizeof(server.sun_path) - 1);
-
-	if (connect(sock_fd, (struct sockaddr *)&server, sizeof(server))
-	    == -1) {
-		perror("connect");
-		exit(1);
+	// no tray without a display to show it on, e.g. under the bench
+	if (!gtk_init_check(NULL, NULL)) {
+		fprintf(stderr, "no display for the tray icon\n");
+		return;
 	}
 	struct indicator_state istate = {
 	    .state = state,
-	    .sock_fd = sock_fd,
 	};
-	AppIndicator *indicator = gtr_icon_new(&istate);
+	istate.indicator = gtr_icon_new(&istate);
 
-	GIOChannel *gio_channel = g_io_channel_unix_new(sock_fd);
-	g_io_add_watch(gio_channel, G_IO_IN, mycallback, (gpointer)indicator);
+	GIOChannel *gio_channel = g_io_channel_unix_new(state->to_tray.fd);
+	g_io_add_watch(gio_channel, G_IO_IN, tray_channel_callback, &istate);
 
 	gtk_main();
+	g_io_channel_unref(gio_channel);
 }
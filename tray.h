@@ -5,7 +5,7 @@
 
 struct indicator_state {
 	struct daklakwl_state *state;
-	int sock_fd;
+	AppIndicator *indicator;
 };
 
 AppIndicator *gtr_icon_new(struct indicator_state *);
@@ -0,0 +1,82 @@
+#include "word.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+bool daklakwl_word_get(struct daklakwl_buffer const *buffer, char const *part,
+		       char word[DAKLAKWL_WORD_MAX])
+{
+	size_t prefix_len = strlen(buffer->prefix);
+	size_t part_len = strlen(part);
+	if (prefix_len + part_len >= DAKLAKWL_WORD_MAX)
+		return false;
+	memcpy(word, buffer->prefix, prefix_len);
+	memcpy(word + prefix_len, part, part_len + 1);
+	return true;
+}
+
+bool daklakwl_word_fold(char word[DAKLAKWL_WORD_MAX])
+{
+	wchar_t wide[DAKLAKWL_WORD_MAX];
+	size_t len = mbstowcs(wide, word, DAKLAKWL_WORD_MAX);
+	if (len == (size_t)-1 || len == DAKLAKWL_WORD_MAX)
+		return false;
+	for (size_t i = 0; i < len; i++)
+		wide[i] = towlower(wide[i]);
+	// towlower keeps the UTF-8 length of every Vietnamese letter
+	return wcstombs(word, wide, DAKLAKWL_WORD_MAX) != (size_t)-1;
+}
+
+bool daklakwl_word_should_restore(struct daklakwl_buffer const *buffer,
+				  struct daklakwl_bloom const *english,
+				  struct daklakwl_dict const *dict)
+{
+	char raw[DAKLAKWL_WORD_MAX], text[DAKLAKWL_WORD_MAX];
+	return buffer->len != 0 && strcmp(buffer->raw, buffer->text) != 0
+	       && daklakwl_word_get(buffer, buffer->raw, raw)
+	       && daklakwl_word_get(buffer, buffer->text, text)
+	       && daklakwl_word_fold(raw) && daklakwl_word_fold(text)
+	       && daklakwl_bloom_contains(english, raw)
+	       && !daklakwl_dict_contains(dict, text);
+}
+
+uint32_t daklakwl_word_shortcut_walk(struct daklakwl_shortcuts const *shortcuts,
+				     struct daklakwl_buffer const *buffer)
+{
+	uint32_t state = DAKLAKWL_SHORTCUT_ROOT;
+	for (char const *c = buffer->prefix; *c; c++)
+		state = daklakwl_shortcuts_feed(shortcuts, state, *c);
+	for (char const *c = buffer->raw; *c; c++)
+		state = daklakwl_shortcuts_feed(shortcuts, state, *c);
+	return state;
+}
+
+char *daklakwl_word_shortcut_expand(struct daklakwl_shortcuts const *shortcuts,
+				    uint32_t state,
+				    struct daklakwl_buffer const *buffer)
+{
+	char const *expansion = daklakwl_shortcuts_match(
+	    shortcuts, state, strlen(buffer->prefix) + strlen(buffer->raw));
+	if (expansion == NULL)
+		return NULL;
+	char *text = strdup(expansion);
+	if (text == NULL)
+		return NULL;
+	char first = buffer->prefix[0] != '\0' ? buffer->prefix[0]
+						 : buffer->raw[0];
+	wchar_t wc;
+	mbstate_t ps = {0};
+	size_t len = mbrtowc(&wc, text, strlen(text), &ps);
+	if (first >= 'A' && first <= 'Z' && len != (size_t)-1
+	    && len != (size_t)-2 && len != 0) {
+		char upper[MB_LEN_MAX];
+		memset(&ps, 0, sizeof ps);
+		size_t upper_len = wcrtomb(upper, towupper(wc), &ps);
+		if (upper_len == len)
+			memcpy(text, upper, len);
+	}
+	return text;
+}
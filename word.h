@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bloom.h"
+#include "buffer.h"
+#include "dict.h"
+#include "shortcut.h"
+
+// The word being composed as the client sees it. Both typing methods send
+// the consonants before the first vowel on as they are typed, so the
+// buffer's text and raw keys start after them; these put them back.
+
+#define DAKLAKWL_WORD_MAX 64
+
+// The buffer's prefix followed by part, false if that does not fit.
+bool daklakwl_word_get(struct daklakwl_buffer const *, char const *part,
+		       char word[DAKLAKWL_WORD_MAX]);
+// Lowercases word in place, as both word lists and the learned words are.
+bool daklakwl_word_fold(char word[DAKLAKWL_WORD_MAX]);
+// Whether to commit the keys as typed instead: only words the typing
+// method changed count, and a real Vietnamese word wins over an English
+// one spelled the same way ("car" → "cả" stays, "text" → "tẽt" does
+// not).
+bool daklakwl_word_should_restore(struct daklakwl_buffer const *,
+				  struct daklakwl_bloom const *english,
+				  struct daklakwl_dict const *dict);
+// The shortcut automaton state after every key of the word.
+uint32_t daklakwl_word_shortcut_walk(struct daklakwl_shortcuts const *,
+				     struct daklakwl_buffer const *);
+// The expansion of the whole word if it is an abbreviation, capitalized
+// like the word ("Ko" → "Không"), NULL otherwise. The caller frees it.
+char *daklakwl_word_shortcut_expand(struct daklakwl_shortcuts const *,
+				    uint32_t state,
+				    struct daklakwl_buffer const *);